@@ -4,9 +4,11 @@
 
 #include <iostream>
 #include <fstream>
+#include <sstream>
 
 #include "io.h"
 #include "utils.h"
+#include "worker_pool.h"
 
 using namespace dynet;
 using namespace std;
@@ -20,6 +22,7 @@ int main(int argc, char** argv) {
   ("model", po::value<string>()->required(), "model file, as output by train")
   ("input_source", po::value<string>()->required(), "input file source")
   ("input_target", po::value<string>()->required(), "input file target")
+  ("threads,j", po::value<unsigned>()->default_value(1), "Number of sentences to align in parallel. Each runs in its own forked process")
   ("help", "Display this help message");
 
   po::positional_options_description positional_options;
@@ -38,6 +41,7 @@ int main(int argc, char** argv) {
   po::notify(vm);
 
   const string model_filename = vm["model"].as<string>();
+  const unsigned threads = vm["threads"].as<unsigned>();
 
   InputReader* input_reader = nullptr;
   OutputReader* output_reader = nullptr;
@@ -50,26 +54,29 @@ int main(int argc, char** argv) {
   vector<InputSentence*> source_sentences = input_reader->Read(vm["input_source"].as<string>());
   vector<OutputSentence*> target_sentences = output_reader->Read(vm["input_target"].as<string>());
   assert (source_sentences.size() == target_sentences.size());
-  for (unsigned sentence_number = 0; sentence_number < source_sentences.size(); ++sentence_number) {
+  auto align = [&](unsigned sentence_number, const string&) {
     InputSentence* source = source_sentences[sentence_number];
     OutputSentence* target = target_sentences[sentence_number];
-
     ComputationGraph cg;
     vector<Expression> alignment = translator.Align(source, target, cg);
     assert (alignment.size() > 0);
 
-    unsigned j = 0;
+    ostringstream out;
     for (Expression a : alignment) {
       vector<float> v = as_vector(a.value());
       for (unsigned i = 0; i < v.size(); ++i) {
-        cout << (i == 0 ? "" : " ") << v[i];
+        out << (i == 0 ? "" : " ") << v[i];
       }
-      cout << endl;
-      ++j;
+      out << endl;
     }
-    cout << endl;
+    out << endl;
+    return out.str();
+  };
+  auto emit = [](unsigned sentence_number, const string& alignment) {
+    cout << alignment;
     cout.flush();
-  }
+  };
+  RunOrdered(source_sentences.size(), threads, align, emit);
 
   return 0;
 }
@@ -0,0 +1,319 @@
+#include "dynet/dynet.h"
+#include "dynet/expr.h"
+#include <boost/program_options.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <random>
+
+#include "attention.h"
+#include "utils.h"
+
+using namespace dynet;
+using namespace dynet::expr;
+using namespace std;
+namespace po = boost::program_options;
+
+// Checks the fused additive_attention_softmax node against the plain
+// additive_attention + softmax path. For each case, builds the same graph with
+// fused_softmax off and on, with identical parameters, and compares the
+// alignments and the parameter gradients. The fused gradients are also
+// checked against finite differences of the loss. Also checks that local
+// attention picks the same window at each step whether it's called once per
+// step or once per hypothesis, as in beam search. Exits with status 1 if
+// anything is off by more than the tolerance.
+
+// One configuration to check. With a single source length the sentence goes
+// through NewSentence, and with several they form a padded, masked batch.
+struct Case {
+  unsigned hidden_size;
+  vector<unsigned> source_lengths;
+};
+
+// Random inputs shared by both models
+struct CaseData {
+  vector<vector<float>> encodings; // one per source position, batch elements side by side
+  vector<vector<float>> states; // one per target position, likewise
+  vector<float> r; // the loss is sum_t r^T context_t, over the whole batch
+};
+
+vector<float> RandomVector(unsigned dim, mt19937& rng) {
+  normal_distribution<float> normal(0.0f, 1.0f);
+  vector<float> v(dim);
+  for (float& x : v) {
+    x = normal(rng);
+  }
+  return v;
+}
+
+CaseData RandomData(const Case& c, unsigned input_dim, unsigned state_dim, unsigned target_length, mt19937& rng) {
+  const unsigned batch_size = c.source_lengths.size();
+  const unsigned max_length = *max_element(c.source_lengths.begin(), c.source_lengths.end());
+  CaseData data;
+  for (unsigned i = 0; i < max_length; ++i) {
+    data.encodings.push_back(RandomVector(input_dim * batch_size, rng));
+  }
+  for (unsigned t = 0; t < target_length; ++t) {
+    data.states.push_back(RandomVector(state_dim * batch_size, rng));
+  }
+  data.r = RandomVector(input_dim, rng);
+  return data;
+}
+
+// Builds the graph for c and returns the loss. If alignments is not null, the
+// alignment of each target position is appended to it. If backward is set, the
+// parameter gradients are left in the model.
+float Loss(StandardAttentionModel& attention_model, const Case& c, const CaseData& data, bool backward, vector<float>* alignments) {
+  const unsigned batch_size = c.source_lengths.size();
+  const unsigned input_dim = data.r.size();
+  const unsigned state_dim = data.states[0].size() / batch_size;
+
+  ComputationGraph cg;
+  attention_model.NewGraph(cg);
+  LinearSentence source;
+  if (batch_size == 1) {
+    source.resize(c.source_lengths[0]);
+    attention_model.NewSentence(&source);
+  }
+  else {
+    attention_model.NewBatch(c.source_lengths);
+  }
+
+  vector<Expression> inputs(data.encodings.size());
+  for (unsigned i = 0; i < inputs.size(); ++i) {
+    inputs[i] = input(cg, Dim({input_dim}, batch_size), data.encodings[i]);
+  }
+  Expression r = input(cg, {1, input_dim}, data.r);
+
+  vector<Expression> losses;
+  vector<Expression> step_alignments;
+  for (const vector<float>& s : data.states) {
+    Expression state = input(cg, Dim({state_dim}, batch_size), s);
+    Expression context = attention_model.GetContext(inputs, state);
+    step_alignments.push_back(attention_model.GetLastAlignment());
+    losses.push_back(sum_batches(r * context));
+  }
+  Expression loss = sum(losses);
+  const float value = as_scalar(cg.forward(loss));
+
+  if (alignments != nullptr) {
+    for (Expression& a : step_alignments) {
+      vector<float> v = as_vector(a.value());
+      alignments->insert(alignments->end(), v.begin(), v.end());
+    }
+  }
+  if (backward) {
+    cg.backward(loss);
+  }
+  return value;
+}
+
+vector<vector<float>> Gradients(Model& model) {
+  vector<vector<float>> grads;
+  for (ParameterStorage* p : model.parameters_list()) {
+    grads.push_back(as_vector(p->g));
+  }
+  return grads;
+}
+
+// Largest |a - b| / max(1, |b|)
+float MaxError(const vector<float>& a, const vector<float>& b) {
+  assert (a.size() == b.size());
+  float error = 0.0f;
+  for (unsigned i = 0; i < a.size(); ++i) {
+    error = max(error, fabs(a[i] - b[i]) / max(1.0f, fabs(b[i])));
+  }
+  return error;
+}
+
+// Returns whether the case passed
+bool Check(const Case& c, unsigned target_length, unsigned fd_samples, float epsilon, float tolerance, float fd_tolerance, mt19937& rng) {
+  const unsigned hidden_size = c.hidden_size;
+  const unsigned input_dim = 2 * hidden_size;
+  const unsigned state_dim = hidden_size + 3;
+  const CaseData data = RandomData(c, input_dim, state_dim, target_length, rng);
+
+  Model plain_model;
+  StandardAttentionModel plain(plain_model, input_dim, state_dim, hidden_size, input_dim, false);
+  Model fused_model;
+  StandardAttentionModel fused(fused_model, input_dim, state_dim, hidden_size, input_dim, true);
+  const vector<ParameterStorage*>& plain_params = plain_model.parameters_list();
+  const vector<ParameterStorage*>& fused_params = fused_model.parameters_list();
+  assert (plain_params.size() == fused_params.size());
+  for (unsigned k = 0; k < plain_params.size(); ++k) {
+    assert (plain_params[k]->size() == fused_params[k]->size());
+    memcpy(fused_params[k]->values.v, plain_params[k]->values.v, plain_params[k]->size() * sizeof(float));
+  }
+
+  vector<float> plain_alignments, fused_alignments;
+  plain_model.reset_gradient();
+  fused_model.reset_gradient();
+  Loss(plain, c, data, true, &plain_alignments);
+  Loss(fused, c, data, true, &fused_alignments);
+  const float forward_error = MaxError(fused_alignments, plain_alignments);
+
+  // Padding must get no attention at all
+  bool mask_ok = true;
+  const unsigned max_length = data.encodings.size();
+  for (unsigned t = 0; t < target_length; ++t) {
+    for (unsigned j = 0; j < c.source_lengths.size(); ++j) {
+      for (unsigned i = c.source_lengths[j]; i < max_length; ++i) {
+        const unsigned index = (t * c.source_lengths.size() + j) * max_length + i;
+        mask_ok = mask_ok && fused_alignments[index] == 0.0f;
+      }
+    }
+  }
+
+  const vector<vector<float>> plain_grads = Gradients(plain_model);
+  const vector<vector<float>> fused_grads = Gradients(fused_model);
+  float gradient_error = 0.0f;
+  for (unsigned k = 0; k < plain_grads.size(); ++k) {
+    gradient_error = max(gradient_error, MaxError(fused_grads[k], plain_grads[k]));
+  }
+
+  // Central differences of the fused loss at a few entries of each parameter
+  float fd_error = 0.0f;
+  for (unsigned k = 0; k < fused_params.size(); ++k) {
+    float* values = fused_params[k]->values.v;
+    const unsigned size = fused_params[k]->size();
+    const unsigned samples = min(fd_samples, size);
+    for (unsigned s = 0; s < samples; ++s) {
+      const unsigned i = (unsigned)((uint64_t)s * size / samples);
+      const float original = values[i];
+      values[i] = original + epsilon;
+      const float loss_plus = Loss(fused, c, data, false, nullptr);
+      values[i] = original - epsilon;
+      const float loss_minus = Loss(fused, c, data, false, nullptr);
+      values[i] = original;
+      const float numeric = (loss_plus - loss_minus) / (2.0f * epsilon);
+      fd_error = max(fd_error, fabs(numeric - fused_grads[k][i]) / max(1.0f, fabs(fused_grads[k][i])));
+    }
+  }
+
+  const bool ok = forward_error <= tolerance && gradient_error <= tolerance && fd_error <= fd_tolerance && mask_ok;
+  cout << "hidden size " << hidden_size << ", source lengths";
+  for (unsigned length : c.source_lengths) {
+    cout << " " << length;
+  }
+  cout << ": alignment error " << forward_error << ", gradient error " << gradient_error << ", finite difference error " << fd_error;
+  if (!mask_ok) {
+    cout << ", padding attended";
+  }
+  cout << (ok ? "  OK" : "  FAILED") << endl;
+  return ok;
+}
+
+// The first and last source positions with nonzero attention
+pair<unsigned, unsigned> Support(const vector<float>& alignment) {
+  unsigned first = alignment.size();
+  unsigned last = 0;
+  for (unsigned i = 0; i < alignment.size(); ++i) {
+    if (alignment[i] != 0.0f) {
+      first = min(first, i);
+      last = i;
+    }
+  }
+  return make_pair(first, last);
+}
+
+// Decodes target_length steps with monotonic local attention, first with one
+// GetContext() call per step and then with beam_size calls per step, one per
+// hypothesis, the way Translator::Translate does. Returns whether every call
+// at a given step used the same window.
+bool CheckLocalWindows(unsigned source_length, unsigned target_length, unsigned beam_size, mt19937& rng) {
+  const unsigned hidden_size = 8;
+  const unsigned input_dim = 2 * hidden_size;
+  const unsigned window = 2;
+  Model model;
+  LocalAttentionModel attention_model(model, input_dim, hidden_size, hidden_size, input_dim, window, false);
+
+  vector<vector<float>> encodings;
+  for (unsigned i = 0; i < source_length; ++i) {
+    encodings.push_back(RandomVector(input_dim, rng));
+  }
+  vector<vector<float>> states;
+  for (unsigned h = 0; h < beam_size; ++h) {
+    states.push_back(RandomVector(hidden_size, rng));
+  }
+
+  // windows[k][t] is the window of step t with k + 1 hypotheses, for each hypothesis
+  vector<vector<vector<pair<unsigned, unsigned>>>> windows(2);
+  for (unsigned k = 0; k < 2; ++k) {
+    const unsigned hypotheses = (k == 0) ? 1 : beam_size;
+    ComputationGraph cg;
+    attention_model.NewGraph(cg);
+    LinearSentence source;
+    source.resize(source_length);
+    attention_model.NewSentence(&source);
+    vector<Expression> inputs(source_length);
+    for (unsigned i = 0; i < source_length; ++i) {
+      inputs[i] = input(cg, {input_dim}, encodings[i]);
+    }
+
+    windows[k].resize(target_length);
+    for (unsigned t = 0; t < target_length; ++t) {
+      for (unsigned h = 0; h < hypotheses; ++h) {
+        attention_model.SetTargetIndex(t);
+        attention_model.GetContext(inputs, input(cg, {hidden_size}, states[h]));
+        windows[k][t].push_back(Support(as_vector(attention_model.GetLastAlignment().value())));
+      }
+    }
+  }
+
+  bool ok = true;
+  for (unsigned t = 0; t < target_length; ++t) {
+    for (const pair<unsigned, unsigned>& w : windows[1][t]) {
+      ok = ok && w == windows[0][t][0];
+    }
+  }
+  cout << "local attention windows with beam 1 and beam " << beam_size << (ok ? "  OK" : "  FAILED") << endl;
+  return ok;
+}
+
+int main(int argc, char** argv) {
+  dynet::initialize(argc, argv);
+
+  po::options_description desc("description");
+  desc.add_options()
+  ("hidden_sizes", po::value<string>()->default_value("1,5,13,24,37"), "Comma-separated hidden sizes to check. Sizes that aren't multiples of 8 or 16 exercise the vector kernels' remainder loops")
+  ("target_length,t", po::value<unsigned>()->default_value(3), "Number of target words to attend for")
+  ("fd_samples", po::value<unsigned>()->default_value(6), "Number of entries of each parameter to check by finite differences")
+  ("epsilon", po::value<float>()->default_value(1e-2f), "Step size for finite differences")
+  ("tolerance", po::value<float>()->default_value(1e-4f), "Largest allowed relative difference between the fused and plain alignments and gradients")
+  ("fd_tolerance", po::value<float>()->default_value(1e-2f), "Largest allowed relative difference between the gradients and finite differences")
+  ("help", "Display this help message");
+
+  po::variables_map vm;
+  po::store(po::command_line_parser(argc, argv).options(desc).run(), vm);
+
+  if (vm.count("help")) {
+    cerr << desc;
+    return 1;
+  }
+
+  po::notify(vm);
+
+  const unsigned target_length = vm["target_length"].as<unsigned>();
+  const unsigned fd_samples = vm["fd_samples"].as<unsigned>();
+  const float epsilon = vm["epsilon"].as<float>();
+  const float tolerance = vm["tolerance"].as<float>();
+  const float fd_tolerance = vm["fd_tolerance"].as<float>();
+
+  vector<Case> cases;
+  for (const string& h : tokenize(vm["hidden_sizes"].as<string>(), ",")) {
+    const unsigned hidden_size = stoi(h);
+    cases.push_back({hidden_size, {7}});
+    cases.push_back({hidden_size, {9, 4, 9, 1}});
+  }
+
+  mt19937 rng(1);
+  bool all_ok = true;
+  for (const Case& c : cases) {
+    all_ok = Check(c, target_length, fd_samples, epsilon, tolerance, fd_tolerance, rng) && all_ok;
+  }
+  all_ok = CheckLocalWindows(40, 12, 5, rng) && all_ok;
+  cout << (all_ok ? "All checks passed" : "Some checks FAILED") << endl;
+  return all_ok ? 0 : 1;
+}
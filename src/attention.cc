@@ -1,6 +1,11 @@
+#include <algorithm>
+#include <cmath>
+#include <limits>
 #include "attention.h"
 BOOST_CLASS_EXPORT_IMPLEMENT(StandardAttentionModel)
 BOOST_CLASS_EXPORT_IMPLEMENT(SparsemaxAttentionModel)
+BOOST_CLASS_EXPORT_IMPLEMENT(LocalAttentionModel)
+BOOST_CLASS_EXPORT_IMPLEMENT(BilinearAttentionModel)
 BOOST_CLASS_EXPORT_IMPLEMENT(EncoderDecoderAttentionModel)
 
 AttentionModel::~AttentionModel() {}
@@ -15,9 +20,112 @@ void AttentionModel::AddPrior(AttentionPrior* prior) {
   priors.push_back(prior);
 }
 
-StandardAttentionModel::StandardAttentionModel() {}
+void AttentionModel::SetTargetIndex(unsigned target_index) {}
 
-StandardAttentionModel::StandardAttentionModel(Model& model, unsigned input_dim, unsigned state_dim, unsigned hidden_dim, unsigned key_size) : key_size(key_size) {
+bool AttentionModel::SupportsBatchedDecoding() const {
+  return false;
+}
+
+void AttentionModel::SelectHypotheses(const vector<unsigned>& parents) {
+  for (AttentionPrior* prior : priors) {
+    prior->SelectHypotheses(parents);
+  }
+}
+
+vector<Expression> AttentionModel::GetPriorState() const {
+  vector<Expression> state(priors.size());
+  for (unsigned j = 0; j < priors.size(); ++j) {
+    state[j] = priors[j]->GetState();
+  }
+  return state;
+}
+
+void AttentionModel::SetPriorState(const vector<Expression>& state) {
+  assert (state.size() == priors.size());
+  for (unsigned j = 0; j < priors.size(); ++j) {
+    priors[j]->SetState(state[j]);
+  }
+}
+
+bool AttentionModel::SupportsBatchedSources() const {
+  return SupportsBatchedDecoding() && priors.size() == 0;
+}
+
+void AttentionModel::NewBatch(const vector<unsigned>& source_lengths) {
+  cerr << "This attention model does not support batching" << endl;
+  assert (false);
+}
+
+Expression AttentionModel::GetLastAlignment() const {
+  assert (last_alignment.pg != nullptr);
+  return last_alignment;
+}
+
+bool AttentionModel::ProducesAlignments() const {
+  return true;
+}
+
+Expression AttentionModel::ApplyPriors(Expression scores, const vector<Expression>& inputs, const SyntaxTree* const tree, unsigned target_index) {
+  vector<Expression> log_potentials(priors.size());
+  vector<Expression> weights(priors.size());
+  for (unsigned j = 0; j < priors.size(); ++j) {
+    AttentionPrior* prior = priors[j];
+    log_potentials[j] = (tree != nullptr) ? prior->LogPotential(inputs, tree, target_index) : prior->LogPotential(inputs, target_index);
+    weights[j] = prior->Weight();
+  }
+  Expression a = prior_combine(scores, log_potentials, weights);
+
+  for (AttentionPrior* prior : priors) {
+    prior->Notify(a);
+  }
+  return a;
+}
+
+bool AttentionModel::PriorsSupportBatchedDecoding() const {
+  for (AttentionPrior* prior : priors) {
+    if (!prior->SupportsBatchedDecoding()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+namespace {
+// Returns an expression that is 0 for the real source positions of each
+// batch element and -inf for its padding, or an empty expression if there is
+// no padding
+Expression MakeSourceMask(ComputationGraph& cg, const vector<unsigned>& source_lengths) {
+  const unsigned max_length = *max_element(source_lengths.begin(), source_lengths.end());
+  bool padded = false;
+  vector<float> mask(max_length * source_lengths.size(), 0.0f);
+  for (unsigned j = 0; j < source_lengths.size(); ++j) {
+    for (unsigned i = source_lengths[j]; i < max_length; ++i) {
+      mask[j * max_length + i] = -numeric_limits<float>::infinity();
+      padded = true;
+    }
+  }
+  if (!padded) {
+    return Expression();
+  }
+  return input(cg, Dim({max_length, 1}, source_lengths.size()), mask);
+}
+}
+
+EncodedSource::EncodedSource() : length(0) {}
+
+bool EncodedSource::empty() const {
+  return values.pg == nullptr;
+}
+
+void EncodedSource::clear() {
+  values.pg = nullptr;
+  keys.pg = nullptr;
+  length = 0;
+}
+
+StandardAttentionModel::StandardAttentionModel() : fused_softmax(false) {}
+
+StandardAttentionModel::StandardAttentionModel(Model& model, unsigned input_dim, unsigned state_dim, unsigned hidden_dim, unsigned key_size, bool fused_softmax) : key_size(key_size), fused_softmax(fused_softmax) {
   if (key_size == 0) {
     key_size = input_dim;
   }
@@ -39,103 +147,324 @@ void StandardAttentionModel::NewGraph(ComputationGraph& cg) {
     prior->NewGraph(cg);
   }
 
-  input_matrix.pg = nullptr;
+  encoded_source.clear();
+  source_mask.pg = nullptr;
+  last_alignment.pg = nullptr;
 }
 
-Expression StandardAttentionModel::GetScoreVector(const vector<Expression>& inputs, const Expression& state) {
-  // The score of an input vector x and state s is:
-  // U * tanh(Wx + Vs + b) + c
-  // The bias c is unnecessary because we're just going to softmax the result anyway.
+void StandardAttentionModel::NewSentence(const InputSentence* input) {
+  AttentionModel::NewSentence(input);
+  encoded_source.clear();
+  source_mask.pg = nullptr;
+}
 
-  // Normally we would loop over each input x and compute its score individually
-  // but we can achieve a ~10% speed up by batching this into matrix-matrix
-  // operations.
-  // Below, the variable Vsb_n is Vsb broadcasted to size of inputs.
-  // Note: Vs + b does not depend on x, so we can pre-compute that quantity once.
-  // Similarly W * input_matrix does not change per output-position, so we can compute
-  // that quantity and save it until we start working on a new sentence.
+void StandardAttentionModel::NewBatch(const vector<unsigned>& source_lengths) {
+  assert (priors.size() == 0);
+  encoded_source.clear();
+  source_mask = MakeSourceMask(*U.pg, source_lengths);
+}
 
-  if (input_matrix.pg == nullptr) {
+const EncodedSource& StandardAttentionModel::EncodeSource(const vector<Expression>& inputs) {
+  // W * keys does not change per output position, so we compute it once
+  // when we see a new sentence and hold on to it until the next one.
+  if (encoded_source.empty()) {
     vector<Expression> keys(inputs.size());
     for (unsigned i = 0; i < inputs.size(); ++i) {
       keys[i] = pickrange(inputs[i], 0, key_size);
     }
-    input_matrix = concatenate_cols(inputs);
-    WI = W * concatenate_cols(keys);
+    encoded_source.values = concatenate_cols(inputs);
+    encoded_source.keys = W * concatenate_cols(keys);
+    encoded_source.length = inputs.size();
   }
+  assert (encoded_source.length == inputs.size());
+  return encoded_source;
+}
+
+Expression StandardAttentionModel::GetScoreVector(const vector<Expression>& inputs, const Expression& state) {
+  // The score of an input vector x and state s is:
+  // U * tanh(Wx + Vs + b) + c
+  // The bias c is unnecessary because we're just going to softmax the result anyway.
+
+  // Wx is precomputed for the whole sentence, and Vs + b does not depend on x.
+  // additive_attention broadcasts Vs + b across all the inputs inside a single
+  // node, so each step only adds O(1) nodes to the graph regardless of the
+  // source length. It also handles a batch of states, one per hypothesis.
+  const EncodedSource& source = EncodeSource(inputs);
   Expression Vsb = affine_transform({b, V, state});
-  Expression Vsb_n = concatenate_cols(vector<Expression>(inputs.size(), Vsb));
-  Expression h = tanh(WI + Vsb_n);
-  Expression scores = transpose(U * h);
+  Expression scores = additive_attention(source.keys, Vsb, U);
+  if (source_mask.pg != nullptr) {
+    scores = scores + source_mask;
+  }
   return scores;
 }
 
+Expression StandardAttentionModel::GetSoftmaxAlignment(const vector<Expression>& inputs, const Expression& state) {
+  if (!fused_softmax) {
+    return softmax(GetScoreVector(inputs, state));
+  }
+
+  const EncodedSource& source = EncodeSource(inputs);
+  Expression Vsb = affine_transform({b, V, state});
+  if (source_mask.pg != nullptr) {
+    return additive_attention_softmax(source.keys, Vsb, U, source_mask);
+  }
+  return additive_attention_softmax(source.keys, Vsb, U);
+}
+
 Expression StandardAttentionModel::GetAlignmentVector(const vector<Expression>& inputs, const Expression& state) {
-  Expression a = softmax(GetScoreVector(inputs, state));
+  Expression a = (priors.size() > 0) ? ApplyPriors(GetScoreVector(inputs, state), inputs, nullptr, target_index) : GetSoftmaxAlignment(inputs, state);
+  ++target_index;
+  last_alignment = a;
+  return a;
+}
 
-  for (AttentionPrior* prior : priors) {
-    a = cmult(a, prior->Compute(inputs, target_index));
+Expression StandardAttentionModel::GetAlignmentVector(const vector<Expression>& inputs, const Expression& state, const SyntaxTree* const tree) {
+  Expression a = (priors.size() > 0) ? ApplyPriors(GetScoreVector(inputs, state), inputs, tree, target_index) : GetSoftmaxAlignment(inputs, state);
+  ++target_index;
+  last_alignment = a;
+  return a;
+}
+
+Expression StandardAttentionModel::GetContext(const vector<Expression>& inputs, const Expression& state) {
+  Expression dist = GetAlignmentVector(inputs, state);
+  Expression context = encoded_source.values * dist;
+  return context;
+}
+
+void StandardAttentionModel::SetTargetIndex(unsigned target_index) {
+  this->target_index = target_index;
+}
+
+bool StandardAttentionModel::SupportsBatchedDecoding() const {
+  // Priors with a running state (e.g. coverage) need to keep one per hypothesis
+  return PriorsSupportBatchedDecoding();
+}
+
+Expression StandardAttentionModel::GetContext(const vector<Expression>& inputs, const Expression& state, const SyntaxTree* const tree) {
+  Expression dist = GetAlignmentVector(inputs, state, tree);
+  Expression context = encoded_source.values * dist;
+  return context;
+}
+
+SparsemaxAttentionModel::SparsemaxAttentionModel() : StandardAttentionModel() {}
+
+SparsemaxAttentionModel::SparsemaxAttentionModel(Model& model, unsigned input_dim, unsigned state_dim, unsigned hidden_dim, unsigned key_size) : StandardAttentionModel(model, input_dim, state_dim, hidden_dim, key_size) {}
+
+Expression SparsemaxAttentionModel::GetAlignmentVector(const vector<Expression>& inputs, const Expression& state) {
+  last_alignment = sparsemax(GetScoreVector(inputs, state));
+  return last_alignment;
+}
+
+bool SparsemaxAttentionModel::SupportsBatchedDecoding() const {
+  return false;
+}
+
+LocalAttentionModel::LocalAttentionModel() : StandardAttentionModel() {}
+
+LocalAttentionModel::LocalAttentionModel(Model& model, unsigned input_dim, unsigned state_dim, unsigned hidden_dim, unsigned key_size, unsigned window, bool predict_center, bool fused_softmax) :
+    StandardAttentionModel(model, input_dim, state_dim, hidden_dim, key_size, fused_softmax), window(window), predict_center(predict_center) {
+  if (predict_center) {
+    p_center_W = model.add_parameters({hidden_dim, state_dim});
+    p_center_v = model.add_parameters({1, hidden_dim});
+  }
+  else {
+    p_log_ratio = model.add_parameters({1});
   }
+}
 
-  // Renormalize if we have priors
-  if (priors.size() > 0) {
-    Expression Z = sum_cols(transpose(a));
-    vector<Expression> Z_n(inputs.size(), Z);
-    Expression Zc = concatenate(Z_n);
-    a = cdiv(a, Zc);
+void LocalAttentionModel::NewGraph(ComputationGraph& cg) {
+  StandardAttentionModel::NewGraph(cg);
+  if (predict_center) {
+    center_W = parameter(cg, p_center_W);
+    center_v = parameter(cg, p_center_v);
   }
+  else {
+    log_ratio = parameter(cg, p_log_ratio);
+  }
+  keys_t.pg = nullptr;
+  values_t.pg = nullptr;
+}
 
-  ++target_index;
+void LocalAttentionModel::NewSentence(const InputSentence* input) {
+  StandardAttentionModel::NewSentence(input);
+  keys_t.pg = nullptr;
+  values_t.pg = nullptr;
+}
 
-  for (AttentionPrior* prior : priors) {
-    prior->Notify(a);
+Expression LocalAttentionModel::SelectWindow(const vector<Expression>& inputs, const Expression& state) {
+  const EncodedSource& source = EncodeSource(inputs);
+  const unsigned N = source.length;
+  if (keys_t.pg == nullptr) {
+    keys_t = transpose(source.keys);
+    values_t = transpose(source.values);
   }
 
-  return a;
+  ComputationGraph& cg = *state.pg;
+  Expression center;
+  if (predict_center) {
+    center = (N - 1.0f) * logistic(center_v * tanh(center_W * state));
+  }
+  else {
+    center = min((float)target_index * exp(log_ratio), input(cg, N - 1.0f));
+  }
+
+  // The window itself has to be chosen now, while the graph is being built
+  const float c = as_scalar(center.value());
+  const unsigned middle = (unsigned)min(max(round(c), 0.0f), N - 1.0f);
+  window_start = (middle > window) ? middle - window : 0;
+  window_end = min(N, middle + window + 1);
+  const unsigned width = window_end - window_start;
+
+  // Gaussian weights around the center: exp(-(i - c)^2 / (2 sigma^2)).
+  // The width x 1 by 1 x 1 product copies the center down the window.
+  vector<float> positions(width);
+  for (unsigned i = 0; i < width; ++i) {
+    positions[i] = window_start + i;
+  }
+  const float sigma = max(window, 1U) / 2.0f;
+  Expression diff = input(cg, {width}, positions) - input(cg, {width}, vector<float>(width, 1.0f)) * center;
+  return square(diff) * (-1.0f / (2.0f * sigma * sigma));
 }
 
-Expression StandardAttentionModel::GetAlignmentVector(const vector<Expression>& inputs, const Expression& state, const SyntaxTree* const tree) {
-  Expression a = softmax(GetScoreVector(inputs, state));
+Expression LocalAttentionModel::GetWindowAlignment(const vector<Expression>& inputs, const Expression& state) {
+  Expression log_weights = SelectWindow(inputs, state);
+  Expression keys = transpose(pickrange(keys_t, window_start, window_end));
+  Expression Vsb = affine_transform({b, V, state});
+  // The log weights go into the scores, just as with priors
+  if (fused_softmax) {
+    return additive_attention_softmax(keys, Vsb, U, log_weights);
+  }
+  return softmax(additive_attention(keys, Vsb, U) + log_weights);
+}
 
-  for (AttentionPrior* prior : priors) {
-    a = cmult(a, prior->Compute(inputs, tree, target_index));
+Expression LocalAttentionModel::ExpandWindow(const Expression& window_vector, unsigned source_length, float padding) {
+  if (window_start == 0 && window_end == source_length) {
+    return window_vector;
   }
 
-  // Renormalize if we have priors
+  ComputationGraph& cg = *window_vector.pg;
+  vector<Expression> parts;
+  if (window_start > 0) {
+    parts.push_back(input(cg, {window_start}, vector<float>(window_start, padding)));
+  }
+  parts.push_back(window_vector);
+  if (window_end < source_length) {
+    parts.push_back(input(cg, {source_length - window_end}, vector<float>(source_length - window_end, padding)));
+  }
+  return concatenate(parts);
+}
+
+Expression LocalAttentionModel::GetAlignmentVector(const vector<Expression>& inputs, const Expression& state) {
+  Expression a;
+  if (priors.size() > 0) {
+    // Positions outside the window get a score of -inf
+    Expression log_weights = SelectWindow(inputs, state);
+    Expression keys = transpose(pickrange(keys_t, window_start, window_end));
+    Expression scores = additive_attention(keys, affine_transform({b, V, state}), U) + log_weights;
+    scores = ExpandWindow(scores, inputs.size(), -numeric_limits<float>::infinity());
+    a = ApplyPriors(scores, inputs, nullptr, target_index);
+  }
+  else {
+    a = ExpandWindow(GetWindowAlignment(inputs, state), inputs.size(), 0.0f);
+  }
+  ++target_index;
+  last_alignment = a;
+  return a;
+}
+
+Expression LocalAttentionModel::GetContext(const vector<Expression>& inputs, const Expression& state) {
+  // Priors need the alignment over the whole source
   if (priors.size() > 0) {
-    Expression Z = sum_cols(transpose(a));
-    vector<Expression> Z_n(inputs.size(), Z);
-    Expression Zc = concatenate(Z_n);
-    a = cdiv(a, Zc);
+    Expression dist = GetAlignmentVector(inputs, state);
+    return encoded_source.values * dist;
   }
 
+  Expression window_alignment = GetWindowAlignment(inputs, state);
+  Expression window_values = transpose(pickrange(values_t, window_start, window_end));
   ++target_index;
+  last_alignment = ExpandWindow(window_alignment, inputs.size(), 0.0f);
+  return window_values * window_alignment;
+}
+
+bool LocalAttentionModel::SupportsBatchedDecoding() const {
+  return false;
+}
+
+BilinearAttentionModel::BilinearAttentionModel() {}
 
+BilinearAttentionModel::BilinearAttentionModel(Model& model, unsigned input_dim, unsigned state_dim, unsigned key_size) {
+  this->key_size = (key_size == 0) ? input_dim : key_size;
+  assert (this->key_size <= input_dim);
+  p_W = model.add_parameters({state_dim, this->key_size});
+}
+
+void BilinearAttentionModel::NewGraph(ComputationGraph& cg) {
+  W = parameter(cg, p_W);
+
+  target_index = 0;
   for (AttentionPrior* prior : priors) {
-    prior->Notify(a);
+    prior->NewGraph(cg);
   }
 
-  return a;
+  encoded_source.clear();
+  source_mask.pg = nullptr;
+  last_alignment.pg = nullptr;
 }
 
-Expression StandardAttentionModel::GetContext(const vector<Expression>& inputs, const Expression& state) {
-  Expression dist = GetAlignmentVector(inputs, state);
-  Expression context = input_matrix * dist;
-  return context;
+void BilinearAttentionModel::NewSentence(const InputSentence* input) {
+  AttentionModel::NewSentence(input);
+  encoded_source.clear();
+  source_mask.pg = nullptr;
 }
 
-Expression StandardAttentionModel::GetContext(const vector<Expression>& inputs, const Expression& state, const SyntaxTree* const tree) {
-  Expression dist = GetAlignmentVector(inputs, state, tree);
-  Expression context = input_matrix * dist;
-  return context;
+void BilinearAttentionModel::NewBatch(const vector<unsigned>& source_lengths) {
+  assert (priors.size() == 0);
+  encoded_source.clear();
+  source_mask = MakeSourceMask(*W.pg, source_lengths);
 }
 
-SparsemaxAttentionModel::SparsemaxAttentionModel() : StandardAttentionModel() {}
+const EncodedSource& BilinearAttentionModel::EncodeSource(const vector<Expression>& inputs) {
+  if (encoded_source.empty()) {
+    vector<Expression> keys(inputs.size());
+    for (unsigned i = 0; i < inputs.size(); ++i) {
+      keys[i] = pickrange(inputs[i], 0, key_size);
+    }
+    encoded_source.values = concatenate_cols(inputs);
+    encoded_source.keys = transpose(W * concatenate_cols(keys));
+    encoded_source.length = inputs.size();
+  }
+  assert (encoded_source.length == inputs.size());
+  return encoded_source;
+}
 
-SparsemaxAttentionModel::SparsemaxAttentionModel(Model& model, unsigned input_dim, unsigned state_dim, unsigned hidden_dim, unsigned key_size) : StandardAttentionModel(model, input_dim, state_dim, hidden_dim, key_size) {}
+Expression BilinearAttentionModel::GetScoreVector(const vector<Expression>& inputs, const Expression& state) {
+  const EncodedSource& source = EncodeSource(inputs);
+  Expression scores = source.keys * state;
+  if (source_mask.pg != nullptr) {
+    scores = scores + source_mask;
+  }
+  return scores;
+}
 
-Expression SparsemaxAttentionModel::GetAlignmentVector(const vector<Expression>& inputs, const Expression& state) {
-  return sparsemax(GetScoreVector(inputs, state));
+Expression BilinearAttentionModel::GetAlignmentVector(const vector<Expression>& inputs, const Expression& state) {
+  Expression scores = GetScoreVector(inputs, state);
+  Expression a = (priors.size() > 0) ? ApplyPriors(scores, inputs, nullptr, target_index) : softmax(scores);
+  ++target_index;
+  last_alignment = a;
+  return a;
+}
+
+Expression BilinearAttentionModel::GetContext(const vector<Expression>& inputs, const Expression& state) {
+  Expression dist = GetAlignmentVector(inputs, state);
+  return encoded_source.values * dist;
+}
+
+void BilinearAttentionModel::SetTargetIndex(unsigned target_index) {
+  this->target_index = target_index;
+}
+
+bool BilinearAttentionModel::SupportsBatchedDecoding() const {
+  return PriorsSupportBatchedDecoding();
 }
 
 EncoderDecoderAttentionModel::EncoderDecoderAttentionModel() {}
@@ -164,3 +493,7 @@ Expression EncoderDecoderAttentionModel::GetContext(const vector<Expression>& in
   Expression context = concatenate({hNf, h0b});
   return context;
 }
+
+bool EncoderDecoderAttentionModel::ProducesAlignments() const {
+  return false;
+}
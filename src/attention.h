@@ -14,6 +14,7 @@
 #include "utils.h"
 #include "syntax_tree.h"
 #include "prior.h"
+#include "custom_ops.h"
 #include <stack>
 #include <map>
 
@@ -33,9 +34,52 @@ public:
   virtual Expression GetContext(const vector<Expression>& inputs, const Expression& state) = 0;
   virtual void AddPrior(AttentionPrior* prior);
 
+  // Sets the target position that the next GetContext() attends for.
+  // Otherwise each call moves on by one position, which is only right when
+  // there's one call per target word. Decoders that call GetContext() once per
+  // hypothesis set this before each call.
+  virtual void SetTargetIndex(unsigned target_index);
+
+  // Whether GetContext() accepts a state with several batch elements, one per hypothesis
+  virtual bool SupportsBatchedDecoding() const;
+  // Called between steps of batched decoding: the i-th hypothesis of the next
+  // step extends the parents[i]-th of the last one. Reorders the priors' states.
+  void SelectHypotheses(const vector<unsigned>& parents);
+  // The priors' running states, for decoders that call GetContext() for one
+  // hypothesis at a time. Each hypothesis continues from the state its
+  // parent's GetContext() left behind.
+  vector<Expression> GetPriorState() const;
+  void SetPriorState(const vector<Expression>& state);
+
+  // Like NewSentence, but for a batch of source sentences that have been
+  // encoded together and padded to the same length. Batch element j of the
+  // states passed in afterwards belongs to the j-th sentence, which is only
+  // allowed to attend to its first source_lengths[j] encodings.
+  // Supported if SupportsBatchedSources() is true.
+  virtual void NewBatch(const vector<unsigned>& source_lengths);
+  // Whether NewBatch() is supported. Priors follow a single source sentence,
+  // so this needs batched decoding support and no priors.
+  bool SupportsBatchedSources() const;
+
+  // The alignment vector computed by the most recent call to GetAlignmentVector
+  // (or GetContext). Not all attention models have one.
+  Expression GetLastAlignment() const;
+  // Whether GetLastAlignment() is available after GetContext()
+  virtual bool ProducesAlignments() const;
+
 protected:
+  // The alignment softmax(scores + sum_j w_j z_j), where z_j is the log
+  // potential of the j-th prior and w_j its weight, which is softmax(scores)
+  // times each prior, renormalized. Computed by a single prior_combine node,
+  // and then shown to the priors. tree is only needed by priors that look at
+  // the source syntax, and may be null.
+  Expression ApplyPriors(Expression scores, const vector<Expression>& inputs, const SyntaxTree* const tree, unsigned target_index);
+  // Whether every prior can keep a state per hypothesis
+  bool PriorsSupportBatchedDecoding() const;
+
   unsigned key_size;
   vector<AttentionPrior*> priors;
+  Expression last_alignment;
 
 private:
   friend class boost::serialization::access;
@@ -46,44 +90,137 @@ private:
   }
 };
 
+// Everything attention needs from the source sentence, computed once per
+// sentence and then shared by all hypotheses at every decoding step.
+struct EncodedSource {
+  EncodedSource();
+  bool empty() const;
+  void clear();
+
+  Expression values; // input_dim x N: the source encodings, side by side
+  Expression keys; // hidden_dim x N: W times the key part of each encoding
+  unsigned length;
+};
+
 class StandardAttentionModel : public AttentionModel {
 public:
   StandardAttentionModel();
-  StandardAttentionModel(Model& model, unsigned input_dim, unsigned state_dim, unsigned hidden_dim, unsigned key_size = 0);
+  // With fused_softmax, the alignment is computed by a single
+  // additive_attention_softmax node instead of scores followed by softmax
+  StandardAttentionModel(Model& model, unsigned input_dim, unsigned state_dim, unsigned hidden_dim, unsigned key_size = 0, bool fused_softmax = false);
 
   void NewGraph(ComputationGraph& cg);
+  void NewSentence(const InputSentence* input) override;
+  void NewBatch(const vector<unsigned>& source_lengths) override;
   Expression GetScoreVector(const vector<Expression>& inputs, const Expression& state);
   Expression GetAlignmentVector(const vector<Expression>& inputs, const Expression& state);
   Expression GetContext(const vector<Expression>& inputs, const Expression& state);
+  void SetTargetIndex(unsigned target_index) override;
+  bool SupportsBatchedDecoding() const override;
 
   Expression GetAlignmentVector(const vector<Expression>& inputs, const Expression& state, const SyntaxTree* const tree);
   Expression GetContext(const vector<Expression>& inputs, const Expression& state, const SyntaxTree* const tree);
 
-private:
+protected:
+  const EncodedSource& EncodeSource(const vector<Expression>& inputs);
+  // softmax(GetScoreVector(inputs, state)), before any priors
+  Expression GetSoftmaxAlignment(const vector<Expression>& inputs, const Expression& state);
+
   Parameter p_U, p_V, p_W, p_b;
   Expression U, V, W, b;
-  Expression WI, input_matrix;
+  EncodedSource encoded_source;
+  // Added to the attention scores to rule out padding in batches
+  Expression source_mask;
   unsigned target_index;
   unsigned key_size;
+  bool fused_softmax;
 
+private:
   friend class boost::serialization::access;
   template<class Archive>
-  void serialize(Archive& ar, const unsigned int) {
+  void serialize(Archive& ar, const unsigned int version) {
     ar & boost::serialization::base_object<AttentionModel>(*this);
     ar & key_size;
     ar & p_U;
     ar & p_V;
     ar & p_W;
     ar & p_b;
+    if (version > 0) {
+      ar & fused_softmax;
+    }
   }
 };
 BOOST_CLASS_EXPORT_KEY(StandardAttentionModel)
+BOOST_CLASS_VERSION(StandardAttentionModel, 1)
+
+// Local attention, after Luong et al. (2015): at each step, predicts a
+// center position c in the source and only scores the 2 * window + 1 encodings
+// around it, so each step costs O(window * hidden_dim) however long the source
+// is. The window's scores are weighted by a Gaussian with standard deviation
+// window / 2 centered at c, which is how c gets gradient: the alignment is
+// softmax(scores - (i - c)^2 / (2 sigma^2)) over the window, i.e. the softmax
+// times the Gaussian, renormalized. Unlike in Luong et al. it always sums to
+// one, and priors are folded into the same softmax.
+// With predict_center, c = (N - 1) * sigmoid(v^T tanh(W_c s)) is predicted from
+// the state. Otherwise the center moves monotonically: c = t * r for target
+// position t, where r is a learned ratio of source to target length.
+// The alignment vector is zero outside the window. Without priors, the context
+// is computed from the window alone.
+class LocalAttentionModel : public StandardAttentionModel {
+public:
+  LocalAttentionModel();
+  LocalAttentionModel(Model& model, unsigned input_dim, unsigned state_dim, unsigned hidden_dim, unsigned key_size, unsigned window, bool predict_center, bool fused_softmax = false);
+
+  void NewGraph(ComputationGraph& cg);
+  void NewSentence(const InputSentence* input) override;
+  Expression GetAlignmentVector(const vector<Expression>& inputs, const Expression& state);
+  Expression GetContext(const vector<Expression>& inputs, const Expression& state);
+  // Each hypothesis would need its own window
+  bool SupportsBatchedDecoding() const override;
+
+private:
+  // Picks the window for this step and returns the log of the Gaussian
+  // weights over it
+  Expression SelectWindow(const vector<Expression>& inputs, const Expression& state);
+  // Returns the alignment over just the window of this step
+  Expression GetWindowAlignment(const vector<Expression>& inputs, const Expression& state);
+  // Pads a vector over the window with padding to cover the whole source
+  Expression ExpandWindow(const Expression& window_vector, unsigned source_length, float padding);
+
+  unsigned window;
+  bool predict_center;
+  Parameter p_log_ratio; // log r, for monotonic centers
+  Parameter p_center_W, p_center_v; // for predicted centers
+  Expression log_ratio, center_W, center_v;
+
+  // The encodings transposed to N x dim, so that a window is a pickrange of rows
+  Expression keys_t, values_t;
+  // The window of the current step, as [window_start, window_end)
+  unsigned window_start, window_end;
+
+  friend class boost::serialization::access;
+  template<class Archive>
+  void serialize(Archive& ar, const unsigned int) {
+    ar & boost::serialization::base_object<StandardAttentionModel>(*this);
+    ar & window;
+    ar & predict_center;
+    if (predict_center) {
+      ar & p_center_W;
+      ar & p_center_v;
+    }
+    else {
+      ar & p_log_ratio;
+    }
+  }
+};
+BOOST_CLASS_EXPORT_KEY(LocalAttentionModel)
 
 class SparsemaxAttentionModel : public StandardAttentionModel {
 public:
   SparsemaxAttentionModel();
   SparsemaxAttentionModel(Model& model, unsigned input_dim, unsigned state_dim, unsigned hidden_dim, unsigned key_size);
   Expression GetAlignmentVector(const vector<Expression>& inputs, const Expression& state);
+  bool SupportsBatchedDecoding() const override;
 private:
   friend class boost::serialization::access;
   template<class Archive>
@@ -93,6 +230,44 @@ private:
 };
 BOOST_CLASS_EXPORT_KEY(SparsemaxAttentionModel)
 
+// Multiplicative ("general") attention from Luong et al. (2015): the score of
+// source encoding x and state s is s^T W x. W times the source encodings is
+// computed once per sentence, so each step is a single matrix-vector product
+// followed by a softmax, with no hidden layer.
+class BilinearAttentionModel : public AttentionModel {
+public:
+  BilinearAttentionModel();
+  BilinearAttentionModel(Model& model, unsigned input_dim, unsigned state_dim, unsigned key_size = 0);
+
+  void NewGraph(ComputationGraph& cg);
+  void NewSentence(const InputSentence* input) override;
+  void NewBatch(const vector<unsigned>& source_lengths) override;
+  Expression GetScoreVector(const vector<Expression>& inputs, const Expression& state);
+  Expression GetAlignmentVector(const vector<Expression>& inputs, const Expression& state);
+  Expression GetContext(const vector<Expression>& inputs, const Expression& state);
+  void SetTargetIndex(unsigned target_index) override;
+  bool SupportsBatchedDecoding() const override;
+
+private:
+  // Unlike StandardAttentionModel's, encoded_source.keys is N x state_dim:
+  // transpose(W * keys), so that the scores are just keys * s.
+  const EncodedSource& EncodeSource(const vector<Expression>& inputs);
+
+  Parameter p_W;
+  Expression W;
+  EncodedSource encoded_source;
+  Expression source_mask;
+  unsigned target_index;
+
+  friend class boost::serialization::access;
+  template<class Archive>
+  void serialize(Archive& ar, const unsigned int) {
+    ar & boost::serialization::base_object<AttentionModel>(*this);
+    ar & p_W;
+  }
+};
+BOOST_CLASS_EXPORT_KEY(BilinearAttentionModel)
+
 /*class ConvolutionalAttentionModel : public AttentionModel {
   ConvolutionalAttentionModel();
   ConvolutionalAttentionModel(Model& model, unsigned input_dim, unsigned state_dim, unsigned hidden_dim, unsigned conv_size);
@@ -117,6 +292,8 @@ public:
   Expression GetScoreVector(const vector<Expression>& inputs, const Expression& state);
   Expression GetAlignmentVector(const vector<Expression>& inputs, const Expression& state);
   Expression GetContext(const vector<Expression>& inputs, const Expression& state);
+  // The context doesn't come from an alignment
+  bool ProducesAlignments() const override;
 private:
   unsigned state_dim;
   Parameter p_W, p_b;
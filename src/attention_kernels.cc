@@ -0,0 +1,402 @@
+#include <cmath>
+#include <algorithm>
+#include "attention_kernels.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define ATTENTION_KERNELS_X86
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+namespace {
+// Coefficients of the [13/6] rational approximation to tanh from Eigen's ptanh
+const float kTanhClamp = 7.90531110763549805f;
+const float kTanhTiny = 0.0004f;
+const float kAlpha1 = 4.89352455891786e-03f;
+const float kAlpha3 = 6.37261928875436e-04f;
+const float kAlpha5 = 1.48572235717979e-05f;
+const float kAlpha7 = 5.12229709037114e-08f;
+const float kAlpha9 = -8.60467152213735e-11f;
+const float kAlpha11 = 2.00018790482477e-13f;
+const float kAlpha13 = -2.76076847742355e-16f;
+const float kBeta0 = 4.89352518554385e-03f;
+const float kBeta2 = 2.26843463243900e-03f;
+const float kBeta4 = 1.18534705686654e-04f;
+const float kBeta6 = 1.19825839466702e-06f;
+
+void ScoresPortable(const float* K, const float* q, const float* u, unsigned H, unsigned N, float* scores) {
+  for (unsigned n = 0; n < N; ++n) {
+    const float* k = K + n * H;
+    float score = 0.0f;
+    for (unsigned h = 0; h < H; ++h) {
+      score += u[h] * FastTanh(k[h] + q[h]);
+    }
+    scores[n] = score;
+  }
+}
+
+void BackwardPortable(const float* K, const float* q, const float* u, unsigned H, unsigned N, const float* dscores, float* dK, float* dq, float* du) {
+  for (unsigned n = 0; n < N; ++n) {
+    const float ds = dscores[n];
+    // Masked out positions get no gradient
+    if (ds == 0.0f) {
+      continue;
+    }
+    const float* k = K + n * H;
+    for (unsigned h = 0; h < H; ++h) {
+      const float t = FastTanh(k[h] + q[h]);
+      const float dt = ds * u[h] * (1.0f - t * t);
+      if (dK != nullptr) {
+        dK[n * H + h] += dt;
+      }
+      if (dq != nullptr) {
+        dq[h] += dt;
+      }
+      if (du != nullptr) {
+        du[h] += ds * t;
+      }
+    }
+  }
+}
+
+#ifdef ATTENTION_KERNELS_X86
+__attribute__((target("avx2,fma")))
+inline __m256 Tanh8(__m256 x) {
+  const __m256 abs_x = _mm256_andnot_ps(_mm256_set1_ps(-0.0f), x);
+  const __m256 tiny = _mm256_cmp_ps(abs_x, _mm256_set1_ps(kTanhTiny), _CMP_LT_OQ);
+  const __m256 c = _mm256_min_ps(_mm256_max_ps(x, _mm256_set1_ps(-kTanhClamp)), _mm256_set1_ps(kTanhClamp));
+  const __m256 c2 = _mm256_mul_ps(c, c);
+
+  __m256 p = _mm256_fmadd_ps(c2, _mm256_set1_ps(kAlpha13), _mm256_set1_ps(kAlpha11));
+  p = _mm256_fmadd_ps(c2, p, _mm256_set1_ps(kAlpha9));
+  p = _mm256_fmadd_ps(c2, p, _mm256_set1_ps(kAlpha7));
+  p = _mm256_fmadd_ps(c2, p, _mm256_set1_ps(kAlpha5));
+  p = _mm256_fmadd_ps(c2, p, _mm256_set1_ps(kAlpha3));
+  p = _mm256_fmadd_ps(c2, p, _mm256_set1_ps(kAlpha1));
+  p = _mm256_mul_ps(c, p);
+
+  __m256 d = _mm256_fmadd_ps(c2, _mm256_set1_ps(kBeta6), _mm256_set1_ps(kBeta4));
+  d = _mm256_fmadd_ps(c2, d, _mm256_set1_ps(kBeta2));
+  d = _mm256_fmadd_ps(c2, d, _mm256_set1_ps(kBeta0));
+  return _mm256_blendv_ps(_mm256_div_ps(p, d), x, tiny);
+}
+
+__attribute__((target("avx2,fma")))
+inline float Sum8(__m256 x) {
+  __m128 s = _mm_add_ps(_mm256_castps256_ps128(x), _mm256_extractf128_ps(x, 1));
+  s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+  s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+  return _mm_cvtss_f32(s);
+}
+
+__attribute__((target("avx2,fma")))
+void ScoresAVX2(const float* K, const float* q, const float* u, unsigned H, unsigned N, float* scores) {
+  for (unsigned n = 0; n < N; ++n) {
+    const float* k = K + n * H;
+    __m256 acc = _mm256_setzero_ps();
+    unsigned h = 0;
+    for (; h + 8 <= H; h += 8) {
+      const __m256 t = Tanh8(_mm256_add_ps(_mm256_loadu_ps(k + h), _mm256_loadu_ps(q + h)));
+      acc = _mm256_fmadd_ps(_mm256_loadu_ps(u + h), t, acc);
+    }
+    float score = Sum8(acc);
+    for (; h < H; ++h) {
+      score += u[h] * FastTanh(k[h] + q[h]);
+    }
+    scores[n] = score;
+  }
+}
+
+__attribute__((target("avx2,fma")))
+void BackwardAVX2(const float* K, const float* q, const float* u, unsigned H, unsigned N, const float* dscores, float* dK, float* dq, float* du) {
+  for (unsigned n = 0; n < N; ++n) {
+    const float ds = dscores[n];
+    if (ds == 0.0f) {
+      continue;
+    }
+    const float* k = K + n * H;
+    const __m256 vds = _mm256_set1_ps(ds);
+    unsigned h = 0;
+    for (; h + 8 <= H; h += 8) {
+      const __m256 t = Tanh8(_mm256_add_ps(_mm256_loadu_ps(k + h), _mm256_loadu_ps(q + h)));
+      const __m256 g = _mm256_mul_ps(vds, _mm256_loadu_ps(u + h));
+      // g * (1 - t^2)
+      const __m256 dt = _mm256_fnmadd_ps(_mm256_mul_ps(t, t), g, g);
+      if (dK != nullptr) {
+        float* p = dK + n * H + h;
+        _mm256_storeu_ps(p, _mm256_add_ps(_mm256_loadu_ps(p), dt));
+      }
+      if (dq != nullptr) {
+        _mm256_storeu_ps(dq + h, _mm256_add_ps(_mm256_loadu_ps(dq + h), dt));
+      }
+      if (du != nullptr) {
+        _mm256_storeu_ps(du + h, _mm256_fmadd_ps(vds, t, _mm256_loadu_ps(du + h)));
+      }
+    }
+    for (; h < H; ++h) {
+      const float t = FastTanh(k[h] + q[h]);
+      const float dt = ds * u[h] * (1.0f - t * t);
+      if (dK != nullptr) {
+        dK[n * H + h] += dt;
+      }
+      if (dq != nullptr) {
+        dq[h] += dt;
+      }
+      if (du != nullptr) {
+        du[h] += ds * t;
+      }
+    }
+  }
+}
+
+__attribute__((target("avx512f")))
+inline __m512 Tanh16(__m512 x) {
+  const __mmask16 tiny = _mm512_cmp_ps_mask(_mm512_abs_ps(x), _mm512_set1_ps(kTanhTiny), _CMP_LT_OQ);
+  const __m512 c = _mm512_min_ps(_mm512_max_ps(x, _mm512_set1_ps(-kTanhClamp)), _mm512_set1_ps(kTanhClamp));
+  const __m512 c2 = _mm512_mul_ps(c, c);
+
+  __m512 p = _mm512_fmadd_ps(c2, _mm512_set1_ps(kAlpha13), _mm512_set1_ps(kAlpha11));
+  p = _mm512_fmadd_ps(c2, p, _mm512_set1_ps(kAlpha9));
+  p = _mm512_fmadd_ps(c2, p, _mm512_set1_ps(kAlpha7));
+  p = _mm512_fmadd_ps(c2, p, _mm512_set1_ps(kAlpha5));
+  p = _mm512_fmadd_ps(c2, p, _mm512_set1_ps(kAlpha3));
+  p = _mm512_fmadd_ps(c2, p, _mm512_set1_ps(kAlpha1));
+  p = _mm512_mul_ps(c, p);
+
+  __m512 d = _mm512_fmadd_ps(c2, _mm512_set1_ps(kBeta6), _mm512_set1_ps(kBeta4));
+  d = _mm512_fmadd_ps(c2, d, _mm512_set1_ps(kBeta2));
+  d = _mm512_fmadd_ps(c2, d, _mm512_set1_ps(kBeta0));
+  return _mm512_mask_blend_ps(tiny, _mm512_div_ps(p, d), x);
+}
+
+// Selects the lanes of h, h + 1, ... that are still less than H
+inline __mmask16 TailMask16(unsigned h, unsigned H) {
+  return (H - h >= 16) ? (__mmask16)0xFFFF : (__mmask16)((1U << (H - h)) - 1);
+}
+
+__attribute__((target("avx512f")))
+void ScoresAVX512(const float* K, const float* q, const float* u, unsigned H, unsigned N, float* scores) {
+  for (unsigned n = 0; n < N; ++n) {
+    const float* k = K + n * H;
+    __m512 acc = _mm512_setzero_ps();
+    for (unsigned h = 0; h < H; h += 16) {
+      // Masked off lanes load u = 0, so they add nothing
+      const __mmask16 m = TailMask16(h, H);
+      const __m512 t = Tanh16(_mm512_add_ps(_mm512_maskz_loadu_ps(m, k + h), _mm512_maskz_loadu_ps(m, q + h)));
+      acc = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, u + h), t, acc);
+    }
+    scores[n] = _mm512_reduce_add_ps(acc);
+  }
+}
+
+__attribute__((target("avx512f")))
+void BackwardAVX512(const float* K, const float* q, const float* u, unsigned H, unsigned N, const float* dscores, float* dK, float* dq, float* du) {
+  for (unsigned n = 0; n < N; ++n) {
+    const float ds = dscores[n];
+    if (ds == 0.0f) {
+      continue;
+    }
+    const float* k = K + n * H;
+    const __m512 vds = _mm512_set1_ps(ds);
+    for (unsigned h = 0; h < H; h += 16) {
+      const __mmask16 m = TailMask16(h, H);
+      const __m512 t = Tanh16(_mm512_add_ps(_mm512_maskz_loadu_ps(m, k + h), _mm512_maskz_loadu_ps(m, q + h)));
+      const __m512 g = _mm512_mul_ps(vds, _mm512_maskz_loadu_ps(m, u + h));
+      const __m512 dt = _mm512_fnmadd_ps(_mm512_mul_ps(t, t), g, g);
+      if (dK != nullptr) {
+        float* p = dK + n * H + h;
+        _mm512_mask_storeu_ps(p, m, _mm512_add_ps(_mm512_maskz_loadu_ps(m, p), dt));
+      }
+      if (dq != nullptr) {
+        _mm512_mask_storeu_ps(dq + h, m, _mm512_add_ps(_mm512_maskz_loadu_ps(m, dq + h), dt));
+      }
+      if (du != nullptr) {
+        _mm512_mask_storeu_ps(du + h, m, _mm512_fmadd_ps(vds, t, _mm512_maskz_loadu_ps(m, du + h)));
+      }
+    }
+  }
+}
+#endif
+
+typedef void (*ScoresKernel)(const float*, const float*, const float*, unsigned, unsigned, float*);
+typedef void (*BackwardKernel)(const float*, const float*, const float*, unsigned, unsigned, const float*, float*, float*, float*);
+
+struct Kernels {
+  ScoresKernel scores;
+  BackwardKernel backward;
+};
+
+Kernels ChooseKernels() {
+#ifdef ATTENTION_KERNELS_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) {
+    return {ScoresAVX512, BackwardAVX512};
+  }
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+    return {ScoresAVX2, BackwardAVX2};
+  }
+#endif
+  return {ScoresPortable, BackwardPortable};
+}
+
+const Kernels& GetKernels() {
+  static const Kernels kernels = ChooseKernels();
+  return kernels;
+}
+} // namespace
+
+float FastTanh(float x) {
+  if (fabs(x) < kTanhTiny) {
+    return x;
+  }
+  const float c = min(max(x, -kTanhClamp), kTanhClamp);
+  const float c2 = c * c;
+  float p = c2 * kAlpha13 + kAlpha11;
+  p = c2 * p + kAlpha9;
+  p = c2 * p + kAlpha7;
+  p = c2 * p + kAlpha5;
+  p = c2 * p + kAlpha3;
+  p = c2 * p + kAlpha1;
+  p = c * p;
+  float d = c2 * kBeta6 + kBeta4;
+  d = c2 * d + kBeta2;
+  d = c2 * d + kBeta0;
+  return p / d;
+}
+
+void AdditiveAttentionScores(const float* K, const float* q, const float* u, unsigned H, unsigned N, float* scores) {
+  GetKernels().scores(K, q, u, H, N, scores);
+}
+
+void AdditiveAttentionBackward(const float* K, const float* q, const float* u, unsigned H, unsigned N, const float* dscores, float* dK, float* dq, float* du) {
+  GetKernels().backward(K, q, u, H, N, dscores, dK, dq, du);
+}
+
+void JumpConvolution(const float* x, unsigned N, const float* f, unsigned W, float* y) {
+  if (W == 1) {
+    float total = 0.0f;
+    for (unsigned i = 0; i < N; ++i) {
+      total += x[i];
+    }
+    for (unsigned j = 0; j < N; ++j) {
+      y[j] = f[0] * total;
+    }
+    return;
+  }
+
+  const int half = W / 2;
+  const int n = N;
+  for (int j = 0; j < n; ++j) {
+    y[j] = 0.0f;
+  }
+
+  // Inner taps: y[j] += f[k] * x[j - d] for the jump d = k - half
+  for (int k = 1; k < (int)W - 1; ++k) {
+    const int d = k - half;
+    const float fk = f[k];
+    const int begin = max(0, d);
+    const int end = min(n, n + d);
+    for (int j = begin; j < end; ++j) {
+      y[j] += fk * x[j - d];
+    }
+  }
+
+  // First tap: jumps of -half or less, i.e. from any i >= j + half
+  float suffix = 0.0f;
+  for (int j = n - 1; j >= 0; --j) {
+    if (j + half < n) {
+      suffix += x[j + half];
+    }
+    y[j] += f[0] * suffix;
+  }
+
+  // Last tap: jumps of W - 1 - half or more, i.e. from any i <= j - (W - 1 - half)
+  const int far = W - 1 - half;
+  float prefix = 0.0f;
+  for (int j = 0; j < n; ++j) {
+    if (j - far >= 0) {
+      prefix += x[j - far];
+    }
+    y[j] += f[W - 1] * prefix;
+  }
+}
+
+void JumpConvolutionBackward(const float* x, unsigned N, const float* f, unsigned W, const float* dy, float* dx, float* df) {
+  if (W == 1) {
+    float x_total = 0.0f, dy_total = 0.0f;
+    for (unsigned i = 0; i < N; ++i) {
+      x_total += x[i];
+      dy_total += dy[i];
+    }
+    for (unsigned i = 0; dx != nullptr && i < N; ++i) {
+      dx[i] += f[0] * dy_total;
+    }
+    if (df != nullptr) {
+      df[0] += x_total * dy_total;
+    }
+    return;
+  }
+
+  const int half = W / 2;
+  const int far = W - 1 - half;
+  const int n = N;
+
+  for (int k = 1; k < (int)W - 1; ++k) {
+    const int d = k - half;
+    const float fk = f[k];
+    const int begin = max(0, d);
+    const int end = min(n, n + d);
+    float dfk = 0.0f;
+    for (int j = begin; j < end; ++j) {
+      dfk += dy[j] * x[j - d];
+    }
+    if (dx != nullptr) {
+      for (int j = begin; j < end; ++j) {
+        dx[j - d] += fk * dy[j];
+      }
+    }
+    if (df != nullptr) {
+      df[k] += dfk;
+    }
+  }
+
+  // First tap: y[j] gets f[0] * sum_{i >= j + half} x[i], so x[i] gets
+  // f[0] * sum_{j <= i - half} dy[j]
+  float suffix = 0.0f, df0 = 0.0f;
+  for (int j = n - 1; j >= 0; --j) {
+    if (j + half < n) {
+      suffix += x[j + half];
+    }
+    df0 += dy[j] * suffix;
+  }
+  float dy_prefix = 0.0f;
+  for (int i = 0; dx != nullptr && i < n; ++i) {
+    if (i - half >= 0) {
+      dy_prefix += dy[i - half];
+    }
+    dx[i] += f[0] * dy_prefix;
+  }
+
+  // Last tap: y[j] gets f[W - 1] * sum_{i <= j - far} x[i], so x[i] gets
+  // f[W - 1] * sum_{j >= i + far} dy[j]
+  float prefix = 0.0f, dflast = 0.0f;
+  for (int j = 0; j < n; ++j) {
+    if (j - far >= 0) {
+      prefix += x[j - far];
+    }
+    dflast += dy[j] * prefix;
+  }
+  float dy_suffix = 0.0f;
+  for (int i = n - 1; dx != nullptr && i >= 0; --i) {
+    if (i + far < n) {
+      dy_suffix += dy[i + far];
+    }
+    dx[i] += f[W - 1] * dy_suffix;
+  }
+
+  if (df != nullptr) {
+    df[0] += df0;
+    df[W - 1] += dflast;
+  }
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+// Vectorized loops behind the attention nodes in custom_ops.
+// The additive attention kernels have AVX-512, AVX2 and portable versions, and
+// the best one the CPU supports is picked the first time it's called.
+// K is hidden_dim x N, column major, q and u have hidden_dim entries.
+
+// tanh, using the same rational approximation as Eigen. Within a few ulps
+// of the real thing, and exactly +-1 beyond about +-7.9.
+float FastTanh(float x);
+
+// scores[n] = sum_h u[h] * tanh(K[n * H + h] + q[h]) for n < N
+void AdditiveAttentionScores(const float* K, const float* q, const float* u, unsigned H, unsigned N, float* scores);
+
+// Given dE/dscores, adds the gradients with respect to K, q and u to dK, dq
+// and du. Any of them may be null if that gradient isn't needed. The tanh
+// activations are recomputed rather than stored by the forward pass.
+void AdditiveAttentionBackward(const float* K, const float* q, const float* u, unsigned H, unsigned N, const float* dscores, float* dK, float* dq, float* du);
+
+// The 1-D convolution behind MarkovPrior. Filter tap k (of W) scores a jump of
+// k - W / 2 positions from the previous alignment, and the first and last taps
+// also cover every longer jump backwards or forwards, so
+// y[j] = sum_i x[i] * f[clamp(j - i + W / 2, 0, W - 1)]. Costs O(N * W): each
+// inner tap is one shifted multiply-add over x, and the two outer taps use
+// running sums.
+void JumpConvolution(const float* x, unsigned N, const float* f, unsigned W, float* y);
+
+// Given dE/dy, adds the gradients with respect to x and f to dx and df.
+// Either may be null.
+void JumpConvolutionBackward(const float* x, unsigned N, const float* f, unsigned W, const float* dy, float* dx, float* df);
@@ -0,0 +1,91 @@
+#include <algorithm>
+#include <numeric>
+#include <random>
+#include <cassert>
+#include "batch_scheduler.h"
+
+PaddingStats::PaddingStats() : batch_count(0), real_tokens(0), padded_tokens(0) {}
+
+double PaddingStats::Efficiency() const {
+  return (padded_tokens > 0) ? 1.0 * real_tokens / padded_tokens : 1.0;
+}
+
+ostream& operator<<(ostream& stream, const PaddingStats& stats) {
+  return stream << stats.batch_count << " batches, " << stats.real_tokens << " tokens, " << stats.padded_tokens << " with padding (" << 100.0 * stats.Efficiency() << "% efficiency)";
+}
+
+BatchScheduler::BatchScheduler(const Bitext& bitext, unsigned max_sentences, unsigned max_tokens, unsigned seed) :
+    bitext(bitext), max_sentences(max_sentences), max_tokens(max_tokens), seed(seed) {
+  assert (max_sentences > 0);
+  source_lengths.resize(bitext.size());
+  target_lengths.resize(bitext.size());
+  for (unsigned i = 0; i < bitext.size(); ++i) {
+    source_lengths[i] = get<0>(bitext[i])->NumNodes();
+    target_lengths[i] = get<1>(bitext[i])->size();
+  }
+}
+
+vector<vector<unsigned>> BatchScheduler::Batches(unsigned epoch) const {
+  mt19937 rng(seed + epoch);
+  vector<unsigned> order(bitext.size());
+  iota(order.begin(), order.end(), 0);
+  shuffle(order.begin(), order.end(), rng);
+  stable_sort(order.begin(), order.end(), [&](unsigned a, unsigned b) {
+    if (source_lengths[a] != source_lengths[b]) {
+      return source_lengths[a] < source_lengths[b];
+    }
+    return target_lengths[a] < target_lengths[b];
+  });
+
+  // Every sentence in a batch is padded to the batch's longest source and target
+  vector<vector<unsigned>> batches;
+  vector<unsigned> batch;
+  unsigned max_source_length = 0;
+  unsigned max_target_length = 0;
+  for (unsigned i : order) {
+    const unsigned new_source_length = max(max_source_length, source_lengths[i]);
+    const unsigned new_target_length = max(max_target_length, target_lengths[i]);
+    const unsigned padded_size = (batch.size() + 1) * (new_source_length + new_target_length);
+    if (batch.size() > 0 && (batch.size() >= max_sentences || (max_tokens > 0 && padded_size > max_tokens))) {
+      batches.push_back(batch);
+      batch.clear();
+      max_source_length = source_lengths[i];
+      max_target_length = target_lengths[i];
+    }
+    else {
+      max_source_length = new_source_length;
+      max_target_length = new_target_length;
+    }
+    batch.push_back(i);
+  }
+  if (batch.size() > 0) {
+    batches.push_back(batch);
+  }
+
+  shuffle(batches.begin(), batches.end(), rng);
+  return batches;
+}
+
+vector<SentencePair> BatchScheduler::Gather(const vector<unsigned>& batch) const {
+  vector<SentencePair> pairs(batch.size());
+  for (unsigned i = 0; i < batch.size(); ++i) {
+    pairs[i] = bitext[batch[i]];
+  }
+  return pairs;
+}
+
+PaddingStats BatchScheduler::ComputePaddingStats(const vector<vector<unsigned>>& batches) const {
+  PaddingStats stats;
+  for (const vector<unsigned>& batch : batches) {
+    unsigned max_source_length = 0;
+    unsigned max_target_length = 0;
+    for (unsigned i : batch) {
+      stats.real_tokens += source_lengths[i] + target_lengths[i];
+      max_source_length = max(max_source_length, source_lengths[i]);
+      max_target_length = max(max_target_length, target_lengths[i]);
+    }
+    stats.padded_tokens += batch.size() * (max_source_length + max_target_length);
+    stats.batch_count++;
+  }
+  return stats;
+}
@@ -0,0 +1,42 @@
+#pragma once
+#include <vector>
+#include <iostream>
+#include "utils.h"
+
+using namespace std;
+
+// How much of a set of batches is real data rather than padding
+struct PaddingStats {
+  PaddingStats();
+  double Efficiency() const;
+
+  unsigned batch_count;
+  unsigned long real_tokens;
+  unsigned long padded_tokens;
+};
+ostream& operator<<(ostream& stream, const PaddingStats& stats);
+
+// Splits a corpus into training minibatches of sentence pairs with similar
+// lengths. Pairs are sorted by (source length, target length), with ties
+// broken randomly, and cut greedily into batches of at most max_sentences
+// pairs and at most max_tokens tokens once padded. The order of the batches
+// is shuffled. Each epoch gets its own, reproducible, random choices.
+class BatchScheduler {
+public:
+  // max_tokens = 0 means there is no token budget, only the sentence limit
+  BatchScheduler(const Bitext& bitext, unsigned max_sentences, unsigned max_tokens, unsigned seed);
+
+  // Returns the batches of the given epoch, as indices into the bitext.
+  // Every pair appears in exactly one batch.
+  vector<vector<unsigned>> Batches(unsigned epoch) const;
+  vector<SentencePair> Gather(const vector<unsigned>& batch) const;
+  PaddingStats ComputePaddingStats(const vector<vector<unsigned>>& batches) const;
+
+private:
+  const Bitext& bitext;
+  vector<unsigned> source_lengths;
+  vector<unsigned> target_lengths;
+  unsigned max_sentences;
+  unsigned max_tokens;
+  unsigned seed;
+};
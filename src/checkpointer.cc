@@ -0,0 +1,132 @@
+#include <sstream>
+#include <iostream>
+#include <cstdio>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include "checkpointer.h"
+
+namespace {
+// Writes data to filename.tmp, syncs it, and renames it to filename
+bool WriteAtomically(const string& filename, const string& data) {
+  const string temp_filename = filename + ".tmp";
+  int fd = open(temp_filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    cerr << "Unable to open " << temp_filename << " for writing: " << strerror(errno) << endl;
+    return false;
+  }
+
+  const char* p = data.data();
+  size_t remaining = data.size();
+  while (remaining > 0) {
+    ssize_t written = write(fd, p, remaining);
+    if (written < 0 && errno == EINTR) {
+      continue;
+    }
+    if (written <= 0) {
+      cerr << "Unable to write " << temp_filename << ": " << strerror(errno) << endl;
+      close(fd);
+      return false;
+    }
+    p += written;
+    remaining -= written;
+  }
+
+  if (fsync(fd) != 0 || close(fd) != 0) {
+    cerr << "Unable to sync " << temp_filename << ": " << strerror(errno) << endl;
+    return false;
+  }
+  if (rename(temp_filename.c_str(), filename.c_str()) != 0) {
+    cerr << "Unable to rename " << temp_filename << " to " << filename << ": " << strerror(errno) << endl;
+    return false;
+  }
+
+  // Make the rename itself durable
+  const size_t slash = filename.rfind('/');
+  const string directory = (slash == string::npos) ? "." : filename.substr(0, slash + 1);
+  int dir_fd = open(directory.c_str(), O_RDONLY);
+  if (dir_fd >= 0) {
+    fsync(dir_fd);
+    close(dir_fd);
+  }
+  return true;
+}
+}
+
+Checkpointer::Checkpointer(const string& prefix, unsigned keep_last) : prefix(prefix), keep_last(keep_last), count(0), busy(false), done(false) {}
+
+Checkpointer::~Checkpointer() {
+  if (writer.joinable()) {
+    {
+      lock_guard<mutex> lock(jobs_mutex);
+      done = true;
+    }
+    jobs_changed.notify_all();
+    writer.join();
+  }
+}
+
+void Checkpointer::Save(const InputReader* const input_reader, const OutputReader* const output_reader, const Translator& translator, Model& dynet_model, const Trainer* const trainer, bool best) {
+  ostringstream out;
+  Serialize(input_reader, output_reader, translator, dynet_model, trainer, out);
+
+  Job job;
+  job.data = make_shared<string>(out.str());
+  job.number = ++count;
+  job.best = best;
+
+  if (!writer.joinable()) {
+    writer = thread(&Checkpointer::Run, this);
+  }
+  {
+    lock_guard<mutex> lock(jobs_mutex);
+    jobs.push_back(job);
+  }
+  jobs_changed.notify_all();
+}
+
+void Checkpointer::Wait() {
+  unique_lock<mutex> lock(jobs_mutex);
+  jobs_changed.wait(lock, [this] { return jobs.empty() && !busy; });
+}
+
+void Checkpointer::Run() {
+  while (true) {
+    Job job;
+    {
+      unique_lock<mutex> lock(jobs_mutex);
+      jobs_changed.wait(lock, [this] { return !jobs.empty() || done; });
+      if (jobs.empty()) {
+        return;
+      }
+      job = jobs.front();
+      jobs.pop_front();
+      busy = true;
+    }
+
+    Write(job);
+
+    {
+      lock_guard<mutex> lock(jobs_mutex);
+      busy = false;
+    }
+    jobs_changed.notify_all();
+  }
+}
+
+void Checkpointer::Write(const Job& job) {
+  if (!WriteAtomically(Filename(job.number), *job.data)) {
+    return;
+  }
+  if (job.best) {
+    WriteAtomically(prefix + ".best", *job.data);
+  }
+  if (job.number > keep_last) {
+    remove(Filename(job.number - keep_last).c_str());
+  }
+}
+
+string Checkpointer::Filename(unsigned number) const {
+  return prefix + "." + to_string(number);
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "io.h"
+
+using namespace std;
+
+// Saves models without holding up training. Save() serializes the model into
+// memory, which is quick, and a background thread then writes it to disk.
+// Files are written under a temporary name, synced, and renamed into place,
+// so a crash never leaves a partially written checkpoint behind.
+// Checkpoints are named prefix.1, prefix.2, etc., and only the last keep_last
+// of them are kept. The best one so far is also saved as prefix.best.
+class Checkpointer {
+public:
+  Checkpointer(const string& prefix, unsigned keep_last);
+  // Waits for any pending writes to finish
+  ~Checkpointer();
+
+  void Save(const InputReader* const input_reader, const OutputReader* const output_reader, const Translator& translator, Model& dynet_model, const Trainer* const trainer, bool best);
+  // Blocks until everything saved so far is on disk
+  void Wait();
+
+private:
+  struct Job {
+    shared_ptr<string> data;
+    unsigned number;
+    bool best;
+  };
+
+  void Run();
+  void Write(const Job& job);
+  string Filename(unsigned number) const;
+
+  string prefix;
+  unsigned keep_last;
+  unsigned count;
+
+  // The thread is only started on the first Save(), so that forking training
+  // workers beforehand doesn't copy a process with several threads in it
+  thread writer;
+  mutex jobs_mutex;
+  condition_variable jobs_changed;
+  deque<Job> jobs;
+  bool busy;
+  bool done;
+};
@@ -0,0 +1,34 @@
+#include <boost/program_options.hpp>
+
+#include <iostream>
+
+#include "corpus.h"
+
+using namespace std;
+namespace po = boost::program_options;
+
+int main(int argc, char** argv) {
+  po::options_description desc("description");
+  desc.add_options()
+  ("input", po::value<string>()->required(), "tokenized text, one sentence per line")
+  ("output", po::value<string>()->required(), "where to write the compiled corpus")
+  ("help", "Display this help message");
+
+  po::positional_options_description positional_options;
+  positional_options.add("input", 1);
+  positional_options.add("output", 1);
+
+  po::variables_map vm;
+  po::store(po::command_line_parser(argc, argv).options(desc).positional(positional_options).run(), vm, true);
+
+  if (vm.count("help")) {
+    cerr << "Compiles one side of a corpus into a binary file that train, loss, etc. can load in place of the text." << endl;
+    cerr << desc;
+    return 1;
+  }
+
+  po::notify(vm);
+
+  CompileCorpus(vm["input"].as<string>(), vm["output"].as<string>());
+  return 0;
+}
@@ -0,0 +1,65 @@
+#include "dynet/dynet.h"
+#include <boost/program_options.hpp>
+
+#include <iostream>
+#include <fstream>
+
+#include "io.h"
+#include "mapped_model.h"
+
+using namespace dynet;
+using namespace std;
+namespace po = boost::program_options;
+
+int main(int argc, char** argv) {
+  dynet::initialize(argc, argv);
+
+  po::options_description desc("description");
+  desc.add_options()
+  ("input", po::value<string>()->required(), "model file, in either format")
+  ("output", po::value<string>()->required(), "where to write the converted model")
+  ("archive", "Write the boost archive format that train outputs, instead of the mapped format")
+  ("keep_trainer", "Keep the trainer's state (e.g. Adam moments) so training can be resumed from the output. By default it's dropped, since inference doesn't need it")
+  ("help", "Display this help message");
+
+  po::positional_options_description positional_options;
+  positional_options.add("input", 1);
+  positional_options.add("output", 1);
+
+  po::variables_map vm;
+  po::store(po::command_line_parser(argc, argv).options(desc).positional(positional_options).run(), vm, true);
+
+  if (vm.count("help")) {
+    cerr << desc;
+    return 1;
+  }
+
+  po::notify(vm);
+
+  const string input_filename = vm["input"].as<string>();
+  const string output_filename = vm["output"].as<string>();
+
+  InputReader* input_reader = nullptr;
+  OutputReader* output_reader = nullptr;
+  Translator translator;
+  Model dynet_model;
+  Trainer* trainer = nullptr;
+  Deserialize(input_filename, input_reader, output_reader, translator, dynet_model, trainer);
+  if (!vm.count("keep_trainer")) {
+    trainer = nullptr;
+  }
+
+  if (vm.count("archive")) {
+    ofstream f(output_filename, ios::binary);
+    if (!f.is_open()) {
+      cerr << "Unable to open " << output_filename << " for writing." << endl;
+      return 1;
+    }
+    Serialize(input_reader, output_reader, translator, dynet_model, trainer, f);
+  }
+  else {
+    SerializeMapped(output_filename, input_reader, output_reader, translator, dynet_model, trainer);
+  }
+
+  return 0;
+}
@@ -0,0 +1,204 @@
+#include <fstream>
+#include <iostream>
+#include <unordered_map>
+#include <cstring>
+#include <cassert>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "corpus.h"
+
+namespace {
+struct CompiledCorpusHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t vocab_count;
+  uint64_t sentence_count;
+  uint64_t token_count;
+  uint64_t vocab_offset;
+  uint64_t vocab_size;
+  uint64_t offsets_offset;
+  uint64_t tokens_offset;
+};
+
+uint64_t Align(uint64_t offset) {
+  return (offset + 7) / 8 * 8;
+}
+}
+
+CompiledCorpus::CompiledCorpus(const string& filename) {
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    cerr << "Unable to open " << filename << " for reading." << endl;
+    assert (fd >= 0);
+  }
+  struct stat st;
+  int r = fstat(fd, &st);
+  assert (r == 0);
+  file_size = st.st_size;
+  assert (file_size >= sizeof(CompiledCorpusHeader));
+
+  base = (char*)mmap(nullptr, file_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) {
+    cerr << "Unable to map " << filename << " into memory." << endl;
+    assert (base != MAP_FAILED);
+  }
+  madvise(base, file_size, MADV_SEQUENTIAL);
+
+  const CompiledCorpusHeader& header = *reinterpret_cast<const CompiledCorpusHeader*>(base);
+  assert (memcmp(header.magic, kCompiledCorpusMagic, sizeof(header.magic)) == 0);
+  if (header.version != kCompiledCorpusVersion) {
+    cerr << filename << " is compiled corpus version " << header.version << ", but only version " << kCompiledCorpusVersion << " is supported." << endl;
+    assert (header.version == kCompiledCorpusVersion);
+  }
+  if (header.tokens_offset + header.token_count * sizeof(int32_t) > file_size) {
+    cerr << filename << " is shorter than its header says. Is it truncated?" << endl;
+    assert (header.tokens_offset + header.token_count * sizeof(int32_t) <= file_size);
+  }
+
+  sentence_count = header.sentence_count;
+  offsets = reinterpret_cast<const uint64_t*>(base + header.offsets_offset);
+  tokens = reinterpret_cast<const int32_t*>(base + header.tokens_offset);
+
+  vocab.reserve(header.vocab_count);
+  const char* p = base + header.vocab_offset;
+  const char* end = p + header.vocab_size;
+  while (p < end) {
+    const size_t length = strnlen(p, end - p);
+    vocab.push_back(string(p, length));
+    p += length + 1;
+  }
+  assert (vocab.size() == header.vocab_count);
+}
+
+CompiledCorpus::~CompiledCorpus() {
+  munmap(base, file_size);
+}
+
+unsigned CompiledCorpus::size() const {
+  return sentence_count;
+}
+
+unsigned CompiledCorpus::Length(unsigned sentence) const {
+  assert (sentence < sentence_count);
+  return offsets[sentence + 1] - offsets[sentence];
+}
+
+const int32_t* CompiledCorpus::Sentence(unsigned sentence) const {
+  assert (sentence < sentence_count);
+  return tokens + offsets[sentence];
+}
+
+const vector<string>& CompiledCorpus::Vocab() const {
+  return vocab;
+}
+
+vector<WordId> CompiledCorpus::Remap(Dict& dict) const {
+  vector<WordId> ids(vocab.size());
+  for (unsigned i = 0; i < vocab.size(); ++i) {
+    ids[i] = dict.convert(vocab[i]);
+  }
+  return ids;
+}
+
+bool IsCompiledCorpus(const string& filename) {
+  ifstream f(filename, ios::binary);
+  char magic[sizeof(kCompiledCorpusMagic)];
+  if (!f.read(magic, sizeof(magic))) {
+    return false;
+  }
+  return memcmp(magic, kCompiledCorpusMagic, sizeof(magic)) == 0;
+}
+
+void CompileCorpus(const string& input_filename, const string& output_filename) {
+  ifstream in(input_filename);
+  if (!in.is_open()) {
+    cerr << "Unable to open " << input_filename << " for reading." << endl;
+    assert (in.is_open());
+  }
+
+  unordered_map<string, int32_t> ids;
+  vector<string> vocab;
+  vector<uint64_t> offsets(1, 0);
+  vector<int32_t> tokens;
+  for (string line; getline(in, line);) {
+    for (const string& word : tokenize(strip(line), " ")) {
+      auto it = ids.find(word);
+      if (it == ids.end()) {
+        it = ids.insert(make_pair(word, (int32_t)vocab.size())).first;
+        vocab.push_back(word);
+      }
+      tokens.push_back(it->second);
+    }
+    offsets.push_back(tokens.size());
+  }
+
+  string vocab_bytes;
+  for (const string& word : vocab) {
+    vocab_bytes += word;
+    vocab_bytes += '\0';
+  }
+
+  CompiledCorpusHeader header = {};
+  memcpy(header.magic, kCompiledCorpusMagic, sizeof(header.magic));
+  header.version = kCompiledCorpusVersion;
+  header.vocab_count = vocab.size();
+  header.sentence_count = offsets.size() - 1;
+  header.token_count = tokens.size();
+  header.vocab_offset = sizeof(header);
+  header.vocab_size = vocab_bytes.size();
+  header.offsets_offset = Align(header.vocab_offset + header.vocab_size);
+  header.tokens_offset = header.offsets_offset + offsets.size() * sizeof(uint64_t);
+
+  ofstream out(output_filename, ios::binary);
+  if (!out.is_open()) {
+    cerr << "Unable to open " << output_filename << " for writing." << endl;
+    assert (out.is_open());
+  }
+  const char padding[8] = {};
+  out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  out.write(vocab_bytes.data(), vocab_bytes.size());
+  out.write(padding, header.offsets_offset - header.vocab_offset - header.vocab_size);
+  out.write(reinterpret_cast<const char*>(offsets.data()), offsets.size() * sizeof(uint64_t));
+  out.write(reinterpret_cast<const char*>(tokens.data()), tokens.size() * sizeof(int32_t));
+  out.close();
+  if (!out) {
+    cerr << "Error writing " << output_filename << endl;
+    assert (false);
+  }
+}
+
+vector<LinearSentence*> ReadCompiledSentences(const string& filename, Dict& dict, bool add_bos_eos) {
+  CompiledCorpus corpus(filename);
+
+  Word bos, eos;
+  if (add_bos_eos) {
+    bos = Word(dict.convert("<s>"));
+  }
+  const vector<WordId> ids = corpus.Remap(dict);
+  if (add_bos_eos) {
+    eos = Word(dict.convert("</s>"));
+  }
+
+  vector<LinearSentence*> sentences(corpus.size());
+  for (unsigned i = 0; i < corpus.size(); ++i) {
+    const int32_t* tokens = corpus.Sentence(i);
+    const unsigned length = corpus.Length(i);
+    LinearSentence* sentence = new LinearSentence();
+    sentence->reserve(length + (add_bos_eos ? 2 : 0));
+    if (add_bos_eos) {
+      sentence->push_back(bos);
+    }
+    for (unsigned j = 0; j < length; ++j) {
+      assert (tokens[j] >= 0 && (unsigned)tokens[j] < ids.size());
+      sentence->push_back(Word(ids[tokens[j]]));
+    }
+    if (add_bos_eos) {
+      sentence->push_back(eos);
+    }
+    sentences[i] = sentence;
+  }
+  return sentences;
+}
@@ -0,0 +1,55 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "dynet/dict.h"
+#include "utils.h"
+
+using namespace std;
+using namespace dynet;
+
+// A corpus that has already been tokenized and numberized by compile_corpus,
+// so that it can be loaded without parsing any text.
+// The file is a fixed header, the corpus's own vocabulary as NUL separated
+// strings, one offset per sentence into the token array, and then the tokens
+// as int32 ids into that vocabulary. The vocabulary is stored in order of first
+// appearance. When the corpus is loaded, each of its words is looked up in the
+// reader's Dict once, and token ids are remapped through that table.
+const char kCompiledCorpusMagic[8] = {'A', 'M', 'C', 'O', 'R', 'P', 'U', 'S'};
+const unsigned kCompiledCorpusVersion = 1;
+
+class CompiledCorpus {
+public:
+  // Maps filename into memory
+  explicit CompiledCorpus(const string& filename);
+  ~CompiledCorpus();
+
+  unsigned size() const;
+  unsigned Length(unsigned sentence) const;
+  // The tokens of a sentence, as ids into Vocab()
+  const int32_t* Sentence(unsigned sentence) const;
+  const vector<string>& Vocab() const;
+
+  // Returns the id of each entry of Vocab() according to dict
+  vector<WordId> Remap(Dict& dict) const;
+
+private:
+  CompiledCorpus(const CompiledCorpus&) = delete;
+  CompiledCorpus& operator=(const CompiledCorpus&) = delete;
+
+  char* base;
+  size_t file_size;
+  unsigned sentence_count;
+  const uint64_t* offsets;
+  const int32_t* tokens;
+  vector<string> vocab;
+};
+
+// Returns true if filename starts with the compiled corpus header
+bool IsCompiledCorpus(const string& filename);
+
+// Tokenizes the text in input_filename, one sentence per line, and writes it to output_filename
+void CompileCorpus(const string& input_filename, const string& output_filename);
+
+// Reads a compiled corpus into sentences, converting its words with dict
+vector<LinearSentence*> ReadCompiledSentences(const string& filename, Dict& dict, bool add_bos_eos);
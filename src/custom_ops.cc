@@ -0,0 +1,398 @@
+#include <cassert>
+#include <cmath>
+#include <algorithm>
+#include <vector>
+#include <sstream>
+#include "dynet/tensor.h"
+#include "dynet/nodes.h"
+#include "custom_ops.h"
+#include "attention_kernels.h"
+
+using namespace std;
+
+namespace dynet {
+
+struct AdditiveAttention : public Node {
+  explicit AdditiveAttention(const initializer_list<VariableIndex>& a) : Node(a) {}
+
+  string as_string(const vector<string>& arg_names) const override {
+    ostringstream s;
+    s << "additive_attention(" << arg_names[0] << ", " << arg_names[1] << ", " << arg_names[2] << ')';
+    return s.str();
+  }
+
+  Dim dim_forward(const vector<Dim>& xs) const override {
+    assert (xs.size() == 3);
+    const Dim& keys = xs[0];
+    const Dim& query = xs[1];
+    const Dim& u = xs[2];
+    assert (query.rows() == keys.rows() && query.cols() == 1);
+    assert (u.rows() == 1 && u.cols() == keys.rows() && u.bd == 1);
+    assert (keys.bd == 1 || query.bd == 1 || keys.bd == query.bd);
+    hidden_dim = keys.rows();
+    return Dim({keys.cols(), 1}, max(keys.bd, query.bd));
+  }
+
+  // The tanh activations are kept around for the backward pass
+  size_t aux_storage_size() const override {
+    return hidden_dim * dim.size() * sizeof(float);
+  }
+
+  bool supports_multibatch() const override {
+    return true;
+  }
+
+  void forward_impl(const vector<const Tensor*>& xs, Tensor& fx) const override {
+    const Tensor& keys = *xs[0];
+    const Tensor& query = *xs[1];
+    const float* u = xs[2]->v;
+    const unsigned H = hidden_dim;
+    const unsigned N = keys.d.cols();
+    float* activations = static_cast<float*>(aux_mem);
+
+    for (unsigned b = 0; b < fx.d.bd; ++b) {
+      const float* K = keys.v + (keys.d.bd == 1 ? 0 : b * H * N);
+      const float* q = query.v + (query.d.bd == 1 ? 0 : b * H);
+      float* T = activations + b * H * N;
+      float* scores = fx.v + b * N;
+      for (unsigned n = 0; n < N; ++n) {
+        float score = 0.0f;
+        for (unsigned h = 0; h < H; ++h) {
+          const float t = tanh(K[n * H + h] + q[h]);
+          T[n * H + h] = t;
+          score += u[h] * t;
+        }
+        scores[n] = score;
+      }
+    }
+  }
+
+  void backward_impl(const vector<const Tensor*>& xs, const Tensor& fx, const Tensor& dEdf, unsigned i, Tensor& dEdxi) const override {
+    const float* u = xs[2]->v;
+    const unsigned H = hidden_dim;
+    const unsigned N = xs[0]->d.cols();
+    const float* activations = static_cast<const float*>(aux_mem);
+
+    for (unsigned b = 0; b < fx.d.bd; ++b) {
+      const float* T = activations + b * H * N;
+      const float* g = dEdf.v + b * N;
+      // If the argument we're differentiating isn't batched, its gradient
+      // accumulates over the whole batch.
+      float* d = dEdxi.v;
+      if (i == 0 && dEdxi.d.bd > 1) {
+        d += b * H * N;
+      }
+      else if (i == 1 && dEdxi.d.bd > 1) {
+        d += b * H;
+      }
+
+      for (unsigned n = 0; n < N; ++n) {
+        for (unsigned h = 0; h < H; ++h) {
+          const float t = T[n * H + h];
+          if (i == 0) {
+            d[n * H + h] += g[n] * u[h] * (1.0f - t * t);
+          }
+          else if (i == 1) {
+            d[h] += g[n] * u[h] * (1.0f - t * t);
+          }
+          else {
+            d[h] += g[n] * t;
+          }
+        }
+      }
+    }
+  }
+
+  // Set by dim_forward, which always runs before aux_storage_size and forward
+  mutable unsigned hidden_dim;
+};
+
+struct AdditiveAttentionSoftmax : public Node {
+  explicit AdditiveAttentionSoftmax(const initializer_list<VariableIndex>& a) : Node(a) {}
+
+  string as_string(const vector<string>& arg_names) const override {
+    ostringstream s;
+    s << "additive_attention_softmax(" << arg_names[0] << ", " << arg_names[1] << ", " << arg_names[2];
+    if (arg_names.size() == 4) {
+      s << ", " << arg_names[3];
+    }
+    s << ')';
+    return s.str();
+  }
+
+  Dim dim_forward(const vector<Dim>& xs) const override {
+    assert (xs.size() == 3 || xs.size() == 4);
+    const Dim& keys = xs[0];
+    const Dim& query = xs[1];
+    const Dim& u = xs[2];
+    assert (query.rows() == keys.rows() && query.cols() == 1);
+    assert (u.rows() == 1 && u.cols() == keys.rows() && u.bd == 1);
+    assert (keys.bd == 1 || query.bd == 1 || keys.bd == query.bd);
+    const unsigned bd = max(keys.bd, query.bd);
+    if (xs.size() == 4) {
+      const Dim& mask = xs[3];
+      assert (mask.rows() == keys.cols() && mask.cols() == 1);
+      assert (mask.bd == 1 || mask.bd == bd);
+    }
+    return Dim({keys.cols(), 1}, bd);
+  }
+
+  bool supports_multibatch() const override {
+    return true;
+  }
+
+  void forward_impl(const vector<const Tensor*>& xs, Tensor& fx) const override {
+    const Tensor& keys = *xs[0];
+    const Tensor& query = *xs[1];
+    const float* u = xs[2]->v;
+    const Tensor* mask = (xs.size() == 4) ? xs[3] : nullptr;
+    const unsigned H = keys.d.rows();
+    const unsigned N = keys.d.cols();
+
+    for (unsigned b = 0; b < fx.d.bd; ++b) {
+      const float* K = keys.v + (keys.d.bd == 1 ? 0 : b * H * N);
+      const float* q = query.v + (query.d.bd == 1 ? 0 : b * H);
+      float* p = fx.v + b * N;
+      AdditiveAttentionScores(K, q, u, H, N, p);
+      if (mask != nullptr) {
+        const float* m = mask->v + (mask->d.bd == 1 ? 0 : b * N);
+        for (unsigned n = 0; n < N; ++n) {
+          p[n] += m[n];
+        }
+      }
+
+      const float max_score = *max_element(p, p + N);
+      float Z = 0.0f;
+      for (unsigned n = 0; n < N; ++n) {
+        p[n] = exp(p[n] - max_score);
+        Z += p[n];
+      }
+      for (unsigned n = 0; n < N; ++n) {
+        p[n] /= Z;
+      }
+    }
+  }
+
+  void backward_impl(const vector<const Tensor*>& xs, const Tensor& fx, const Tensor& dEdf, unsigned i, Tensor& dEdxi) const override {
+    const Tensor& keys = *xs[0];
+    const Tensor& query = *xs[1];
+    const float* u = xs[2]->v;
+    const unsigned H = keys.d.rows();
+    const unsigned N = keys.d.cols();
+    vector<float> dscores(N);
+
+    for (unsigned b = 0; b < fx.d.bd; ++b) {
+      // Back through the softmax: ds_n = p_n * (g_n - sum_m g_m * p_m)
+      const float* p = fx.v + b * N;
+      const float* g = dEdf.v + b * N;
+      float gp = 0.0f;
+      for (unsigned n = 0; n < N; ++n) {
+        gp += g[n] * p[n];
+      }
+      for (unsigned n = 0; n < N; ++n) {
+        dscores[n] = p[n] * (g[n] - gp);
+      }
+
+      // If the argument we're differentiating isn't batched, its gradient
+      // accumulates over the whole batch.
+      if (i == 3) {
+        float* d = dEdxi.v + (dEdxi.d.bd == 1 ? 0 : b * N);
+        for (unsigned n = 0; n < N; ++n) {
+          d[n] += dscores[n];
+        }
+        continue;
+      }
+
+      const float* K = keys.v + (keys.d.bd == 1 ? 0 : b * H * N);
+      const float* q = query.v + (query.d.bd == 1 ? 0 : b * H);
+      float* dK = nullptr;
+      float* dq = nullptr;
+      float* du = nullptr;
+      if (i == 0) {
+        dK = dEdxi.v + (dEdxi.d.bd == 1 ? 0 : b * H * N);
+      }
+      else if (i == 1) {
+        dq = dEdxi.v + (dEdxi.d.bd == 1 ? 0 : b * H);
+      }
+      else {
+        du = dEdxi.v;
+      }
+      AdditiveAttentionBackward(K, q, u, H, N, dscores.data(), dK, dq, du);
+    }
+  }
+};
+
+struct JumpConvolutionNode : public Node {
+  explicit JumpConvolutionNode(const initializer_list<VariableIndex>& a) : Node(a) {}
+
+  string as_string(const vector<string>& arg_names) const override {
+    ostringstream s;
+    s << "jump_convolution(" << arg_names[0] << ", " << arg_names[1] << ')';
+    return s.str();
+  }
+
+  Dim dim_forward(const vector<Dim>& xs) const override {
+    assert (xs.size() == 2);
+    const Dim& x = xs[0];
+    const Dim& filter = xs[1];
+    assert (x.cols() == 1);
+    assert (filter.rows() == 1 && filter.cols() >= 1 && filter.bd == 1);
+    return Dim({x.rows(), 1}, x.bd);
+  }
+
+  bool supports_multibatch() const override {
+    return true;
+  }
+
+  void forward_impl(const vector<const Tensor*>& xs, Tensor& fx) const override {
+    const unsigned N = xs[0]->d.rows();
+    const unsigned W = xs[1]->d.cols();
+    for (unsigned b = 0; b < fx.d.bd; ++b) {
+      JumpConvolution(xs[0]->v + b * N, N, xs[1]->v, W, fx.v + b * N);
+    }
+  }
+
+  void backward_impl(const vector<const Tensor*>& xs, const Tensor& fx, const Tensor& dEdf, unsigned i, Tensor& dEdxi) const override {
+    const unsigned N = xs[0]->d.rows();
+    const unsigned W = xs[1]->d.cols();
+    for (unsigned b = 0; b < fx.d.bd; ++b) {
+      float* dx = (i == 0) ? dEdxi.v + b * N : nullptr;
+      float* df = (i == 1) ? dEdxi.v : nullptr;
+      JumpConvolutionBackward(xs[0]->v + b * N, N, xs[1]->v, W, dEdf.v + b * N, dx, df);
+    }
+  }
+};
+
+struct PriorCombine : public Node {
+  // Arguments are scores, then each log potential followed by its weight
+  template <typename T> explicit PriorCombine(const T& a) : Node(a) {}
+
+  string as_string(const vector<string>& arg_names) const override {
+    ostringstream s;
+    s << "prior_combine(" << arg_names[0];
+    for (unsigned j = 1; j < arg_names.size(); j += 2) {
+      s << " + " << arg_names[j + 1] << " * " << arg_names[j];
+    }
+    s << ')';
+    return s.str();
+  }
+
+  Dim dim_forward(const vector<Dim>& xs) const override {
+    assert (xs.size() % 2 == 1);
+    const unsigned N = xs[0].rows();
+    unsigned bd = xs[0].bd;
+    for (unsigned j = 1; j < xs.size(); j += 2) {
+      assert (xs[j].rows() == N && xs[j].cols() == 1);
+      assert (xs[j + 1].size() == 1);
+      bd = max(bd, xs[j].bd);
+    }
+    assert (xs[0].cols() == 1);
+    for (unsigned j = 0; j < xs.size(); j += 2) {
+      assert (xs[j].bd == 1 || xs[j].bd == bd);
+    }
+    return Dim({N, 1}, bd);
+  }
+
+  bool supports_multibatch() const override {
+    return true;
+  }
+
+  void forward_impl(const vector<const Tensor*>& xs, Tensor& fx) const override {
+    const unsigned N = fx.d.rows();
+    for (unsigned b = 0; b < fx.d.bd; ++b) {
+      float* p = fx.v + b * N;
+      const float* s = xs[0]->v + (xs[0]->d.bd == 1 ? 0 : b * N);
+      copy(s, s + N, p);
+      for (unsigned j = 1; j < xs.size(); j += 2) {
+        const float* z = xs[j]->v + (xs[j]->d.bd == 1 ? 0 : b * N);
+        const float w = xs[j + 1]->v[0];
+        for (unsigned n = 0; n < N; ++n) {
+          p[n] += w * z[n];
+        }
+      }
+
+      const float max_score = *max_element(p, p + N);
+      float Z = 0.0f;
+      for (unsigned n = 0; n < N; ++n) {
+        p[n] = exp(p[n] - max_score);
+        Z += p[n];
+      }
+      for (unsigned n = 0; n < N; ++n) {
+        p[n] /= Z;
+      }
+    }
+  }
+
+  void backward_impl(const vector<const Tensor*>& xs, const Tensor& fx, const Tensor& dEdf, unsigned i, Tensor& dEdxi) const override {
+    const unsigned N = fx.d.rows();
+    vector<float> dscores(N);
+    for (unsigned b = 0; b < fx.d.bd; ++b) {
+      // Back through the softmax: ds_n = p_n * (g_n - sum_m g_m * p_m)
+      const float* p = fx.v + b * N;
+      const float* g = dEdf.v + b * N;
+      float gp = 0.0f;
+      for (unsigned n = 0; n < N; ++n) {
+        gp += g[n] * p[n];
+      }
+      for (unsigned n = 0; n < N; ++n) {
+        dscores[n] = p[n] * (g[n] - gp);
+      }
+
+      // Unbatched arguments accumulate their gradient over the whole batch
+      if (i == 0) {
+        float* d = dEdxi.v + (dEdxi.d.bd == 1 ? 0 : b * N);
+        for (unsigned n = 0; n < N; ++n) {
+          d[n] += dscores[n];
+        }
+      }
+      else if (i % 2 == 1) {
+        const float w = xs[i + 1]->v[0];
+        float* d = dEdxi.v + (dEdxi.d.bd == 1 ? 0 : b * N);
+        for (unsigned n = 0; n < N; ++n) {
+          d[n] += w * dscores[n];
+        }
+      }
+      else {
+        const float* z = xs[i - 1]->v + (xs[i - 1]->d.bd == 1 ? 0 : b * N);
+        float dw = 0.0f;
+        for (unsigned n = 0; n < N; ++n) {
+          dw += z[n] * dscores[n];
+        }
+        dEdxi.v[0] += dw;
+      }
+    }
+  }
+};
+
+} // namespace dynet
+
+Expression additive_attention(const Expression& keys, const Expression& query, const Expression& u) {
+  ComputationGraph* pg = keys.pg;
+  return Expression(pg, pg->add_function<AdditiveAttention>({keys.i, query.i, u.i}));
+}
+
+Expression additive_attention_softmax(const Expression& keys, const Expression& query, const Expression& u) {
+  ComputationGraph* pg = keys.pg;
+  return Expression(pg, pg->add_function<AdditiveAttentionSoftmax>({keys.i, query.i, u.i}));
+}
+
+Expression additive_attention_softmax(const Expression& keys, const Expression& query, const Expression& u, const Expression& mask) {
+  ComputationGraph* pg = keys.pg;
+  return Expression(pg, pg->add_function<AdditiveAttentionSoftmax>({keys.i, query.i, u.i, mask.i}));
+}
+
+Expression jump_convolution(const Expression& x, const Expression& filter) {
+  ComputationGraph* pg = x.pg;
+  return Expression(pg, pg->add_function<JumpConvolutionNode>({x.i, filter.i}));
+}
+
+Expression prior_combine(const Expression& scores, const vector<Expression>& log_potentials, const vector<Expression>& weights) {
+  assert (log_potentials.size() == weights.size());
+  ComputationGraph* pg = scores.pg;
+  vector<VariableIndex> args = {scores.i};
+  for (unsigned j = 0; j < log_potentials.size(); ++j) {
+    args.push_back(log_potentials[j].i);
+    args.push_back(weights[j].i);
+  }
+  return Expression(pg, pg->add_function<PriorCombine>(args));
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include "dynet/dynet.h"
+#include "dynet/expr.h"
+#include <vector>
+
+using namespace dynet;
+using namespace dynet::expr;
+
+// Operations that DyNet doesn't provide, or that we want as a single fused
+// node rather than a chain of small ones. These are implemented for the CPU only.
+
+// Additive (MLP) attention scores: transpose(u * tanh(keys + query * 1^T)).
+// keys is hidden_dim x N, query is a hidden_dim column vector and u is a
+// 1 x hidden_dim row vector. The result is an N x 1 column of scores. The query
+// is broadcast across the N columns without materializing N copies of it.
+// Either keys or query (but not u) may have several batch elements; if only
+// one of them does, the other is shared by the whole batch.
+Expression additive_attention(const Expression& keys, const Expression& query, const Expression& u);
+
+// softmax(additive_attention(keys, query, u) + mask), computed in a single node
+// with the vectorized kernels in attention_kernels.h. Neither the scores nor
+// the tanh activations are stored: the backward pass recomputes the
+// activations, so the node needs no memory beyond its N x 1 output. tanh is
+// approximated to within a few ulps. The optional mask is N x 1 and is added
+// to the scores before the softmax, so -inf entries get zero probability. It
+// may have one batch element or as many as the result.
+Expression additive_attention_softmax(const Expression& keys, const Expression& query, const Expression& u);
+Expression additive_attention_softmax(const Expression& keys, const Expression& query, const Expression& u, const Expression& mask);
+
+// The Markov prior's convolution of the previous alignment x (N x 1) with a
+// filter of W taps (1 x W), where tap k scores a jump of k - W / 2 positions
+// and the outermost taps also cover all longer jumps. See JumpConvolution in
+// attention_kernels.h. The result is N x 1. x may have several batch elements,
+// which share the filter.
+Expression jump_convolution(const Expression& x, const Expression& filter);
+
+// The alignment under a set of attention priors:
+// softmax(scores + sum_j weights[j] * log_potentials[j]). This equals
+// softmax(scores) times each softmax(log_potentials[j]) ^ weights[j],
+// renormalized, but it is built as one node instead of a chain of softmaxes,
+// powers, products and a broadcast normalizer. scores and each log potential
+// are N x 1. Each weight is 1 x 1 and has a single batch element. The other
+// arguments may have one batch element, or as many as the result. The
+// softmax sends -inf scores to zero, so padding masks still work.
+Expression prior_combine(const Expression& scores, const std::vector<Expression>& log_potentials, const std::vector<Expression>& weights);
@@ -7,6 +7,14 @@ const unsigned lstm_layer_count = 2;
 void Embedder::NewGraph(ComputationGraph& cg) {}
 void Embedder::SetDropout(float) {}
 
+Expression Embedder::EmbedBatch(const vector<Word>& words) {
+  vector<Expression> embeddings(words.size());
+  for (unsigned i = 0; i < words.size(); ++i) {
+    embeddings[i] = Embed(words[i]);
+  }
+  return concatenate_to_batch(embeddings);
+}
+
 StandardEmbedder::StandardEmbedder() {}
 
 StandardEmbedder::StandardEmbedder(Model& model, unsigned vocab_size, unsigned emb_dim) : emb_dim(emb_dim), pcg(nullptr) {
@@ -23,10 +31,16 @@ unsigned StandardEmbedder::Dim() const {
   return emb_dim;
 }
 
-Expression StandardEmbedder::Embed(const shared_ptr<const Word> word) {
-  const shared_ptr<const StandardWord> standard_word = dynamic_pointer_cast<const StandardWord>(word);
-  assert (standard_word != nullptr);
-  return lookup(*pcg, embeddings, standard_word->id);
+Expression StandardEmbedder::Embed(const Word& word) {
+  return lookup(*pcg, embeddings, word.standard_id());
+}
+
+Expression StandardEmbedder::EmbedBatch(const vector<Word>& words) {
+  vector<unsigned> ids(words.size());
+  for (unsigned i = 0; i < words.size(); ++i) {
+    ids[i] = words[i].standard_id();
+  }
+  return lookup(*pcg, embeddings, ids);
 }
 
 MorphologyEmbedder::MorphologyEmbedder() {}
@@ -114,21 +128,21 @@ Expression MorphologyEmbedder::EmbedCharSequence(const vector<WordId>& chars) {
   return char_emb;
 }
 
-Expression MorphologyEmbedder::Embed(const shared_ptr<const Word> word) {
-  const shared_ptr<const MorphoWord> mword = dynamic_pointer_cast<const MorphoWord>(word);
+Expression MorphologyEmbedder::Embed(const Word& word) {
+  const MorphoWord& mword = word.morpho();
 
   vector<Expression> pieces;
   if (use_words) {
-    Expression word_emb = EmbedWord(mword->word);
+    Expression word_emb = EmbedWord(mword.word);
     pieces.push_back(word_emb);
   }
 
   if (use_morphology) {
-    Expression morph_emb = EmbedAnalyses(mword->analyses);
+    Expression morph_emb = EmbedAnalyses(mword.analyses);
     pieces.push_back(morph_emb);
   }
 
-  Expression char_emb = EmbedCharSequence(mword->chars);
+  Expression char_emb = EmbedCharSequence(mword.chars);
   pieces.push_back(char_emb);
 
   return concatenate(pieces);
@@ -17,7 +17,9 @@ public:
   virtual void NewGraph(ComputationGraph& cg);
   virtual void SetDropout(float rate);
   virtual unsigned Dim() const = 0;
-  virtual Expression Embed(const shared_ptr<const Word> word) = 0;
+  virtual Expression Embed(const Word& word) = 0;
+  // Embeds several words at once, as the batch elements of one expression
+  virtual Expression EmbedBatch(const vector<Word>& words);
 private:
   friend class boost::serialization::access;
   template<class Archive>
@@ -32,7 +34,8 @@ public:
   void NewGraph(ComputationGraph& cg) override;
   void SetDropout(float rate) override;
   unsigned Dim() const override;
-  Expression Embed(const shared_ptr<const Word> word) override;
+  Expression Embed(const Word& word) override;
+  Expression EmbedBatch(const vector<Word>& words) override;
 private:
   unsigned emb_dim;
   LookupParameter embeddings;
@@ -61,7 +64,7 @@ public:
   Expression PoolAnalysisEmbeddings(const vector<Expression> analysis_embs);
   Expression EmbedAnalyses(const vector<Analysis>& analyses);
   Expression EmbedCharSequence(const vector<WordId>& chars);
-  Expression Embed(const shared_ptr<const Word> word) override;
+  Expression Embed(const Word& word) override;
 private:
   bool use_words;
   bool use_morphology;
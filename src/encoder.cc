@@ -1,9 +1,40 @@
+#include <algorithm>
 #include "encoder.h"
 BOOST_CLASS_EXPORT_IMPLEMENT(BidirectionalEncoder)
 BOOST_CLASS_EXPORT_IMPLEMENT(TrivialEncoder)
 
 const unsigned lstm_layer_count = 2;
 
+namespace {
+// Returns the words at each position of a batch of linear sentences, padded
+// to the length of the longest one by repeating each sentence's last word.
+vector<vector<Word>> PadBatch(const vector<const InputSentence*>& inputs, vector<unsigned>& lengths) {
+  lengths.resize(inputs.size());
+  unsigned max_length = 0;
+  for (unsigned j = 0; j < inputs.size(); ++j) {
+    const LinearSentence* sentence = dynamic_cast<const LinearSentence*>(inputs[j]);
+    assert (sentence != nullptr && sentence->size() > 0);
+    lengths[j] = sentence->size();
+    max_length = max(max_length, lengths[j]);
+  }
+
+  vector<vector<Word>> words(max_length, vector<Word>(inputs.size()));
+  for (unsigned j = 0; j < inputs.size(); ++j) {
+    const LinearSentence& sentence = *dynamic_cast<const LinearSentence*>(inputs[j]);
+    for (unsigned i = 0; i < max_length; ++i) {
+      words[i][j] = sentence[min(i, lengths[j] - 1)];
+    }
+  }
+  return words;
+}
+}
+
+vector<Expression> EncoderModel::EncodeBatch(const vector<const InputSentence*>& inputs) {
+  cerr << "This encoder does not support batching" << endl;
+  assert (false);
+  return vector<Expression>();
+}
+
 TrivialEncoder::TrivialEncoder() {}
 
 TrivialEncoder::TrivialEncoder(Model& model, Embedder* embedder, unsigned output_dim) : embedder(embedder) {
@@ -33,6 +64,17 @@ Expression TrivialEncoder::EncodeSentence(const InputSentence* const input) {
   return sum(Encode(input));
 }
 
+vector<Expression> TrivialEncoder::EncodeBatch(const vector<const InputSentence*>& inputs) {
+  vector<unsigned> lengths;
+  vector<vector<Word>> words = PadBatch(inputs, lengths);
+  vector<Expression> encodings(words.size());
+  for (unsigned i = 0; i < words.size(); ++i) {
+    Expression embedding = embedder->EmbedBatch(words[i]);
+    encodings[i] = affine_transform({b, W, embedding});
+  }
+  return encodings;
+}
+
 BidirectionalEncoder::BidirectionalEncoder() {}
 
 BidirectionalEncoder::BidirectionalEncoder(Model& model, Embedder* embedder, unsigned output_dim, bool peep_concat, bool peep_add) :
@@ -104,8 +146,17 @@ vector<Expression> BidirectionalEncoder::Encode(const InputSentence* const input
   return Encode(Embed(input));
 }
 
-vector<Expression> BidirectionalEncoder::EncodeForward(const vector<Expression>& embeddings) {
-  forward_builder.start_new_sequence(forward_lstm_init_v);
+vector<Expression> BidirectionalEncoder::EncodeForward(const vector<Expression>& embeddings, unsigned batch_size) {
+  if (batch_size > 1) {
+    vector<Expression> h0(forward_lstm_init_v.size());
+    for (unsigned k = 0; k < h0.size(); ++k) {
+      h0[k] = BroadcastToBatch(forward_lstm_init_v[k], batch_size);
+    }
+    forward_builder.start_new_sequence(h0);
+  }
+  else {
+    forward_builder.start_new_sequence(forward_lstm_init_v);
+  }
   vector<Expression> forward_encodings(embeddings.size());
   for (unsigned i = 0; i < embeddings.size(); ++i) {
     Expression x = embeddings[i];
@@ -126,6 +177,59 @@ vector<Expression> BidirectionalEncoder::EncodeReverse(const vector<Expression>&
   return reverse_encodings;
 }
 
+vector<Expression> BidirectionalEncoder::EncodeBatch(const vector<const InputSentence*>& inputs) {
+  vector<unsigned> lengths;
+  vector<vector<Word>> words = PadBatch(inputs, lengths);
+  vector<Expression> embeddings(words.size());
+  for (unsigned i = 0; i < words.size(); ++i) {
+    embeddings[i] = embedder->EmbedBatch(words[i]);
+  }
+
+  // Padding comes after the end of each sentence, so it can't affect the
+  // forward LSTM's states at real positions, but the reverse LSTM reads it first.
+  vector<Expression> forward_encodings = EncodeForward(embeddings, inputs.size());
+  vector<Expression> reverse_encodings = EncodeReverseBatch(embeddings, lengths);
+  vector<Expression> bidir_encodings(embeddings.size());
+  for (unsigned i = 0; i < embeddings.size(); ++i) {
+    const Expression& f = forward_encodings[i];
+    const Expression& r = reverse_encodings[embeddings.size() - 1 - i];
+    bidir_encodings[i] = concatenate({f, r});
+    if (peep_add) {
+      bidir_encodings[i] = bidir_encodings[i] + W * embeddings[i];
+    }
+    if (peep_concat) {
+      bidir_encodings[i] = concatenate({bidir_encodings[i], embeddings[i]});
+    }
+  }
+  return bidir_encodings;
+}
+
+// Like EncodeReverse, except that each sentence's state is held at the initial
+// state until the reverse LSTM reaches the sentence's last real word.
+vector<Expression> BidirectionalEncoder::EncodeReverseBatch(const vector<Expression>& embeddings, const vector<unsigned>& lengths) {
+  const unsigned min_length = *min_element(lengths.begin(), lengths.end());
+  vector<Expression> s(reverse_lstm_init_v.size());
+  for (unsigned k = 0; k < s.size(); ++k) {
+    s[k] = BroadcastToBatch(reverse_lstm_init_v[k], lengths.size());
+  }
+
+  reverse_builder.start_new_sequence(s);
+  vector<Expression> reverse_encodings(embeddings.size());
+  for (unsigned i = 0; i < embeddings.size(); ++i) {
+    const unsigned position = embeddings.size() - 1 - i;
+    reverse_encodings[i] = reverse_builder.add_input(embeddings[position]);
+    if (position >= min_length) {
+      Expression mask = LengthMask(*pcg, lengths, position);
+      vector<Expression> s_new = reverse_builder.final_s();
+      for (unsigned k = 0; k < s.size(); ++k) {
+        s[k] = s_new[k] * mask + s[k] * (1.0f - mask);
+      }
+      reverse_builder.start_new_sequence(s);
+    }
+  }
+  return reverse_encodings;
+}
+
 Expression BidirectionalEncoder::EncodeSentence(const InputSentence* const input) {
   const LinearSentence& sentence = *dynamic_cast<const LinearSentence*>(input);
   vector<Expression> embeddings(sentence.size());
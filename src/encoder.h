@@ -26,6 +26,12 @@ public:
   virtual vector<Expression> Encode(const InputSentence* const input) = 0;
   virtual Expression EncodeSentence(const InputSentence* const input) = 0;
 
+  // Encodes a batch of sentences at once, padded to the length of the longest
+  // one. Batch element j of each returned expression belongs to inputs[j].
+  // The encodings of padding positions are meaningless, and must be masked.
+  virtual bool SupportsBatchedEncoding() const { return false; }
+  virtual vector<Expression> EncodeBatch(const vector<const InputSentence*>& inputs);
+
 private:
   friend class boost::serialization::access;
   template<class Archive>
@@ -40,6 +46,8 @@ public:
   void NewGraph(ComputationGraph& cg);
   vector<Expression> Encode(const InputSentence* const input);
   Expression EncodeSentence(const InputSentence* const input);
+  bool SupportsBatchedEncoding() const override { return true; }
+  vector<Expression> EncodeBatch(const vector<const InputSentence*>& inputs) override;
 private:
   Embedder* embedder;
   Parameter p_W, p_b;
@@ -65,12 +73,16 @@ public:
   void NewGraph(ComputationGraph& cg);
   void SetDropout(float rate);
   vector<Expression> Encode(const InputSentence* const input);
-  vector<Expression> EncodeForward(const vector<Expression>& embeddings);
+  vector<Expression> EncodeForward(const vector<Expression>& embeddings, unsigned batch_size = 1);
   vector<Expression> EncodeReverse(const vector<Expression>& embeddings);
   vector<Expression> Encode(const vector<Expression>& embeddings);
   vector<Expression> Embed(const InputSentence* const input);
   Expression EncodeSentence(const InputSentence* const input);
+  bool SupportsBatchedEncoding() const override { return true; }
+  vector<Expression> EncodeBatch(const vector<const InputSentence*>& inputs) override;
 private:
+  vector<Expression> EncodeReverseBatch(const vector<Expression>& embeddings, const vector<unsigned>& lengths);
+
   Embedder* embedder;
   unsigned output_dim;
   bool peep_concat, peep_add;
@@ -0,0 +1,100 @@
+#include <sstream>
+#include <cassert>
+#include <sys/mman.h>
+#include "hogwild.h"
+
+HogwildTrainer::HogwildTrainer(unsigned worker_count, Learner* learner, Trainer* trainer, const Bitext& train_bitext, const Bitext& dev_bitext) :
+    learner(learner), trainer(trainer), train_bitext(train_bitext), dev_bitext(dev_bitext), worker_epoch(0) {
+  assert (atomic<unsigned>().is_lock_free());
+  const unsigned max_count = max(train_bitext.size(), dev_bitext.size());
+  shared_size = sizeof(Queue) + max_count * sizeof(unsigned);
+  void* shared = mmap(nullptr, shared_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (shared == MAP_FAILED) {
+    cerr << "Unable to allocate shared memory for the training workers" << endl;
+    abort();
+  }
+  queue = new (shared) Queue();
+  indices = (unsigned*)((char*)shared + sizeof(Queue));
+
+  // Make the trainer allocate whatever state it keeps per parameter before
+  // forking. A zero scale leaves the parameters as they are.
+  if (trainer != nullptr) {
+    trainer->update(0.0);
+  }
+  pool = new WorkerPool(worker_count, [this](unsigned, const string& request) { return Work(request); });
+}
+
+HogwildTrainer::~HogwildTrainer() {
+  delete pool;
+  queue->~Queue();
+  munmap(queue, shared_size);
+}
+
+// Requests are "learn epoch". Responses are "loss words sentences seconds".
+string HogwildTrainer::Work(const string& request) {
+  bool learn;
+  unsigned epoch;
+  istringstream in(request);
+  in >> learn >> epoch;
+  for (; trainer != nullptr && worker_epoch < epoch; ++worker_epoch) {
+    trainer->update_epoch();
+  }
+
+  const Bitext& corpus = queue->dev ? dev_bitext : train_bitext;
+  SufficientStats stats;
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  for (unsigned i = queue->next++; i < queue->count; i = queue->next++) {
+    stats += learner->LearnFromDatum(corpus[indices[i]], learn);
+    if (learn) {
+      trainer->update(1.0);
+    }
+  }
+  double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+  ostringstream out;
+  out.precision(9);
+  out << stats.loss << " " << stats.word_count << " " << stats.sentence_count << " " << seconds;
+  return out.str();
+}
+
+SufficientStats HogwildTrainer::Run(const vector<unsigned>& slice, bool dev, bool learn, unsigned epoch) {
+  assert (!learn || trainer != nullptr);
+  assert (slice.size() <= max(train_bitext.size(), dev_bitext.size()));
+  copy(slice.begin(), slice.end(), indices);
+  queue->count = slice.size();
+  queue->dev = dev;
+  queue->next = 0;
+
+  ostringstream request;
+  request << learn << " " << epoch;
+  for (unsigned i = 0; i < pool->size(); ++i) {
+    pool->Submit(i, request.str());
+  }
+
+  SufficientStats total;
+  throughput.assign(pool->size(), make_pair(0, 0.0));
+  while (pool->pending() > 0) {
+    unsigned id;
+    string response;
+    pool->Receive(id, response);
+    SufficientStats stats;
+    double seconds;
+    istringstream in(response);
+    in >> stats.loss >> stats.word_count >> stats.sentence_count >> seconds;
+    total += stats;
+    throughput[id] = make_pair(stats.word_count, seconds);
+  }
+  assert (total.sentence_count == slice.size());
+  return total;
+}
+
+void HogwildTrainer::ReportThroughput(ostream& out) const {
+  double total = 0.0;
+  out << "Words/sec per worker:";
+  for (auto& worker : throughput) {
+    double rate = (worker.second > 0.0) ? worker.first / worker.second : 0.0;
+    total += rate;
+    out << " " << (unsigned)rate;
+  }
+  out << " (total " << (unsigned)total << ")" << endl;
+}
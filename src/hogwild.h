@@ -0,0 +1,56 @@
+#pragma once
+#include <atomic>
+#include <iostream>
+#include <vector>
+#include "dynet/training.h"
+#include "train_wrapper.h"
+#include "worker_pool.h"
+
+using namespace std;
+using namespace dynet;
+
+// Trains on slices of a corpus with a pool of persistent worker processes.
+// DyNet only allows one ComputationGraph per process, so the workers have to
+// be forked processes rather than threads. train initializes DyNet with shared
+// parameters, so the parameters and their gradients live in shared memory,
+// and each worker applies its own updates to them without locking (Hogwild).
+// Unlike dynet::mp, the workers are forked once and reused for every slice,
+// and instead of being handed fixed shares of the slice they keep taking the
+// next sentence pair off a shared atomic counter until the slice runs out.
+class HogwildTrainer {
+public:
+  // trainer may be null if the pool will only be used to compute losses
+  HogwildTrainer(unsigned worker_count, Learner* learner, Trainer* trainer, const Bitext& train_bitext, const Bitext& dev_bitext);
+  ~HogwildTrainer();
+
+  // Runs the given pairs of the training or dev set through the workers.
+  // If learn is set, the workers update the model after every pair. The
+  // workers' trainers are brought up to the given epoch first, so that
+  // learning rate decay matches the parent's.
+  SufficientStats Run(const vector<unsigned>& indices, bool dev, bool learn, unsigned epoch);
+
+  // The number of target words per second of each worker during the last Run,
+  // counting only the time it was busy
+  void ReportThroughput(ostream& out) const;
+
+private:
+  // Lives in memory shared by the parent and all the workers
+  struct Queue {
+    atomic<unsigned> next;
+    unsigned count;
+    bool dev;
+  };
+
+  string Work(const string& request);
+
+  Learner* learner;
+  Trainer* trainer;
+  const Bitext& train_bitext;
+  const Bitext& dev_bitext;
+  Queue* queue;
+  unsigned* indices;
+  size_t shared_size;
+  unsigned worker_epoch;
+  WorkerPool* pool;
+  vector<pair<unsigned, double>> throughput;
+};
@@ -0,0 +1,59 @@
+#include <cassert>
+#include "hypothesis_arena.h"
+
+HypothesisArena::HypothesisArena() {
+  nodes.push_back({0, Word(), 0.0, 0, 0});
+  coverages.push_back(vector<float>());
+}
+
+HypothesisArena::Handle HypothesisArena::root() const {
+  return 0;
+}
+
+HypothesisArena::Handle HypothesisArena::Extend(Handle parent, const Word& word, double log_prob, unsigned coverage_id) {
+  assert (parent < nodes.size());
+  assert (coverage_id < coverages.size());
+  nodes.push_back({parent, word, log_prob, nodes[parent].length + 1, coverage_id});
+  return nodes.size() - 1;
+}
+
+unsigned HypothesisArena::AddCoverage(const vector<float>& coverage) {
+  coverages.push_back(coverage);
+  return coverages.size() - 1;
+}
+
+HypothesisArena::Handle HypothesisArena::parent(Handle h) const {
+  return nodes[h].parent;
+}
+
+const Word& HypothesisArena::word(Handle h) const {
+  return nodes[h].word;
+}
+
+double HypothesisArena::log_prob(Handle h) const {
+  return nodes[h].log_prob;
+}
+
+unsigned HypothesisArena::length(Handle h) const {
+  return nodes[h].length;
+}
+
+unsigned HypothesisArena::coverage_id(Handle h) const {
+  return nodes[h].coverage_id;
+}
+
+const vector<float>& HypothesisArena::coverage(Handle h) const {
+  return coverages[nodes[h].coverage_id];
+}
+
+void HypothesisArena::set_log_prob(Handle h, double log_prob) {
+  nodes[h].log_prob = log_prob;
+}
+
+shared_ptr<OutputSentence> HypothesisArena::Sentence(Handle h) const {
+  shared_ptr<OutputSentence> sentence = make_shared<OutputSentence>(nodes[h].length);
+  for (; h != root(); h = nodes[h].parent) {
+    (*sentence)[nodes[h].length - 1] = nodes[h].word;
+  }
+  return sentence;
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include <vector>
+#include <memory>
+#include "utils.h"
+
+using namespace std;
+
+// Stores beam search hypotheses as a tree of back pointers: each node holds
+// one word and a pointer to the hypothesis it extends. Extending a hypothesis
+// is O(1) and shares the whole prefix with its parent. Sentences are only
+// materialized at the end, for the hypotheses that make it into the k-best list.
+// Hypotheses are referred to by small integer handles, which are cheap to
+// keep in KBestLists.
+class HypothesisArena {
+public:
+  typedef unsigned Handle;
+
+  // Creates an arena containing only the empty hypothesis, root()
+  HypothesisArena();
+
+  Handle root() const;
+  Handle Extend(Handle parent, const Word& word, double log_prob, unsigned coverage_id = 0);
+
+  // Coverage vectors are shared by all the children of a hypothesis,
+  // so they are stored once and referred to by id. Id 0 is an empty vector.
+  unsigned AddCoverage(const vector<float>& coverage);
+
+  Handle parent(Handle h) const;
+  const Word& word(Handle h) const;
+  double log_prob(Handle h) const;
+  unsigned length(Handle h) const;
+  unsigned coverage_id(Handle h) const;
+  const vector<float>& coverage(Handle h) const;
+
+  // Used when recombining hypotheses, to give the survivor the merged probability
+  void set_log_prob(Handle h, double log_prob);
+
+  shared_ptr<OutputSentence> Sentence(Handle h) const;
+
+private:
+  struct Node {
+    Handle parent;
+    Word word;
+    double log_prob;
+    unsigned length;
+    unsigned coverage_id;
+  };
+
+  vector<Node> nodes;
+  vector<vector<float>> coverages;
+};
@@ -1,5 +1,8 @@
 #include <fstream>
 #include "io.h"
+#include "mapped_model.h"
+#include "corpus.h"
+#include "parallel_reader.h"
 BOOST_CLASS_EXPORT_IMPLEMENT(StandardInputReader)
 BOOST_CLASS_EXPORT_IMPLEMENT(SyntaxInputReader)
 BOOST_CLASS_EXPORT_IMPLEMENT(MorphologyInputReader)
@@ -8,70 +11,105 @@ BOOST_CLASS_EXPORT_IMPLEMENT(MorphologyOutputReader)
 BOOST_CLASS_EXPORT_IMPLEMENT(RnngOutputReader)
 BOOST_CLASS_EXPORT_IMPLEMENT(DependencyOutputReader)
 
-LinearSentence* ReadStandardSentence(const string& line, Dict& dict, bool add_bos_eos) {
-  vector<string> words = tokenize(strip(line), " ");
-  LinearSentence* r = new LinearSentence();
+void ReadStandardWords(const string& line, Dict& dict, bool add_bos_eos, OutputSentence& out) {
+  static thread_local vector<boost::string_ref> words;
+  tokenize_ref(strip_ref(line), ' ', words);
+  out.reserve(out.size() + words.size() + (add_bos_eos ? 2 : 0));
   if (add_bos_eos) {
-    r->push_back(make_shared<StandardWord>(dict.convert("<s>")));
+    out.push_back(Word(dict.convert("<s>")));
   }
-  for (const string& w : words) {
-    r->push_back(make_shared<StandardWord>(dict.convert(w)));
+  for (boost::string_ref w : words) {
+    out.push_back(Word(ConvertWord(dict, w)));
   }
   if (add_bos_eos) {
-    r->push_back(make_shared<StandardWord>(dict.convert("</s>")));
+    out.push_back(Word(dict.convert("</s>")));
   }
+}
+
+LinearSentence* ReadStandardSentence(const string& line, Dict& dict, bool add_bos_eos) {
+  LinearSentence* r = new LinearSentence();
+  ReadStandardWords(line, dict, add_bos_eos, *r);
   return r;
 }
 
-vector<LinearSentence*> ReadStandardSentences(const string& filename, Dict& dict, bool add_bos_eos) {
-  ifstream f(filename);
-  if (!f.is_open()) {
-    cerr << "Unable to open " << filename << " for reading." << endl;
-    assert (f.is_open());
+struct LinearPiece {
+  Dict vocab;
+  vector<LinearSentence*> sentences;
+};
+
+// Merges each piece's vocab into dict, rewrites its sentences with the merged
+// ids, and concatenates them
+vector<LinearSentence*> MergeLinearPieces(vector<LinearPiece>& pieces, Dict& dict) {
+  vector<vector<WordId>> ids(pieces.size());
+  for (unsigned i = 0; i < pieces.size(); ++i) {
+    ids[i] = MergeVocab(pieces[i].vocab, dict);
   }
 
+  ParallelFor(pieces.size(), [&](unsigned i) {
+    for (LinearSentence* sentence : pieces[i].sentences) {
+      for (Word& word : *sentence) {
+        word.id = ids[i][word.id];
+      }
+    }
+  });
+
   vector<LinearSentence*> sentences;
-  for (string line; getline(f, line);) {
-    LinearSentence* sentence = ReadStandardSentence(strip(line), dict, add_bos_eos);
-    sentences.push_back(sentence);
+  for (LinearPiece& piece : pieces) {
+    sentences.insert(sentences.end(), piece.sentences.begin(), piece.sentences.end());
   }
   return sentences;
 }
 
-shared_ptr<MorphoWord> ReadMorphoWord(const string& line, Dict& word_vocab, Dict& root_vocab, Dict& affix_vocab, Dict& char_vocab) {
-  shared_ptr<MorphoWord> word = make_shared<MorphoWord>();
-  vector<string> parts = tokenize(strip(line), "\t");
-  string& word_str = parts[0];
-  word->word = word_vocab.convert(word_str);
+vector<LinearSentence*> ReadStandardSentences(const string& filename, Dict& dict, bool add_bos_eos) {
+  vector<LinearPiece> pieces = ReadInParallel<LinearPiece>(filename, false, [&](FileRange& range, LinearPiece& piece) {
+    for (string line; range.getline(line);) {
+      LinearSentence* sentence = ReadStandardSentence(line, piece.vocab, add_bos_eos);
+      piece.sentences.push_back(sentence);
+    }
+  });
+  return MergeLinearPieces(pieces, dict);
+}
+
+MorphoWord ParseMorphoWord(const string& line, Dict& word_vocab, Dict& root_vocab, Dict& affix_vocab, Dict& char_vocab) {
+  MorphoWord word;
+  static thread_local vector<boost::string_ref> parts, morphemes, chars;
+  tokenize_ref(strip_ref(line), '\t', parts);
+  assert (parts.size() > 0);
+  boost::string_ref word_str = parts[0];
+  word.word = ConvertWord(word_vocab, word_str);
 
+  word.analyses.resize(parts.size() - 1);
   for (unsigned i = 1; i < parts.size(); ++i) {
-    vector<string> morphemes = tokenize(parts[i], "+");
+    tokenize_ref(parts[i], '+', morphemes);
     assert (morphemes.size() > 0);
-    Analysis analysis;
-    analysis.root = root_vocab.convert(morphemes[0]);
+    Analysis& analysis = word.analyses[i - 1];
+    analysis.root = ConvertWord(root_vocab, morphemes[0]);
+    analysis.affixes.reserve(morphemes.size() - 1);
     for (unsigned j = 1; j < morphemes.size(); ++j) {
-      analysis.affixes.push_back(affix_vocab.convert(morphemes[j]));
+      analysis.affixes.push_back(ConvertWord(affix_vocab, morphemes[j]));
     }
-    word->analyses.push_back(analysis);
   }
 
-  for (unsigned i = 0; i < word_str.length(); ) {
-    unsigned len = UTF8Len(parts[0][i]);
-    string c = parts[0].substr(i, len);
-    word->chars.push_back(char_vocab.convert(c));
-    i += len;
+  utf8_chars_ref(word_str, chars);
+  word.chars.reserve(chars.size());
+  for (boost::string_ref c : chars) {
+    word.chars.push_back(ConvertWord(char_vocab, c));
   }
   return word;
 }
 
-LinearSentence* ReadMorphologySentence(const vector<string>& lines, Dict& word_vocab, Dict& root_vocab, Dict& affix_vocab, Dict& char_vocab, bool add_bos_eos) {
-  LinearSentence* r = new LinearSentence();
+// MorphoWords are parsed on the reading threads, but only the main thread
+// moves them into the Word arena
+typedef vector<MorphoWord> MorphologySentence;
+
+MorphologySentence ParseMorphologySentence(const vector<string>& lines, Dict& word_vocab, Dict& root_vocab, Dict& affix_vocab, Dict& char_vocab, bool add_bos_eos) {
+  MorphologySentence r;
   if (add_bos_eos) {
     // TODO: Add <s>
   }
 
   for (const string& line : lines) {
-    r->push_back(ReadMorphoWord(line, word_vocab, root_vocab, affix_vocab, char_vocab));
+    r.push_back(ParseMorphoWord(line, word_vocab, root_vocab, affix_vocab, char_vocab));
   }
 
   if (add_bos_eos) {
@@ -80,31 +118,70 @@ LinearSentence* ReadMorphologySentence(const vector<string>& lines, Dict& word_v
   return r;
 }
 
+struct MorphologyPiece {
+  Dict word_vocab;
+  Dict root_vocab;
+  Dict affix_vocab;
+  Dict char_vocab;
+  vector<MorphologySentence> sentences;
+};
+
 vector<LinearSentence*> ReadMorphologySentences(const string& filename, Dict& word_vocab, Dict& root_vocab, Dict& affix_vocab, Dict& char_vocab, bool add_bos_eos) {
-  ifstream f(filename);
-  if (!f.is_open()) {
-    cerr << "Unable to open " << filename << " for reading." << endl;
-    assert (f.is_open());
-  }
+  vector<MorphologyPiece> pieces = ReadInParallel<MorphologyPiece>(filename, true, [&](FileRange& range, MorphologyPiece& piece) {
+    vector<string> current_sentence;
+    for (string line; range.getline(line);) {
+      string sline = strip(line);
+      if (sline.length() == 0) {
+        piece.sentences.push_back(ParseMorphologySentence(current_sentence, piece.word_vocab, piece.root_vocab, piece.affix_vocab, piece.char_vocab, add_bos_eos));
+        current_sentence.clear();
+      }
+      else {
+        current_sentence.push_back(sline);
+      }
+    }
 
-  vector<string> current_sentence;
-  vector<LinearSentence*> sentences;
-  for (string line; getline(f, line);) {
-    string sline = strip(line);
-    if (sline.length() == 0) {
-      LinearSentence* sentence = ReadMorphologySentence(current_sentence, word_vocab, root_vocab, affix_vocab, char_vocab, add_bos_eos);
-      sentences.push_back(sentence);
+    // Only the last piece can end without a blank line
+    if (current_sentence.size() > 0) {
+      piece.sentences.push_back(ParseMorphologySentence(current_sentence, piece.word_vocab, piece.root_vocab, piece.affix_vocab, piece.char_vocab, add_bos_eos));
       current_sentence.clear();
     }
-    else {
-      current_sentence.push_back(sline);
+  });
+
+  vector<vector<WordId>> word_ids(pieces.size()), root_ids(pieces.size()), affix_ids(pieces.size()), char_ids(pieces.size());
+  for (unsigned i = 0; i < pieces.size(); ++i) {
+    word_ids[i] = MergeVocab(pieces[i].word_vocab, word_vocab);
+    root_ids[i] = MergeVocab(pieces[i].root_vocab, root_vocab);
+    affix_ids[i] = MergeVocab(pieces[i].affix_vocab, affix_vocab);
+    char_ids[i] = MergeVocab(pieces[i].char_vocab, char_vocab);
+  }
+
+  ParallelFor(pieces.size(), [&](unsigned i) {
+    for (MorphologySentence& sentence : pieces[i].sentences) {
+      for (MorphoWord& word : sentence) {
+        word.word = word_ids[i][word.word];
+        for (Analysis& analysis : word.analyses) {
+          analysis.root = root_ids[i][analysis.root];
+          for (WordId& affix : analysis.affixes) {
+            affix = affix_ids[i][affix];
+          }
+        }
+        for (WordId& c : word.chars) {
+          c = char_ids[i][c];
+        }
+      }
     }
-  }
+  });
 
-  if (current_sentence.size() > 0) {
-    LinearSentence* sentence = ReadMorphologySentence(current_sentence, word_vocab, root_vocab, affix_vocab, char_vocab, add_bos_eos);
-    sentences.push_back(sentence);
-    current_sentence.clear();
+  vector<LinearSentence*> sentences;
+  for (MorphologyPiece& piece : pieces) {
+    for (MorphologySentence& morpho_sentence : piece.sentences) {
+      LinearSentence* sentence = new LinearSentence();
+      sentence->reserve(morpho_sentence.size());
+      for (MorphoWord& word : morpho_sentence) {
+        sentence->push_back(Word::FromMorphoWord(move(word)));
+      }
+      sentences.push_back(sentence);
+    }
   }
   return sentences;
 }
@@ -143,10 +220,10 @@ LinearSentence* GetDependencyOracle(const vector<tuple<string, unsigned>>& arcs,
       open_nodes.pop();
       if (parent != (unsigned)-1 && (children[parent].size() == 0 || children[parent].back() < parent)) {
         //cout << "Done with left (" << parent << ")" << endl;
-        out->push_back(make_shared<StandardWord>(vocab.convert("</LEFT>")));
+        out->push_back(Word(vocab.convert("</LEFT>")));
       }
       //cout << "Done with right (" << parent << ")" << endl;
-      out->push_back(make_shared<StandardWord>(vocab.convert("</RIGHT>")));
+      out->push_back(Word(vocab.convert("</RIGHT>")));
     }
     else {
       unsigned child = children[parent][child_index];
@@ -154,15 +231,15 @@ LinearSentence* GetDependencyOracle(const vector<tuple<string, unsigned>>& arcs,
       child_indices.push(child_index + 1);
       if (child < parent && parent != -1) {
         //cout << "LEFT(" << child_word << ")" << endl;
-        out->push_back(make_shared<StandardWord>(vocab.convert(child_word)));
+        out->push_back(Word(vocab.convert(child_word)));
       }
       else {
         if (parent != -1 && (prev_child == -1 || prev_child < parent)) {
           //cout << "Done with left (" << parent << ")" << endl;
-          out->push_back(make_shared<StandardWord>(vocab.convert("</LEFT>")));
+          out->push_back(Word(vocab.convert("</LEFT>")));
         }
         //cout << "RIGHT(" << child_word << ")" << endl;
-        out->push_back(make_shared<StandardWord>(vocab.convert(child_word)));
+        out->push_back(Word(vocab.convert(child_word)));
       }
 
       open_nodes.push(child);
@@ -173,32 +250,28 @@ LinearSentence* GetDependencyOracle(const vector<tuple<string, unsigned>>& arcs,
 }
 
 vector<LinearSentence*> ReadDependencyTrees(const string& filename, Dict& vocab) {
-  ifstream f(filename);
-  if (!f.is_open()) {
-    cerr << "Unable to open " << filename << " for reading." << endl;
-    assert (f.is_open());
-  }
-
-  vector<LinearSentence*> sentences;
-  vector<tuple<string, unsigned>> arcs;
-  for (string line; getline(f, line);) {
-    line = strip(line);
-    if (line.length() == 0) {
-      sentences.push_back(GetDependencyOracle(arcs, vocab));
-      arcs.clear();
-    }
-    else {
-      vector<string> parts = tokenize(line, "\t");
-      assert (parts.size() == 8);
-      // ID FORM LEMMA UPOSTAG XPOSTAG FEATS HEAD DEPREL (DEPS) (MISC)
-      unsigned id = stoi(parts[0]);
-      string word = parts[1];
-      unsigned head = stoi(parts[6]);
-      assert (arcs.size() == id - 1);
-      arcs.push_back(make_tuple(word, head - 1));
+  vector<LinearPiece> pieces = ReadInParallel<LinearPiece>(filename, true, [&](FileRange& range, LinearPiece& piece) {
+    vector<tuple<string, unsigned>> arcs;
+    vector<boost::string_ref> parts;
+    for (string raw_line; range.getline(raw_line);) {
+      boost::string_ref line = strip_ref(raw_line);
+      if (line.length() == 0) {
+        piece.sentences.push_back(GetDependencyOracle(arcs, piece.vocab));
+        arcs.clear();
+      }
+      else {
+        tokenize_ref(line, '\t', parts);
+        assert (parts.size() == 8);
+        // ID FORM LEMMA UPOSTAG XPOSTAG FEATS HEAD DEPREL (DEPS) (MISC)
+        unsigned id = ParseUnsigned(parts[0]);
+        string word = parts[1].to_string();
+        unsigned head = ParseUnsigned(parts[6]);
+        assert (arcs.size() == id - 1);
+        arcs.push_back(make_tuple(word, head - 1));
+      }
     }
-  }
-  return sentences;
+  });
+  return MergeLinearPieces(pieces, vocab);
 }
 
 StandardInputReader::StandardInputReader() {}
@@ -206,10 +279,14 @@ StandardInputReader::StandardInputReader() {}
 StandardInputReader::StandardInputReader(bool add_bos_eos) : add_bos_eos(add_bos_eos) {}
 
 vector<InputSentence*> StandardInputReader::Read(const string& filename) {
-  vector<LinearSentence*> corpus = ReadStandardSentences(filename, vocab, add_bos_eos);
+  vector<LinearSentence*> corpus = IsCompiledCorpus(filename) ? ReadCompiledSentences(filename, vocab, add_bos_eos) : ReadStandardSentences(filename, vocab, add_bos_eos);
   return vector<InputSentence*>(corpus.begin(), corpus.end());
 }
 
+InputSentence* StandardInputReader::ReadSentence(const string& line) {
+  return ReadStandardSentence(line, vocab, add_bos_eos);
+}
+
 void StandardInputReader::Freeze() {
   if (!vocab.is_frozen()) {
     vocab.freeze();
@@ -217,23 +294,46 @@ void StandardInputReader::Freeze() {
   }
 }
 
+struct SyntaxPiece {
+  Dict terminal_vocab;
+  Dict nonterminal_vocab;
+  vector<SyntaxTree*> trees;
+};
+
 vector<InputSentence*> SyntaxInputReader::Read(const string& filename) {
-  ifstream f(filename);
-  if (!f.is_open()) {
-    cerr << "Unable to open " << filename << " for reading." << endl;
-    assert (f.is_open());
+  vector<SyntaxPiece> pieces = ReadInParallel<SyntaxPiece>(filename, false, [&](FileRange& range, SyntaxPiece& piece) {
+    for (string line; range.getline(line);) {
+      SyntaxTree* tree = new SyntaxTree(strip_ref(line), &piece.terminal_vocab, &piece.nonterminal_vocab);
+      tree->AssignNodeIds();
+      piece.trees.push_back(tree);
+    }
+  });
+
+  vector<vector<WordId>> terminal_ids(pieces.size()), nonterminal_ids(pieces.size());
+  for (unsigned i = 0; i < pieces.size(); ++i) {
+    terminal_ids[i] = MergeVocab(pieces[i].terminal_vocab, terminal_vocab);
+    nonterminal_ids[i] = MergeVocab(pieces[i].nonterminal_vocab, nonterminal_vocab);
   }
 
+  ParallelFor(pieces.size(), [&](unsigned i) {
+    for (SyntaxTree* tree : pieces[i].trees) {
+      tree->Remap(terminal_ids[i], nonterminal_ids[i], &terminal_vocab, &nonterminal_vocab);
+    }
+  });
+
   vector<InputSentence*> sentences;
-  for (string line; getline(f, line);) {
-    SyntaxTree* sentence = new SyntaxTree(strip(line), &terminal_vocab, &nonterminal_vocab);
-    sentence->AssignNodeIds();
-    sentences.push_back(sentence);
+  for (SyntaxPiece& piece : pieces) {
+    sentences.insert(sentences.end(), piece.trees.begin(), piece.trees.end());
   }
-
   return sentences;
 }
 
+InputSentence* SyntaxInputReader::ReadSentence(const string& line) {
+  SyntaxTree* sentence = new SyntaxTree(strip_ref(line), &terminal_vocab, &nonterminal_vocab);
+  sentence->AssignNodeIds();
+  return sentence;
+}
+
 void SyntaxInputReader::Freeze() {
   if (!terminal_vocab.is_frozen()) {
     terminal_vocab.freeze();
@@ -250,6 +350,13 @@ vector<InputSentence*> MorphologyInputReader::Read(const string& filename) {
   return vector<InputSentence*>(corpus.begin(), corpus.end());
 }
 
+InputSentence* MorphologyInputReader::ReadSentence(const string& line) {
+  // Morphologically analyzed sentences span several lines, one per word
+  cerr << "Morphologically analyzed input can't be read one line at a time" << endl;
+  assert (false);
+  return nullptr;
+}
+
 void MorphologyInputReader::Freeze() {
   if (!word_vocab.is_frozen()) {
     word_vocab.freeze();
@@ -263,6 +370,12 @@ void MorphologyInputReader::Freeze() {
   }
 }
 
+OutputSentence* OutputReader::ReadSentence(const string& line) {
+  cerr << "This output format can't be read one line at a time" << endl;
+  assert (false);
+  return nullptr;
+}
+
 StandardOutputReader::StandardOutputReader() {}
 StandardOutputReader::StandardOutputReader(const string& vocab_file, bool add_bos_eos) : add_bos_eos(add_bos_eos) {
   vocab.convert("UNK");
@@ -276,10 +389,16 @@ StandardOutputReader::StandardOutputReader(const string& vocab_file, bool add_bo
 }
 
 vector<OutputSentence*> StandardOutputReader::Read(const string& filename) {
-  vector<LinearSentence*> corpus = ReadStandardSentences(filename, vocab, add_bos_eos);
+  vector<LinearSentence*> corpus = IsCompiledCorpus(filename) ? ReadCompiledSentences(filename, vocab, add_bos_eos) : ReadStandardSentences(filename, vocab, add_bos_eos);
   return vector<OutputSentence*>(corpus.begin(), corpus.end());
 }
 
+OutputSentence* StandardOutputReader::ReadSentence(const string& line) {
+  OutputSentence* r = new OutputSentence();
+  ReadStandardWords(line, vocab, add_bos_eos, *r);
+  return r;
+}
+
 void StandardOutputReader::Freeze() {
   if (!vocab.is_frozen()) {
     vocab.freeze();
@@ -347,18 +466,16 @@ void RnngOutputReader::Freeze() {
   }
 }
 
-string StandardOutputReader::ToString(const shared_ptr<const Word> word) {
-  const shared_ptr<const StandardWord> w = dynamic_pointer_cast<const StandardWord>(word);
-  return vocab.convert(w->id);
+string StandardOutputReader::ToString(const Word& word) {
+  return vocab.convert(word.id);
 }
 
-string MorphologyOutputReader::ToString(const shared_ptr<const Word> word) {
+string MorphologyOutputReader::ToString(const Word& word) {
   assert (false);
 }
 
-string RnngOutputReader::ToString(const shared_ptr<const Word> word) {
-  const shared_ptr<const StandardWord> w = dynamic_pointer_cast<const StandardWord>(word);
-  return vocab.convert(w->id);
+string RnngOutputReader::ToString(const Word& word) {
+  return vocab.convert(word.id);
 }
 
 DependencyOutputReader::DependencyOutputReader() {}
@@ -381,9 +498,8 @@ vector<OutputSentence*> DependencyOutputReader::Read(const string& filename) {
   return vector<OutputSentence*>(corpus.begin(), corpus.end());
 }
 
-string DependencyOutputReader::ToString(const shared_ptr<const Word> word) {
-  const shared_ptr<const StandardWord> w = dynamic_pointer_cast<const StandardWord>(word);
-  return vocab.convert(w->id);
+string DependencyOutputReader::ToString(const Word& word) {
+  return vocab.convert(word.id);
 }
 
 void DependencyOutputReader::Freeze() {
@@ -427,7 +543,11 @@ void Serialize(const InputReader* const input_reader, const OutputReader* const
   if (r != 0) {}
   fseek(stdout, 0, SEEK_SET);
 
-  boost::archive::binary_oarchive oa(cout);
+  Serialize(input_reader, output_reader, translator, dynet_model, trainer, cout);
+}
+
+void Serialize(const InputReader* const input_reader, const OutputReader* const output_reader, const Translator& translator, Model& dynet_model, const Trainer* const trainer, ostream& out) {
+  boost::archive::binary_oarchive oa(out);
   oa & dynet_model;
   oa & input_reader;
   oa & output_reader;
@@ -436,12 +556,21 @@ void Serialize(const InputReader* const input_reader, const OutputReader* const
 }
 
 void Deserialize(const string& filename, InputReader*& input_reader, OutputReader*& output_reader, Translator& translator, Model& dynet_model, Trainer*& trainer) {
+  if (IsMappedModel(filename)) {
+    DeserializeMapped(filename, input_reader, output_reader, translator, dynet_model, trainer);
+    return;
+  }
+
   ifstream f(filename);
-  boost::archive::binary_iarchive ia(f);
+  Deserialize(f, input_reader, output_reader, translator, dynet_model, trainer);
+  f.close();
+}
+
+void Deserialize(istream& in, InputReader*& input_reader, OutputReader*& output_reader, Translator& translator, Model& dynet_model, Trainer*& trainer) {
+  boost::archive::binary_iarchive ia(in);
   ia & dynet_model;
   ia & input_reader;
   ia & output_reader;
   ia & translator;
   ia & trainer;
-  f.close();
 }
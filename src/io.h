@@ -18,6 +18,8 @@ using namespace dynet;
 class InputReader {
 public:
   virtual vector<InputSentence*> Read(const string& filename) = 0;
+  // Reads a single sentence given as one line of input
+  virtual InputSentence* ReadSentence(const string& line) = 0;
   virtual void Freeze() = 0;
   friend class boost::serialization::access;
   template<class Archive>
@@ -27,7 +29,9 @@ public:
 class OutputReader {
 public:
   virtual vector<OutputSentence*> Read(const string& filename) = 0;
-  virtual string ToString(const shared_ptr<const Word> word) = 0;
+  // Reads a single sentence given as one line of input. Not all formats support this.
+  virtual OutputSentence* ReadSentence(const string& line);
+  virtual string ToString(const Word& word) = 0;
   virtual void Freeze() = 0;
   friend class boost::serialization::access;
   template<class Archive>
@@ -39,6 +43,7 @@ public:
   StandardInputReader();
   explicit StandardInputReader(bool add_bos_eos);
   vector<InputSentence*> Read(const string& filename);
+  InputSentence* ReadSentence(const string& line);
   void Freeze();
   Dict vocab;
 private:
@@ -57,6 +62,7 @@ BOOST_CLASS_EXPORT_KEY(StandardInputReader)
 class SyntaxInputReader : public InputReader {
 public:
   vector<InputSentence*> Read(const string& filename);
+  InputSentence* ReadSentence(const string& line);
   void Freeze();
   Dict terminal_vocab;
   Dict nonterminal_vocab;
@@ -74,6 +80,7 @@ BOOST_CLASS_EXPORT_KEY(SyntaxInputReader)
 class MorphologyInputReader : public InputReader {
 public:
   vector<InputSentence*> Read(const string& filename);
+  InputSentence* ReadSentence(const string& line);
   void Freeze();
   Dict word_vocab;
   Dict root_vocab;
@@ -97,7 +104,8 @@ public:
   StandardOutputReader();
   explicit StandardOutputReader(const string& vocab_file, bool add_bos_eos);
   vector<OutputSentence*> Read(const string& filename);
-  string ToString(const shared_ptr<const Word> word);
+  OutputSentence* ReadSentence(const string& line);
+  string ToString(const Word& word);
   void Freeze();
   Dict vocab;
 private:
@@ -118,7 +126,7 @@ public:
   MorphologyOutputReader();
   MorphologyOutputReader(const string& vocab_file, const string& morph_vocab_file);
   vector<OutputSentence*> Read(const string& filename);
-  string ToString(const shared_ptr<const Word> word);
+  string ToString(const Word& word);
   void Freeze();
 
   Dict word_vocab;
@@ -143,7 +151,7 @@ public:
   RnngOutputReader();
   explicit RnngOutputReader(const string& vocab_file);
   vector<OutputSentence*> Read(const string& filename);
-  string ToString(const shared_ptr<const Word> word);
+  string ToString(const Word& word);
   void Freeze();
 
   Dict vocab;
@@ -162,7 +170,7 @@ public:
   DependencyOutputReader();
   explicit DependencyOutputReader(const string& vocab_file);
   vector<OutputSentence*> Read(const string& filename);
-  string ToString(const shared_ptr<const Word> word);
+  string ToString(const Word& word);
   void Freeze();
 
   Dict vocab;
@@ -180,5 +188,9 @@ void ReadDict(const string& filename, Dict& dict);
 void ReadDictRnng(const string& filename, Dict& dict);
 Bitext ReadBitext(const string& source_filename, const string& target_filename, InputReader* SourceReader, OutputReader* TargetReader);
 
+// Overwrites stdout with the model
 void Serialize(const InputReader* const input_reader, const OutputReader* const output_reader, const Translator& translator, Model& dynet_model, const Trainer* const trainer);
+void Serialize(const InputReader* const input_reader, const OutputReader* const output_reader, const Translator& translator, Model& dynet_model, const Trainer* const trainer, ostream& out);
+// Reads either the boost archive written by Serialize or a mapped model
 void Deserialize(const string& filename, InputReader*& input_reader, OutputReader*& output_reader, Translator& translator, Model& dynet_model, Trainer*& trainer);
+void Deserialize(istream& in, InputReader*& input_reader, OutputReader*& output_reader, Translator& translator, Model& dynet_model, Trainer*& trainer);
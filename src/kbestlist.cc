@@ -4,7 +4,7 @@
 #include "io.h"
 using namespace std;
 
-void OutputKBestList(unsigned sentence_number, KBestList<shared_ptr<OutputSentence>> kbest, OutputReader* output_reader) {
+void OutputKBestList(unsigned sentence_number, KBestList<shared_ptr<OutputSentence>> kbest, OutputReader* output_reader, ostream& out) {
   for (auto& scored_hyp : kbest.hypothesis_list()) {
     double score = scored_hyp.first;
     const shared_ptr<OutputSentence> hyp = scored_hyp.second;
@@ -13,7 +13,7 @@ void OutputKBestList(unsigned sentence_number, KBestList<shared_ptr<OutputSenten
       words[i] = output_reader->ToString(hyp->at(i));
     }
     string translation = boost::algorithm::join(words, " ");
-    cout << sentence_number << " ||| " << translation << " ||| " << score << endl;
+    out << sentence_number << " ||| " << translation << " ||| " << score << endl;
   }
-  cout.flush();
+  out.flush();
 }
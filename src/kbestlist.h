@@ -1,5 +1,6 @@
 #pragma once
 #include <deque>
+#include <iostream>
 #include <utility>
 #include <memory>
 #include "dynet/dict.h"
@@ -45,6 +46,18 @@ public:
     return true;
   }
 
+  // Adds a hypothesis that is known to be no better than anything already
+  // in the list, e.g. when copying over the output of TopK(). This is O(1),
+  // unlike add(). Returns false if the list is already full.
+  bool append(double score, T hyp) {
+    assert (size() == 0 || score <= hypotheses.back().first);
+    if (size() >= max_size) {
+      return false;
+    }
+    hypotheses.push_back(make_pair(score, hyp));
+    return true;
+  }
+
   double worst_score() const {
     assert (hypotheses.size() > 0);
     return hypotheses.back().first;
@@ -63,4 +76,4 @@ private:
 };
 
 class OutputReader;
-void OutputKBestList(unsigned sentence_number, KBestList<shared_ptr<OutputSentence>> kbest, OutputReader* output_reader);
+void OutputKBestList(unsigned sentence_number, KBestList<shared_ptr<OutputSentence>> kbest, OutputReader* output_reader, ostream& out = cout);
@@ -3,9 +3,12 @@
 
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <iomanip>
 
 #include "io.h"
 #include "utils.h"
+#include "worker_pool.h"
 
 using namespace dynet;
 using namespace std;
@@ -20,6 +23,7 @@ int main(int argc, char** argv) {
   ("input_source", po::value<string>()->required(), "input file source")
   ("input_target", po::value<string>()->required(), "input file target")
   ("perp", "Show per-sentence perplexity instead of negative log prob")
+  ("threads,j", po::value<unsigned>()->default_value(1), "Number of sentences to score in parallel. Each runs in its own forked process")
   ("help", "Display this help message");
 
   po::positional_options_description positional_options;
@@ -39,6 +43,7 @@ int main(int argc, char** argv) {
 
   const string model_filename = vm["model"].as<string>();
   const bool show_perp = vm.count("perp") > 0;
+  const unsigned threads = vm["threads"].as<unsigned>();
 
   InputReader* input_reader = nullptr;
   OutputReader* output_reader = nullptr;
@@ -53,14 +58,19 @@ int main(int argc, char** argv) {
   vector<InputSentence*> source_sentences = input_reader->Read(vm["input_source"].as<string>());
   vector<OutputSentence*> target_sentences = output_reader->Read(vm["input_target"].as<string>());
   assert (source_sentences.size() == target_sentences.size());
-  for (unsigned sentence_number = 0; sentence_number < source_sentences.size(); ++sentence_number) {
+  // Workers send back the loss itself; the totals are kept here
+  auto score = [&](unsigned sentence_number, const string&) {
     InputSentence* source = source_sentences[sentence_number];
     OutputSentence* target = target_sentences[sentence_number];
-
     ComputationGraph cg;
     Expression loss_expr = translator.BuildGraph(source, target, cg);
-    dynet::real loss = as_scalar(loss_expr.value());
-    unsigned words = target->size();
+    ostringstream out;
+    out << setprecision(9) << as_scalar(loss_expr.value());
+    return out.str();
+  };
+  auto emit = [&](unsigned sentence_number, const string& response) {
+    dynet::real loss = stof(response);
+    unsigned words = target_sentences[sentence_number]->size();
     if (show_perp) {
       cout << sentence_number << " ||| " << exp(loss / words) << endl;
     }
@@ -71,7 +81,8 @@ int main(int argc, char** argv) {
 
     total_loss += loss;
     total_words += words;
-  }
+  };
+  RunOrdered(source_sentences.size(), threads, score, emit);
 
   if (show_perp) {
     cout << "Total ||| " << exp(total_loss / total_words) << " (" << total_loss << " over " << total_words << " words)" << endl;
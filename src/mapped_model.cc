@@ -0,0 +1,281 @@
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <cstring>
+#include <cstdint>
+#include <cassert>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "mapped_model.h"
+
+namespace {
+struct MappedModelHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t tensor_count;
+  uint64_t metadata_offset;
+  uint64_t metadata_size;
+  uint64_t table_offset;
+  uint64_t file_size;
+};
+
+enum MappedTensorKind { kParameter = 0, kLookupParameter = 1 };
+
+struct MappedTensor {
+  uint32_t kind;
+  uint32_t index;
+  // Shape of the whole tensor
+  uint32_t nd;
+  uint32_t d[7];
+  // For lookup parameters, the shape of a single entry
+  uint32_t row_nd;
+  uint32_t row_d[7];
+  // offset is in bytes from the start of the file, size is in floats
+  uint64_t offset;
+  uint64_t size;
+};
+
+uint64_t Align(uint64_t offset) {
+  return (offset + kMappedModelAlignment - 1) / kMappedModelAlignment * kMappedModelAlignment;
+}
+
+void StoreDim(const Dim& dim, uint32_t& nd, uint32_t* d) {
+  assert (dim.batch_elems() == 1);
+  nd = dim.nd;
+  for (unsigned i = 0; i < 7; ++i) {
+    d[i] = (i < dim.nd) ? dim.d[i] : 0;
+  }
+}
+
+Dim LoadDim(uint32_t nd, const uint32_t* d) {
+  Dim dim;
+  dim.nd = nd;
+  dim.bd = 1;
+  for (unsigned i = 0; i < 7; ++i) {
+    dim.d[i] = (i < nd) ? d[i] : 1;
+  }
+  return dim;
+}
+
+// Temporarily gives every parameter an empty shape, so that serializing the
+// model records its structure but none of its values
+class ParameterHider {
+public:
+  explicit ParameterHider(Model& dynet_model) : dynet_model(dynet_model) {
+    const Dim empty({0});
+    for (ParameterStorage* p : dynet_model.parameters_list()) {
+      dims.push_back(p->dim);
+      p->dim = empty;
+      p->values.d = empty;
+      p->g.d = empty;
+    }
+    for (LookupParameterStorage* p : dynet_model.lookup_parameters_list()) {
+      lookup_dims.push_back(make_pair(p->all_dim, p->dim));
+      lookup_values.push_back(vector<Tensor>());
+      lookup_grads.push_back(vector<Tensor>());
+      swap(p->values, lookup_values.back());
+      swap(p->grads, lookup_grads.back());
+      p->all_dim = empty;
+      p->dim = empty;
+      p->all_values.d = empty;
+      p->all_grads.d = empty;
+    }
+  }
+
+  ~ParameterHider() {
+    const vector<ParameterStorage*>& params = dynet_model.parameters_list();
+    for (unsigned i = 0; i < params.size(); ++i) {
+      params[i]->dim = params[i]->values.d = params[i]->g.d = dims[i];
+    }
+    const vector<LookupParameterStorage*>& lookup_params = dynet_model.lookup_parameters_list();
+    for (unsigned i = 0; i < lookup_params.size(); ++i) {
+      LookupParameterStorage* p = lookup_params[i];
+      p->all_dim = p->all_values.d = p->all_grads.d = lookup_dims[i].first;
+      p->dim = lookup_dims[i].second;
+      swap(p->values, lookup_values[i]);
+      swap(p->grads, lookup_grads[i]);
+    }
+  }
+
+private:
+  Model& dynet_model;
+  vector<Dim> dims;
+  vector<pair<Dim, Dim>> lookup_dims;
+  vector<vector<Tensor>> lookup_values;
+  vector<vector<Tensor>> lookup_grads;
+};
+}
+
+bool IsMappedModel(const string& filename) {
+  ifstream f(filename, ios::binary);
+  char magic[sizeof(kMappedModelMagic)];
+  if (!f.read(magic, sizeof(magic))) {
+    return false;
+  }
+  return memcmp(magic, kMappedModelMagic, sizeof(magic)) == 0;
+}
+
+void SerializeMapped(const string& filename, const InputReader* const input_reader, const OutputReader* const output_reader, const Translator& translator, Model& dynet_model, const Trainer* const trainer) {
+  vector<MappedTensor> table;
+  vector<const float*> sources;
+  const vector<ParameterStorage*>& params = dynet_model.parameters_list();
+  for (unsigned i = 0; i < params.size(); ++i) {
+    MappedTensor entry = {};
+    entry.kind = kParameter;
+    entry.index = i;
+    StoreDim(params[i]->dim, entry.nd, entry.d);
+    entry.size = params[i]->dim.size();
+    table.push_back(entry);
+    sources.push_back(params[i]->values.v);
+  }
+  const vector<LookupParameterStorage*>& lookup_params = dynet_model.lookup_parameters_list();
+  for (unsigned i = 0; i < lookup_params.size(); ++i) {
+    MappedTensor entry = {};
+    entry.kind = kLookupParameter;
+    entry.index = i;
+    StoreDim(lookup_params[i]->all_dim, entry.nd, entry.d);
+    StoreDim(lookup_params[i]->dim, entry.row_nd, entry.row_d);
+    entry.size = lookup_params[i]->all_dim.size();
+    table.push_back(entry);
+    sources.push_back(lookup_params[i]->all_values.v);
+  }
+
+  ostringstream metadata;
+  {
+    ParameterHider hider(dynet_model);
+    Serialize(input_reader, output_reader, translator, dynet_model, trainer, metadata);
+  }
+  const string metadata_bytes = metadata.str();
+
+  MappedModelHeader header = {};
+  memcpy(header.magic, kMappedModelMagic, sizeof(header.magic));
+  header.version = kMappedModelVersion;
+  header.tensor_count = table.size();
+  header.metadata_offset = sizeof(header);
+  header.metadata_size = metadata_bytes.size();
+  header.table_offset = Align(header.metadata_offset + header.metadata_size);
+  uint64_t offset = Align(header.table_offset + table.size() * sizeof(MappedTensor));
+  for (MappedTensor& entry : table) {
+    entry.offset = offset;
+    offset = Align(offset + entry.size * sizeof(float));
+  }
+  header.file_size = offset;
+
+  ofstream f(filename, ios::binary);
+  if (!f.is_open()) {
+    cerr << "Unable to open " << filename << " for writing." << endl;
+    assert (f.is_open());
+  }
+  const char padding[kMappedModelAlignment] = {};
+  auto pad_to = [&](uint64_t position) {
+    assert ((uint64_t)f.tellp() <= position);
+    f.write(padding, position - f.tellp());
+  };
+  f.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  f.write(metadata_bytes.data(), metadata_bytes.size());
+  pad_to(header.table_offset);
+  f.write(reinterpret_cast<const char*>(table.data()), table.size() * sizeof(MappedTensor));
+  for (unsigned i = 0; i < table.size(); ++i) {
+    pad_to(table[i].offset);
+    f.write(reinterpret_cast<const char*>(sources[i]), table[i].size * sizeof(float));
+  }
+  pad_to(header.file_size);
+  f.close();
+  if (!f) {
+    cerr << "Error writing " << filename << endl;
+    assert (false);
+  }
+}
+
+void DeserializeMapped(const string& filename, InputReader*& input_reader, OutputReader*& output_reader, Translator& translator, Model& dynet_model, Trainer*& trainer) {
+  int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0) {
+    cerr << "Unable to open " << filename << " for reading." << endl;
+    assert (fd >= 0);
+  }
+  struct stat st;
+  int r = fstat(fd, &st);
+  assert (r == 0);
+  assert ((size_t)st.st_size >= sizeof(MappedModelHeader));
+
+  // The mapping lives as long as the process does, just like the model
+  char* base = (char*)mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) {
+    cerr << "Unable to map " << filename << " into memory." << endl;
+    assert (base != MAP_FAILED);
+  }
+
+  const MappedModelHeader& header = *reinterpret_cast<const MappedModelHeader*>(base);
+  assert (memcmp(header.magic, kMappedModelMagic, sizeof(header.magic)) == 0);
+  if (header.version != kMappedModelVersion) {
+    cerr << filename << " is mapped model version " << header.version << ", but only version " << kMappedModelVersion << " is supported." << endl;
+    assert (header.version == kMappedModelVersion);
+  }
+  if (header.file_size != (uint64_t)st.st_size) {
+    cerr << filename << " should be " << header.file_size << " bytes long, but is " << st.st_size << ". Is it truncated?" << endl;
+    assert (header.file_size == (uint64_t)st.st_size);
+  }
+
+  {
+    istringstream metadata(string(base + header.metadata_offset, header.metadata_size));
+    Deserialize(metadata, input_reader, output_reader, translator, dynet_model, trainer);
+  }
+
+  const MappedTensor* table = reinterpret_cast<const MappedTensor*>(base + header.table_offset);
+  uint64_t total_size = 0;
+  for (unsigned i = 0; i < header.tensor_count; ++i) {
+    assert (table[i].offset + table[i].size * sizeof(float) <= header.file_size);
+    total_size += table[i].size;
+  }
+
+  float* grads = nullptr;
+  if (total_size > 0) {
+    grads = (float*)mmap(nullptr, total_size * sizeof(float), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    assert (grads != MAP_FAILED);
+  }
+
+  const vector<ParameterStorage*>& params = dynet_model.parameters_list();
+  const vector<LookupParameterStorage*>& lookup_params = dynet_model.lookup_parameters_list();
+  assert (header.tensor_count == params.size() + lookup_params.size());
+  for (unsigned i = 0; i < header.tensor_count; ++i) {
+    const MappedTensor& entry = table[i];
+    float* values = reinterpret_cast<float*>(base + entry.offset);
+    const Dim dim = LoadDim(entry.nd, entry.d);
+    assert (dim.size() == entry.size);
+    if (entry.kind == kParameter) {
+      assert (entry.index < params.size());
+      ParameterStorage* p = params[entry.index];
+      p->dim = p->values.d = p->g.d = dim;
+      p->values.v = values;
+      p->g.v = grads;
+    }
+    else {
+      assert (entry.kind == kLookupParameter);
+      assert (entry.index < lookup_params.size());
+      LookupParameterStorage* p = lookup_params[entry.index];
+      const Dim row_dim = LoadDim(entry.row_nd, entry.row_d);
+      const unsigned rows = dim[dim.nd - 1];
+      assert (rows * row_dim.size() == dim.size());
+      p->all_dim = p->all_values.d = p->all_grads.d = dim;
+      p->dim = row_dim;
+      p->all_values.v = values;
+      p->all_grads.v = grads;
+      p->values.clear();
+      p->grads.clear();
+      for (unsigned j = 0; j < rows; ++j) {
+        Tensor value = p->all_values;
+        value.d = row_dim;
+        value.v = values + j * row_dim.size();
+        p->values.push_back(value);
+        Tensor grad = p->all_grads;
+        grad.d = row_dim;
+        grad.v = grads + j * row_dim.size();
+        p->grads.push_back(grad);
+      }
+    }
+    grads += entry.size;
+  }
+}
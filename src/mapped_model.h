@@ -0,0 +1,29 @@
+#pragma once
+#include <string>
+#include "io.h"
+
+using namespace std;
+using namespace dynet;
+
+// An alternative on-disk model format that can be loaded with mmap instead of
+// being read and copied parameter by parameter. The file is a fixed header,
+// a boost archive of everything except the parameter values, a table with one
+// entry per parameter tensor, and then the raw tensors themselves, each aligned
+// to kMappedModelAlignment bytes.
+//
+// Loaded parameters point straight into a private mapping of the file, so
+// several processes using the same model share its pages in the page cache.
+// Any writes are copy-on-write and never reach the file. Mapped models are
+// for inference only: train refuses them, since forked training workers would
+// each update their own private copy of the weights.
+// Gradients are backed by anonymous memory that is only allocated if touched.
+
+const char kMappedModelMagic[8] = {'A', 'M', 'M', 'O', 'D', 'E', 'L', '\0'};
+const unsigned kMappedModelVersion = 1;
+const unsigned kMappedModelAlignment = 64;
+
+// Returns true if filename starts with the mapped model header
+bool IsMappedModel(const string& filename);
+
+void SerializeMapped(const string& filename, const InputReader* const input_reader, const OutputReader* const output_reader, const Translator& translator, Model& dynet_model, const Trainer* const trainer);
+void DeserializeMapped(const string& filename, InputReader*& input_reader, OutputReader*& output_reader, Translator& translator, Model& dynet_model, Trainer*& trainer);
@@ -1,4 +1,7 @@
 #include <boost/algorithm/string/predicate.hpp>
+#include <boost/functional/hash.hpp>
+#include <limits>
+#include <algorithm>
 #include "output.h"
 BOOST_CLASS_EXPORT_IMPLEMENT(SoftmaxOutputModel)
 BOOST_CLASS_EXPORT_IMPLEMENT(MlpSoftmaxOutputModel)
@@ -14,11 +17,15 @@ bool OutputModel::IsDone() const {
   return IsDone(GetStatePointer());
 }
 
+size_t OutputModel::StateSignature(RNNPointer p) const {
+  return 0;
+}
+
 Expression OutputModel::GetState() const {
   return GetState(GetStatePointer());
 }
 
-Expression OutputModel::AddInput(const shared_ptr<const Word> prev_word, const Expression& context) {
+Expression OutputModel::AddInput(const Word& prev_word, const Expression& context) {
   return AddInput(prev_word, context, GetStatePointer());
 }
 
@@ -26,26 +33,33 @@ Expression OutputModel::PredictLogDistribution(Expression context) {
   return PredictLogDistribution(GetStatePointer(), context);
 }
 
-KBestList<shared_ptr<Word>> OutputModel::PredictKBest(Expression context, unsigned K) {
+KBestList<Word> OutputModel::PredictKBest(Expression context, unsigned K) {
   return PredictKBest(GetStatePointer(), context, K);
 }
 
-pair<shared_ptr<Word>, float> OutputModel::Sample(Expression context) {
+pair<Word, float> OutputModel::Sample(Expression context) {
   return Sample(GetStatePointer(), context);
 }
 
-Expression OutputModel::Loss(Expression context, const shared_ptr<const Word> ref) {
+Expression OutputModel::Loss(Expression context, const Word& ref) {
   return Loss(GetStatePointer(), context, ref);
 }
 
-SoftmaxOutputModel::SoftmaxOutputModel() : fsb(nullptr) {}
+SoftmaxOutputModel::SoftmaxOutputModel() : fsb(nullptr), has_softmax_params(false), exact_shortlist(false) {}
 
-SoftmaxOutputModel::SoftmaxOutputModel(Model& model, unsigned embedding_dim, unsigned context_dim, unsigned state_dim, Dict* vocab, const string& clusters_filename) : state_dim(state_dim) {
+SoftmaxOutputModel::SoftmaxOutputModel(Model& model, unsigned embedding_dim, unsigned context_dim, unsigned state_dim, Dict* vocab, const string& clusters_filename) : state_dim(state_dim), has_softmax_params(false), exact_shortlist(false) {
   if (clusters_filename.length() > 0) {
     fsb = new ClassFactoredSoftmaxBuilder(state_dim + context_dim, clusters_filename, *vocab, model);
   }
   else {
+    // StandardSoftmaxBuilder doesn't expose its parameters, so note where
+    // it adds them to the model (W, then b) for use by shortlists
+    const unsigned first_param = model.parameters_list().size();
     fsb = new StandardSoftmaxBuilder(state_dim + context_dim, vocab->size(), model);
+    assert (model.parameters_list().size() == first_param + 2);
+    p_softmax_w = Parameter(&model, first_param);
+    p_softmax_b = Parameter(&model, first_param + 1);
+    has_softmax_params = true;
   }
   embeddings = model.add_lookup_parameters(vocab->size(), {embedding_dim});
   output_builder = LSTMBuilder(lstm_layer_count, embedding_dim + context_dim, state_dim, model);
@@ -62,6 +76,9 @@ void SoftmaxOutputModel::NewGraph(ComputationGraph& cg) {
   fsb->new_graph(cg);
   pcg = &cg;
   done.clear();
+  // Only added to the graph when a shortlist or batched loss needs them
+  softmax_w = Expression();
+  softmax_b = Expression();
 }
 
 void SoftmaxOutputModel::SetDropout(float rate) {
@@ -84,13 +101,12 @@ RNNPointer SoftmaxOutputModel::GetStatePointer() const {
   return output_builder.state();
 }
 
-Expression SoftmaxOutputModel::Embed(const shared_ptr<const StandardWord> word) {
-  return lookup(*pcg, embeddings, word->id);
+Expression SoftmaxOutputModel::Embed(const Word& word) {
+  return lookup(*pcg, embeddings, word.standard_id());
 }
 
-Expression SoftmaxOutputModel::AddInput(const shared_ptr<const Word> prev_word_, const Expression& context, const RNNPointer& p) {
-  const shared_ptr<const StandardWord> prev_word = dynamic_pointer_cast<const StandardWord>(prev_word_);
-  done.push_back(prev_word->id == kEOS);
+Expression SoftmaxOutputModel::AddInput(const Word& prev_word, const Expression& context, const RNNPointer& p) {
+  done.push_back(prev_word.standard_id() == kEOS);
   Expression prev_embedding = Embed(prev_word);
   Expression input = concatenate({prev_embedding, context});
   Expression state = output_builder.add_input(p, input);
@@ -103,15 +119,109 @@ Expression SoftmaxOutputModel::PredictLogDistribution(RNNPointer p, Expression c
   return fsb->full_log_distribution(concatenate({state, context}));
 }
 
-KBestList<shared_ptr<Word>> SoftmaxOutputModel::PredictKBest(RNNPointer p, Expression context, unsigned K) {
-  vector<float> dist = as_vector(PredictLogDistribution(p, context).value());
-  KBestList<shared_ptr<Word>> kbest(K);
-  for (unsigned i = 0; i < dist.size(); ++i) {
-    kbest.add(dist[i], make_shared<StandardWord>(i));
+KBestList<Word> SoftmaxOutputModel::PredictKBest(RNNPointer p, Expression context, unsigned K) {
+  Expression log_probs = shortlist.empty() ?
+      PredictLogDistribution(p, context) :
+      ShortlistLogDistribution(concatenate({GetState(p), context}));
+  vector<float> dist = as_vector(log_probs.value());
+  KBestList<Word> kbest(K);
+  for (auto& scored_word : TopK(dist, K)) {
+    kbest.append(scored_word.first, Word(CandidateWord(scored_word.second)));
   }
   return kbest;
 }
 
+bool SoftmaxOutputModel::SupportsShortlist() const {
+  return has_softmax_params;
+}
+
+void SoftmaxOutputModel::SetShortlist(const vector<unsigned>& candidates, bool exact) {
+  assert (SupportsShortlist());
+  shortlist = candidates;
+  shortlist.push_back(kEOS);
+  sort(shortlist.begin(), shortlist.end());
+  shortlist.erase(unique(shortlist.begin(), shortlist.end()), shortlist.end());
+  exact_shortlist = exact;
+}
+
+void SoftmaxOutputModel::ClearShortlist() {
+  shortlist.clear();
+  exact_shortlist = false;
+}
+
+WordId SoftmaxOutputModel::CandidateWord(unsigned index) const {
+  if (shortlist.empty()) {
+    return index;
+  }
+  assert (index < shortlist.size());
+  return shortlist[index];
+}
+
+Expression SoftmaxOutputModel::ShortlistLogDistribution(const Expression& h) {
+  assert (!shortlist.empty());
+  if (softmax_w.pg == nullptr) {
+    softmax_w = parameter(*pcg, p_softmax_w);
+    softmax_b = parameter(*pcg, p_softmax_b);
+  }
+
+  Expression W = select_rows(softmax_w, shortlist);
+  Expression b = select_rows(softmax_b, shortlist);
+  Expression log_probs = log_softmax(affine_transform({b, W, h}));
+  if (exact_shortlist) {
+    // Every word is off from its true log probability by the same amount,
+    // which we can read off of any one of them
+    Expression full_log_probs = log_softmax(affine_transform({softmax_b, softmax_w, h}));
+    Expression offset = pick(full_log_probs, shortlist[0]) - pick(log_probs, (unsigned)0);
+    Expression ones = input(*pcg, {(unsigned)shortlist.size()}, vector<float>(shortlist.size(), 1.0f));
+    log_probs = log_probs + ones * offset;
+  }
+  return log_probs;
+}
+
+bool SoftmaxOutputModel::SupportsBatchedDecoding() const {
+  // The class-factored softmax scores one class at a time and can't be batched
+  return dynamic_cast<StandardSoftmaxBuilder*>(fsb) != nullptr;
+}
+
+vector<Expression> SoftmaxOutputModel::GetInitialBatchState() const {
+  return MakeLSTMInitialState(output_builder_initial_state, state_dim, output_builder.layers);
+}
+
+Expression SoftmaxOutputModel::GetBatchState(const vector<Expression>& s) const {
+  return s.back();
+}
+
+// Note: this restarts output_builder from s, so RNNPointers handed out
+// earlier on this graph are no longer valid afterwards.
+vector<Expression> SoftmaxOutputModel::AddInputBatch(const vector<Expression>& s, const vector<WordId>& prev_words, const Expression& context) {
+  vector<unsigned> ids(prev_words.begin(), prev_words.end());
+  Expression prev_embeddings = lookup(*pcg, embeddings, ids);
+  Expression input = concatenate({prev_embeddings, context});
+  output_builder.start_new_sequence(s);
+  output_builder.add_input(input);
+  return output_builder.final_s();
+}
+
+Expression SoftmaxOutputModel::PredictLogDistributionBatch(const Expression& state, const Expression& context) {
+  if (!shortlist.empty()) {
+    return ShortlistLogDistribution(concatenate({state, context}));
+  }
+  return fsb->full_log_distribution(concatenate({state, context}));
+}
+
+Expression SoftmaxOutputModel::LossBatch(const Expression& state, const Expression& context, const vector<WordId>& refs) {
+  vector<unsigned> ids(refs.begin(), refs.end());
+  Expression h = concatenate({state, context});
+  if (has_softmax_params) {
+    if (softmax_w.pg == nullptr) {
+      softmax_w = parameter(*pcg, p_softmax_w);
+      softmax_b = parameter(*pcg, p_softmax_b);
+    }
+    return pickneglogsoftmax(affine_transform({softmax_b, softmax_w, h}), ids);
+  }
+  return -pick(fsb->full_log_distribution(h), ids);
+}
+
 Expression max_expr(const vector<Expression>& exprs) {
   assert (exprs.size() > 0);
   Expression M = exprs[0];
@@ -121,16 +231,15 @@ Expression max_expr(const vector<Expression>& exprs) {
   return M;
 }
 
-Expression SoftmaxOutputModel::Loss(RNNPointer p, Expression context, const shared_ptr<const Word> ref) {
+Expression SoftmaxOutputModel::Loss(RNNPointer p, Expression context, const Word& ref) {
   Expression state = GetState(p);
-  const shared_ptr<const StandardWord> r = dynamic_pointer_cast<const StandardWord>(ref);
 
   if (false) {
     unsigned vocab_size = 3118;
     unsigned num_samples = 100;
     Expression scores = dynamic_cast<StandardSoftmaxBuilder*>(fsb)->score(state);
-    Expression ref_score = pick(scores, r->id);
-    //cerr << "Ref score " << r->id << ": " << as_scalar(ref_score.value()) << endl;
+    Expression ref_score = pick(scores, ref.standard_id());
+    //cerr << "Ref score " << ref.id << ": " << as_scalar(ref_score.value()) << endl;
     vector<Expression> sample_scores;
     for (unsigned i = 0; i < num_samples; ++i) {
       unsigned sample_id = rand() % vocab_size;
@@ -151,14 +260,14 @@ Expression SoftmaxOutputModel::Loss(RNNPointer p, Expression context, const shar
     return -log_prob;
   }
   else {
-    return fsb->neg_log_softmax(concatenate({state, context}), r->id);
+    return fsb->neg_log_softmax(concatenate({state, context}), ref.standard_id());
   }
 }
 
-pair<shared_ptr<Word>, float> SoftmaxOutputModel::Sample(RNNPointer p, Expression context) {
+pair<Word, float> SoftmaxOutputModel::Sample(RNNPointer p, Expression context) {
   Expression state = GetState(p);
   unsigned sampled_id = fsb->sample(concatenate({state, context}));
-  shared_ptr<StandardWord> sample = make_shared<StandardWord>(sampled_id);
+  Word sample(sampled_id);
   Expression score_expr = fsb->neg_log_softmax(state, sampled_id);
   float score = as_scalar(score_expr.value());
   return make_pair(sample, score);
@@ -186,12 +295,17 @@ Expression MlpSoftmaxOutputModel::GetState(RNNPointer p) const {
   return state;
 }
 
-Expression MlpSoftmaxOutputModel::AddInput(const shared_ptr<const Word> prev_word_, const Expression& context, const RNNPointer& p) {
+Expression MlpSoftmaxOutputModel::AddInput(const Word& prev_word_, const Expression& context, const RNNPointer& p) {
   Expression base_state = SoftmaxOutputModel::AddInput(prev_word_, context, p);
   Expression state = tanh(affine_transform({b, W, base_state}));
   return state;
 }
 
+Expression MlpSoftmaxOutputModel::GetBatchState(const vector<Expression>& s) const {
+  Expression base_state = SoftmaxOutputModel::GetBatchState(s);
+  return tanh(affine_transform({b, W, base_state}));
+}
+
 void MlpSoftmaxOutputModel::NewGraph(ComputationGraph& cg) {
   SoftmaxOutputModel::NewGraph(cg);
   W = parameter(cg, p_W);
@@ -294,7 +408,7 @@ RNNPointer MorphologyOutputModel::GetStatePointer() const {
   return output_builder.state();
 }
 
-Expression MorphologyOutputModel::AddInput(const shared_ptr<const Word> prev_word, const Expression& context, const RNNPointer& p) {
+Expression MorphologyOutputModel::AddInput(const Word& prev_word, const Expression& context, const RNNPointer& p) {
   Expression prev_embedding = embedder.Embed(prev_word);
   Expression input = concatenate({prev_embedding, context});
   Expression state = output_builder.add_input(p, input);
@@ -305,11 +419,11 @@ Expression MorphologyOutputModel::PredictLogDistribution(RNNPointer p, Expressio
   assert (false);
 }
 
-KBestList<shared_ptr<Word>> MorphologyOutputModel::PredictKBest(RNNPointer p, Expression context, unsigned K) {
+KBestList<Word> MorphologyOutputModel::PredictKBest(RNNPointer p, Expression context, unsigned K) {
   assert (false);
 }
 
-pair<shared_ptr<Word>, float> MorphologyOutputModel::Sample(RNNPointer p, Expression context) {
+pair<Word, float> MorphologyOutputModel::Sample(RNNPointer p, Expression context) {
   assert (false);
 }
 
@@ -367,14 +481,14 @@ Expression MorphologyOutputModel::CharLoss(const Expression& state, const vector
   return sum(char_losses);
 }
 
-Expression MorphologyOutputModel::Loss(RNNPointer p, Expression context, const shared_ptr<const Word> ref) {
+Expression MorphologyOutputModel::Loss(RNNPointer p, Expression context, const Word& ref) {
   assert (false && "Use context vector!");
   Expression state = GetState(p);
-  const shared_ptr<const MorphoWord> r = dynamic_pointer_cast<const MorphoWord>(ref);
+  const MorphoWord& r = ref.morpho();
   Expression model_probs = log_softmax(model_chooser.Feed(state));
-  Expression word_loss = WordLoss(state, r->word);
-  Expression morph_loss = MorphLoss(state, r->analyses);
-  Expression char_loss = CharLoss(state, r->chars);
+  Expression word_loss = WordLoss(state, r.word);
+  Expression morph_loss = MorphLoss(state, r.analyses);
+  Expression char_loss = CharLoss(state, r.chars);
 
   vector<Expression> losses;
   losses.push_back(pick(model_probs, 1) - word_loss);
@@ -480,9 +594,8 @@ RNNPointer RnngOutputModel::GetStatePointer() const {
   return builder->state();
 }
 
-Expression RnngOutputModel::AddInput(const shared_ptr<const Word> prev_word_, const Expression& context, const RNNPointer& p) {
-  const shared_ptr<const StandardWord> prev_word = dynamic_pointer_cast<const StandardWord>(prev_word_);
-  Action action = Convert(prev_word->id);
+Expression RnngOutputModel::AddInput(const Word& prev_word, const Expression& context, const RNNPointer& p) {
+  Action action = Convert(prev_word.standard_id());
   builder->PerformAction(action, p);
   Expression state_context_vector = builder->GetStateVector(context);
   state_context_vectors.push_back(state_context_vector);
@@ -495,34 +608,33 @@ Expression RnngOutputModel::PredictLogDistribution(RNNPointer p, Expression cont
   return builder->GetActionDistribution(p, state);
 }
 
-KBestList<shared_ptr<Word>> RnngOutputModel::PredictKBest(RNNPointer p, Expression context, unsigned K) {
+KBestList<Word> RnngOutputModel::PredictKBest(RNNPointer p, Expression context, unsigned K) {
   assert (false && "Use context vector!");
   Expression state = GetState(p); // XXX
   KBestList<Action> kbest_action = builder->PredictKBest(p, state, K);
-  KBestList<shared_ptr<Word>> kbest_list(K);
+  KBestList<Word> kbest_list(K);
   for (auto score_action : kbest_action.hypothesis_list()) {
     float score = get<0>(score_action);
     Action action = get<1>(score_action);
-    kbest_list.add(score, make_shared<StandardWord>(Convert(action)));
+    kbest_list.add(score, Word(Convert(action)));
   }
   return kbest_list;
 }
 
-pair<shared_ptr<Word>, float> RnngOutputModel::Sample(RNNPointer p, Expression context) {
+pair<Word, float> RnngOutputModel::Sample(RNNPointer p, Expression context) {
   assert (false && "Use context vector!");
   Expression state = GetState(p); // XXX
   Action action = builder->Sample(p, state);
   unsigned sampled_id = Convert(action);
-  shared_ptr<Word> sample = make_shared<StandardWord>(sampled_id);
+  Word sample(sampled_id);
   Expression score_expr = builder->Loss(p, state, action);
   float score = as_scalar(score_expr.value());
   return make_pair(sample, score);
 }
 
-Expression RnngOutputModel::Loss(RNNPointer p, Expression context, const shared_ptr<const Word> ref) {
+Expression RnngOutputModel::Loss(RNNPointer p, Expression context, const Word& ref) {
   assert (false && "Use context vector!");
-  const shared_ptr<const StandardWord> r = dynamic_pointer_cast<const StandardWord>(ref);
-  Action ref_action = Convert(r->id);
+  Action ref_action = Convert(ref.standard_id());
   if (ref_action.type == Action::kNone) {
     return zeroes(*pcg, {1});
   }
@@ -532,6 +644,10 @@ Expression RnngOutputModel::Loss(RNNPointer p, Expression context, const shared_
   return neg_log_prob;
 }
 
+size_t RnngOutputModel::StateSignature(RNNPointer p) const {
+  return builder->StateSignature(p);
+}
+
 Action RnngOutputModel::Convert(WordId w) const {
   return w2a[w];
 }
@@ -587,6 +703,9 @@ void DependencyOutputModel::NewGraph(ComputationGraph& cg) {
 
   stack.clear();
   stack.push_back((RNNPointer)-1);
+
+  stack_signatures.clear();
+  stack_signatures.push_back(0);
 }
 
 void DependencyOutputModel::SetDropout(float rate) {}
@@ -606,12 +725,12 @@ RNNPointer DependencyOutputModel::GetStatePointer() const {
   return (RNNPointer)((int)prev_states.size() - 1);
 }
 
-Expression DependencyOutputModel::AddInput(const shared_ptr<const Word> prev_word, const Expression& context, const RNNPointer& p) {
+Expression DependencyOutputModel::AddInput(const Word& prev_word, const Expression& context, const RNNPointer& p) {
   assert (prev_states.size() == stack.size());
   assert (prev_states.size() == head.size());
   assert (p < prev_states.size());
 
-  unsigned wordid = dynamic_pointer_cast<const StandardWord>(prev_word)->id;
+  unsigned wordid = prev_word.standard_id();
   Expression embedding = embedder->Embed(prev_word);
   Expression transformed_embedding = emb_transform * embedding;
 
@@ -621,6 +740,7 @@ Expression DependencyOutputModel::AddInput(const shared_ptr<const Word> prev_wor
   bool left_done;
   tie(stack_pointer, comp_pointer, stack_depth, left_done) = prev_states[p];
   RNNPointer parent = (RNNPointer)-1337;
+  size_t stack_signature = stack_signatures[p];
 
   Expression input_vec = concatenate({transformed_embedding, context});
 
@@ -636,6 +756,7 @@ Expression DependencyOutputModel::AddInput(const shared_ptr<const Word> prev_wor
       stack_depth --;
       left_done = true;
       parent = -1;
+      stack_signature = 0;
     }
     else {
       State& pop_to = prev_states[pop_to_i];
@@ -652,6 +773,7 @@ Expression DependencyOutputModel::AddInput(const shared_ptr<const Word> prev_wor
       left_done = get<3>(pop_to);
 
       parent = stack[pop_to_i];
+      stack_signature = stack_signatures[pop_to_i];
     }
   }
   else if (wordid == done_with_left) {
@@ -670,6 +792,7 @@ Expression DependencyOutputModel::AddInput(const shared_ptr<const Word> prev_wor
     stack_depth++;
     left_done = false;
     parent = p;
+    boost::hash_combine(stack_signature, wordid);
   }
 
   /*cerr << prev_states.size() << "\t" << "head: " << p << ", " << "stack: " << parent;
@@ -677,6 +800,7 @@ Expression DependencyOutputModel::AddInput(const shared_ptr<const Word> prev_wor
   cerr << ", " << "sd: " << stack_depth << ", " << "ld: " << left_done << ", " << "word: " << word << endl;*/
   stack.push_back(parent);
   head.push_back(p);
+  stack_signatures.push_back(stack_signature);
   prev_states.push_back(make_tuple(stack_pointer, comp_pointer, stack_depth, left_done));
 
   assert (prev_states.size() == stack.size());
@@ -691,34 +815,42 @@ Expression DependencyOutputModel::PredictLogDistribution(RNNPointer p, Expressio
   return log_probs;
 }
 
-KBestList<shared_ptr<Word>> DependencyOutputModel::PredictKBest(RNNPointer p, Expression context, unsigned K) {
+KBestList<Word> DependencyOutputModel::PredictKBest(RNNPointer p, Expression context, unsigned K) {
   vector<float> log_probs = as_vector(PredictLogDistribution(p, context).value());
   unsigned stack_depth = get<2>(prev_states[p]);
   bool left_done = get<3>(prev_states[p]);
 
-  KBestList<shared_ptr<Word>> kbest(K);
-  for (unsigned i = 0; i < log_probs.size(); ++i) {
-    if (i == done_with_left && (left_done || stack_depth >= 100)) {
-      continue;
-    }
-    else if (i == done_with_right && (IsDone(p) || !left_done)) {
-      continue;
-    }
-    shared_ptr<Word> word = make_shared<StandardWord>(i);
-    kbest.add(log_probs[i], word);
+  // Mask out the actions that aren't legal in this state
+  const float masked = kMaskedScore;
+  if (left_done || stack_depth >= 100) {
+    log_probs[done_with_left] = masked;
+  }
+  if (IsDone(p) || !left_done) {
+    log_probs[done_with_right] = masked;
   }
 
+  KBestList<Word> kbest(K);
+  for (auto& scored_word : TopK(log_probs, K)) {
+    kbest.append(scored_word.first, Word(scored_word.second));
+  }
   return kbest;
 }
 
-pair<shared_ptr<Word>, float> DependencyOutputModel::Sample(RNNPointer p, Expression context) {
+pair<Word, float> DependencyOutputModel::Sample(RNNPointer p, Expression context) {
   assert (false);
 }
 
-Expression DependencyOutputModel::Loss(RNNPointer p, Expression context, const shared_ptr<const Word> ref) {
+Expression DependencyOutputModel::Loss(RNNPointer p, Expression context, const Word& ref) {
   Expression state = GetState(p);
   Expression log_probs = final_mlp.Feed(concatenate({state, context}));
-  return pickneglogsoftmax(log_probs, dynamic_pointer_cast<const StandardWord>(ref)->id);
+  return pickneglogsoftmax(log_probs, ref.standard_id());
+}
+
+size_t DependencyOutputModel::StateSignature(RNNPointer p) const {
+  size_t signature = stack_signatures[p];
+  boost::hash_combine(signature, get<2>(prev_states[p]));
+  boost::hash_combine(signature, get<3>(prev_states[p]));
+  return signature;
 }
 
 bool DependencyOutputModel::IsDone(RNNPointer p) const {
@@ -5,6 +5,7 @@
 #include <boost/serialization/unordered_map.hpp>
 #include <boost/serialization/vector.hpp>
 #include <boost/serialization/base_object.hpp>
+#include <boost/serialization/version.hpp>
 #include <boost/archive/binary_iarchive.hpp>
 #include <boost/archive/binary_oarchive.hpp>
 #include <boost/archive/text_iarchive.hpp>
@@ -17,6 +18,7 @@
 #include "embedder.h"
 #include "utils.h"
 #include "kbestlist.h"
+#include "topk.h"
 #include "rnng.h"
 
 using namespace std;
@@ -32,21 +34,26 @@ public:
   virtual Expression GetState() const;
   virtual Expression GetState(RNNPointer p) const = 0;
   virtual RNNPointer GetStatePointer() const = 0;
-  virtual Expression AddInput(const shared_ptr<const Word> prev_word, const Expression& context);
-  virtual Expression AddInput(const shared_ptr<const Word> prev_word, const Expression& context, const RNNPointer& p) = 0;
+  virtual Expression AddInput(const Word& prev_word, const Expression& context);
+  virtual Expression AddInput(const Word& prev_word, const Expression& context, const RNNPointer& p) = 0;
 
   virtual Expression PredictLogDistribution(Expression context);
   virtual Expression PredictLogDistribution(RNNPointer p, Expression context) = 0;
-  virtual KBestList<shared_ptr<Word>> PredictKBest(Expression context, unsigned K);
-  virtual KBestList<shared_ptr<Word>> PredictKBest(RNNPointer p, Expression context, unsigned K) = 0;
-  virtual pair<shared_ptr<Word>, float> Sample(Expression context);
-  virtual pair<shared_ptr<Word>, float> Sample(RNNPointer p, Expression context) = 0;
-  virtual Expression Loss(Expression context, const shared_ptr<const Word> ref);
-  virtual Expression Loss(RNNPointer p, Expression context, const shared_ptr<const Word> ref) = 0;
+  virtual KBestList<Word> PredictKBest(Expression context, unsigned K);
+  virtual KBestList<Word> PredictKBest(RNNPointer p, Expression context, unsigned K) = 0;
+  virtual pair<Word, float> Sample(Expression context);
+  virtual pair<Word, float> Sample(RNNPointer p, Expression context) = 0;
+  virtual Expression Loss(Expression context, const Word& ref);
+  virtual Expression Loss(RNNPointer p, Expression context, const Word& ref) = 0;
 
   virtual bool IsDone() const;
   virtual bool IsDone(RNNPointer p) const = 0;
 
+  // A hash of whatever structured state (beyond the recurrent state vectors)
+  // determines what the model can do next from state p, e.g. a parser's stack.
+  // Used by beam search to recombine equivalent hypotheses.
+  virtual size_t StateSignature(RNNPointer p) const;
+
 private:
   friend class boost::serialization::access;
   template<class Archive>
@@ -62,17 +69,41 @@ public:
   void SetDropout(float rate) override;
   virtual Expression GetState(RNNPointer p) const override;
   RNNPointer GetStatePointer() const override;
-  Expression AddInput(const shared_ptr<const Word> prev_word, const Expression& context, const RNNPointer& p) override;
+  Expression AddInput(const Word& prev_word, const Expression& context, const RNNPointer& p) override;
 
   virtual Expression PredictLogDistribution(RNNPointer p, Expression context) override;
-  virtual KBestList<shared_ptr<Word>> PredictKBest(RNNPointer p, Expression context, unsigned K) override;
-  virtual pair<shared_ptr<Word>, float> Sample(RNNPointer p, Expression context) override;
-  virtual Expression Loss(RNNPointer p, Expression context, const shared_ptr<const Word> ref) override;
+  virtual KBestList<Word> PredictKBest(RNNPointer p, Expression context, unsigned K) override;
+  virtual pair<Word, float> Sample(RNNPointer p, Expression context) override;
+  virtual Expression Loss(RNNPointer p, Expression context, const Word& ref) override;
 
   bool IsDone(RNNPointer p) const override;
 
   // TODO: Take an (standard?) embedder
-  Expression Embed(const shared_ptr<const StandardWord> word);
+  Expression Embed(const Word& word);
+
+  // Batched decoding. The LSTM state of a batch of hypotheses is carried around
+  // explicitly as the vector returned by final_s() (cells, then hidden states),
+  // where every expression has one batch element per hypothesis.
+  bool SupportsBatchedDecoding() const;
+  vector<Expression> GetInitialBatchState() const;
+  virtual Expression GetBatchState(const vector<Expression>& s) const;
+  vector<Expression> AddInputBatch(const vector<Expression>& s, const vector<WordId>& prev_words, const Expression& context);
+  Expression PredictLogDistributionBatch(const Expression& state, const Expression& context);
+  // The negative log probability of refs[j] given batch element j of state and context
+  Expression LossBatch(const Expression& state, const Expression& context, const vector<WordId>& refs);
+
+  // Vocabulary shortlists. While one is set, PredictKBest and
+  // PredictLogDistributionBatch only compute the softmax rows of the listed
+  // words (plus </s>), and index i of a batched distribution stands for the
+  // word CandidateWord(i). The listed words are normalized among themselves,
+  // unless exact is set, in which case they get their true log probabilities
+  // at the cost of computing the full logits too. Sampling and losses are
+  // unaffected. Needs the standard softmax of a model saved with its
+  // parameters, i.e. since shortlists were introduced.
+  bool SupportsShortlist() const;
+  void SetShortlist(const vector<unsigned>& candidates, bool exact = false);
+  void ClearShortlist();
+  WordId CandidateWord(unsigned index) const;
 
 //protected:
   WordId kEOS;
@@ -81,15 +112,23 @@ public:
   Parameter p_output_builder_initial_state;
   LookupParameter embeddings;
   SoftmaxBuilder* fsb;
+  // fsb's own W and b, if it's a StandardSoftmaxBuilder
+  bool has_softmax_params;
+  Parameter p_softmax_w, p_softmax_b;
 
   vector<bool> done;
   Expression output_builder_initial_state;
   ComputationGraph* pcg;
 
+  vector<unsigned> shortlist;
+  bool exact_shortlist;
+  Expression softmax_w, softmax_b;
+  Expression ShortlistLogDistribution(const Expression& h);
+
 private:
   friend class boost::serialization::access;
   template<class Archive>
-  void serialize(Archive& ar, const unsigned int) {
+  void serialize(Archive& ar, const unsigned int version) {
     ar & boost::serialization::base_object<OutputModel>(*this);
     ar & kEOS;
     ar & state_dim;
@@ -97,9 +136,17 @@ private:
     ar & p_output_builder_initial_state;
     ar & embeddings;
     ar & fsb;
+    if (version > 0) {
+      ar & has_softmax_params;
+      if (has_softmax_params) {
+        ar & p_softmax_w;
+        ar & p_softmax_b;
+      }
+    }
   }
 };
 BOOST_CLASS_EXPORT_KEY(SoftmaxOutputModel)
+BOOST_CLASS_VERSION(SoftmaxOutputModel, 1)
 
 class MlpSoftmaxOutputModel : public SoftmaxOutputModel {
 public:
@@ -107,7 +154,8 @@ public:
   MlpSoftmaxOutputModel(Model& model, unsigned embedding_dim, unsigned context_dim, unsigned state_dim, unsigned hidden_dim, Dict* vocab, const string& clusters_file);
 
   Expression GetState(RNNPointer p) const override;
-  Expression AddInput(const shared_ptr<const Word> prev_word, const Expression& context, const RNNPointer& p) override;
+  Expression AddInput(const Word& prev_word, const Expression& context, const RNNPointer& p) override;
+  Expression GetBatchState(const vector<Expression>& s) const override;
 
   void NewGraph(ComputationGraph& cg) override;
 
@@ -137,12 +185,12 @@ public:
   void SetDropout(float rate) override;
   Expression GetState(RNNPointer p) const override;
   RNNPointer GetStatePointer() const override;
-  Expression AddInput(const shared_ptr<const Word> prev_word, const Expression& context, const RNNPointer& p) override;
+  Expression AddInput(const Word& prev_word, const Expression& context, const RNNPointer& p) override;
 
   Expression PredictLogDistribution(RNNPointer p, Expression context) override;
-  KBestList<shared_ptr<Word>> PredictKBest(RNNPointer p, Expression context, unsigned K) override;
-  pair<shared_ptr<Word>, float> Sample(RNNPointer p, Expression context) override;
-  Expression Loss(RNNPointer p, Expression context, const shared_ptr<const Word> ref) override;
+  KBestList<Word> PredictKBest(RNNPointer p, Expression context, unsigned K) override;
+  pair<Word, float> Sample(RNNPointer p, Expression context) override;
+  Expression Loss(RNNPointer p, Expression context, const Word& ref) override;
 
   bool IsDone(RNNPointer p) const override;
 
@@ -212,14 +260,15 @@ public:
   void SetDropout(float rate) override;
   Expression GetState(RNNPointer p) const override;
   RNNPointer GetStatePointer() const override;
-  Expression AddInput(const shared_ptr<const Word> prev_word, const Expression& context, const RNNPointer& p) override;
+  Expression AddInput(const Word& prev_word, const Expression& context, const RNNPointer& p) override;
 
   Expression PredictLogDistribution(RNNPointer p, Expression context) override;
-  KBestList<shared_ptr<Word>> PredictKBest(RNNPointer p, Expression context, unsigned K) override;
-  pair<shared_ptr<Word>, float> Sample(RNNPointer p, Expression context) override;
-  Expression Loss(RNNPointer p, Expression context, const shared_ptr<const Word> ref) override;
+  KBestList<Word> PredictKBest(RNNPointer p, Expression context, unsigned K) override;
+  pair<Word, float> Sample(RNNPointer p, Expression context) override;
+  Expression Loss(RNNPointer p, Expression context, const Word& ref) override;
 
   bool IsDone(RNNPointer p) const override;
+  size_t StateSignature(RNNPointer p) const override;
 
 private:
   Action Convert(const WordId w) const;
@@ -234,7 +283,7 @@ private:
 
   vector<Expression> source_contexts;
   vector<Expression> state_context_vectors;
-  vector<vector<StandardWord>> word_sequences;
+  vector<vector<Word>> word_sequences;
   ComputationGraph* pcg;
 
   friend class boost::serialization::access;
@@ -258,13 +307,14 @@ public:
   void SetDropout(float rate) override;
   Expression GetState(RNNPointer p) const override;
   RNNPointer GetStatePointer() const override;
-  Expression AddInput(const shared_ptr<const Word> prev_word, const Expression& context, const RNNPointer& p) override;
+  Expression AddInput(const Word& prev_word, const Expression& context, const RNNPointer& p) override;
 
   Expression PredictLogDistribution(RNNPointer p, Expression context) override;
-  KBestList<shared_ptr<Word>> PredictKBest(RNNPointer p, Expression context, unsigned K) override;
-  pair<shared_ptr<Word>, float> Sample(RNNPointer p, Expression context) override;
-  Expression Loss(RNNPointer p, Expression context, const shared_ptr<const Word> ref) override;
+  KBestList<Word> PredictKBest(RNNPointer p, Expression context, unsigned K) override;
+  pair<Word, float> Sample(RNNPointer p, Expression context) override;
+  Expression Loss(RNNPointer p, Expression context, const Word& ref) override;
   bool IsDone(RNNPointer p) const override;
+  size_t StateSignature(RNNPointer p) const override;
 
 private:
   typedef tuple<RNNPointer, RNNPointer, unsigned, bool> State; // Stack pointer, comp pointer, stack depth, done with left
@@ -289,6 +339,7 @@ private:
   vector<State> prev_states;
   vector<RNNPointer> stack; // From each state, if you were to see </RIGHT> where would you go back to?
   vector<RNNPointer> head;
+  vector<size_t> stack_signatures; // From each state, a hash of the words on the stack
 
   friend class boost::serialization::access;
   template<class Archive>
@@ -0,0 +1,113 @@
+#include <iostream>
+#include <algorithm>
+#include <cassert>
+#include "parallel_reader.h"
+
+namespace {
+// Files smaller than this per thread aren't worth splitting up
+const uint64_t kMinBytesPerRange = 1 << 20;
+
+unsigned read_threads = 0;
+
+// Returns the offset of the first record that starts at or after offset
+uint64_t NextRecordStart(ifstream& f, uint64_t offset, uint64_t file_size, bool blank_line_records) {
+  if (offset == 0) {
+    return 0;
+  }
+
+  // Finish the line that offset - 1 is on
+  f.clear();
+  f.seekg(offset - 1);
+  string line;
+  if (!std::getline(f, line)) {
+    return file_size;
+  }
+  uint64_t position = offset - 1 + line.length() + 1;
+
+  // Then skip past the next blank line. If offset was already just after one,
+  // this moves the boundary one record further than it needs to, which is fine.
+  if (blank_line_records) {
+    while (std::getline(f, line)) {
+      position += line.length() + 1;
+      if (strip(line).length() == 0) {
+        break;
+      }
+    }
+  }
+  return min(position, file_size);
+}
+}
+
+void SetReadThreads(unsigned threads) {
+  read_threads = threads;
+}
+
+unsigned ReadThreads() {
+  if (read_threads == 0) {
+    return max(thread::hardware_concurrency(), 1U);
+  }
+  return read_threads;
+}
+
+FileRange::FileRange(const string& filename, uint64_t begin, uint64_t end) : f(filename), position(begin), end(end) {
+  assert (f.is_open());
+  f.seekg(begin);
+}
+
+bool FileRange::getline(string& line) {
+  if (position >= end || !std::getline(f, line)) {
+    return false;
+  }
+  position += line.length() + 1;
+  return true;
+}
+
+vector<pair<uint64_t, uint64_t>> SplitFile(const string& filename, bool blank_line_records) {
+  ifstream f(filename, ios::binary);
+  if (!f.is_open()) {
+    cerr << "Unable to open " << filename << " for reading." << endl;
+    assert (f.is_open());
+  }
+  f.seekg(0, ios::end);
+  const uint64_t file_size = f.tellg();
+
+  uint64_t range_count = min((uint64_t)ReadThreads(), file_size / kMinBytesPerRange);
+  range_count = max(range_count, (uint64_t)1);
+
+  vector<pair<uint64_t, uint64_t>> ranges;
+  uint64_t begin = 0;
+  for (uint64_t i = 1; i <= range_count; ++i) {
+    uint64_t end = (i == range_count) ? file_size : NextRecordStart(f, file_size * i / range_count, file_size, blank_line_records);
+    if (end > begin) {
+      ranges.push_back(make_pair(begin, end));
+      begin = end;
+    }
+  }
+  if (ranges.size() == 0) {
+    ranges.push_back(make_pair(0, file_size));
+  }
+  return ranges;
+}
+
+vector<WordId> MergeVocab(const Dict& local, Dict& dict) {
+  vector<WordId> ids(local.size());
+  for (unsigned i = 0; i < local.size(); ++i) {
+    ids[i] = dict.convert(local.convert(i));
+  }
+  return ids;
+}
+
+void ParallelFor(unsigned n, const function<void(unsigned)>& f) {
+  if (n == 1) {
+    f(0);
+    return;
+  }
+
+  vector<thread> threads;
+  for (unsigned i = 0; i < n; ++i) {
+    threads.push_back(thread(f, i));
+  }
+  for (thread& t : threads) {
+    t.join();
+  }
+}
@@ -0,0 +1,71 @@
+#pragma once
+#include <fstream>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include "dynet/dict.h"
+#include "utils.h"
+
+using namespace std;
+using namespace dynet;
+
+// Helpers for reading a corpus file on several threads. The file is split
+// into byte ranges that each start at the beginning of a record, and each
+// range is read by its own thread into its own Dicts. The Dicts are then
+// merged into the reader's in range order, which assigns new words exactly
+// the ids that reading the file serially would have, and finally each
+// thread's sentences are remapped to the merged ids.
+
+// Number of threads to read files with. 0, the default, means one per core.
+void SetReadThreads(unsigned threads);
+unsigned ReadThreads();
+
+// The lines of a file between two byte offsets
+class FileRange {
+public:
+  FileRange(const string& filename, uint64_t begin, uint64_t end);
+  bool getline(string& line);
+
+private:
+  ifstream f;
+  uint64_t position;
+  uint64_t end;
+};
+
+// Splits filename into up to ReadThreads() ranges. Records are single lines,
+// or with blank_line_records, runs of lines ending with a blank one.
+vector<pair<uint64_t, uint64_t>> SplitFile(const string& filename, bool blank_line_records);
+
+// Adds the words of local to dict, in local's id order, and returns the id in
+// dict of each word of local
+vector<WordId> MergeVocab(const Dict& local, Dict& dict);
+
+// Calls read_piece on one thread per range of filename, giving each its own Piece
+template<class Piece>
+vector<Piece> ReadInParallel(const string& filename, bool blank_line_records, const function<void(FileRange&, Piece&)>& read_piece) {
+  vector<pair<uint64_t, uint64_t>> ranges = SplitFile(filename, blank_line_records);
+  vector<Piece> pieces(ranges.size());
+  auto read = [&](unsigned i) {
+    FileRange range(filename, ranges[i].first, ranges[i].second);
+    read_piece(range, pieces[i]);
+  };
+
+  if (ranges.size() == 1) {
+    read(0);
+    return pieces;
+  }
+
+  vector<thread> threads;
+  for (unsigned i = 0; i < ranges.size(); ++i) {
+    threads.push_back(thread(read, i));
+  }
+  for (thread& t : threads) {
+    t.join();
+  }
+  return pieces;
+}
+
+// Calls f(i) for each i < n, each on its own thread
+void ParallelFor(unsigned n, const function<void(unsigned)>& f);
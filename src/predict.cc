@@ -5,26 +5,95 @@
 
 #include <iostream>
 #include <fstream>
+#include <sstream>
+#include <chrono>
+#include <unistd.h>
 
 #include "io.h"
 #include "kbestlist.h"
 #include "utils.h"
+#include "worker_pool.h"
+#include "shortlist.h"
 
 using namespace dynet;
 using namespace std;
 namespace po = boost::program_options;
 
+// Reads source sentences from stdin, one per line, and hands them to the pool
+// as they arrive. Each response is a k-best list in the usual format, followed
+// by a blank line. Responses may come back out of order; the sentence number
+// at the start of each line is the (0-based) index of the request it answers.
+// With --stream, STREAM lines may also show up at any point between responses.
+void Serve(WorkerPool& pool) {
+  typedef chrono::steady_clock clock;
+  map<unsigned, clock::time_point> start_times;
+  string buffer;
+  char chunk[4096];
+  unsigned next_id = 0;
+  bool input_done = false;
+
+  while (!input_done || pool.pending() > 0) {
+    unsigned id;
+    string response;
+    bool partial;
+    if (pool.Receive(id, response, input_done ? -1 : STDIN_FILENO, &partial)) {
+      if (partial) {
+        cout << response;
+        cout.flush();
+        continue;
+      }
+      cout << response << endl;
+      cout.flush();
+      double latency = chrono::duration<double, milli>(clock::now() - start_times[id]).count();
+      start_times.erase(id);
+      cerr << "Request " << id << " took " << latency << " ms" << endl;
+      continue;
+    }
+
+    ssize_t bytes_read = read(STDIN_FILENO, chunk, sizeof(chunk));
+    if (bytes_read <= 0) {
+      input_done = true;
+      if (strip(buffer).length() > 0) {
+        start_times[next_id] = clock::now();
+        pool.Submit(next_id++, buffer);
+      }
+      continue;
+    }
+
+    buffer.append(chunk, bytes_read);
+    for (size_t pos = buffer.find('\n'); pos != string::npos; pos = buffer.find('\n')) {
+      start_times[next_id] = clock::now();
+      pool.Submit(next_id++, buffer.substr(0, pos));
+      buffer.erase(0, pos + 1);
+    }
+  }
+}
+
 int main(int argc, char** argv) {
   dynet::initialize(argc, argv);
 
   po::options_description desc("description");
   desc.add_options()
   ("model", po::value<string>()->required(), "model file(s), as output by train")
-  ("input_source", po::value<string>()->required(), "input file source")
+  ("input_source", po::value<string>(), "input file source")
   ("kbest_size,k", po::value<unsigned>()->default_value(1), "K-best list size")
   ("beam_size,b", po::value<unsigned>()->default_value(10), "Beam size")
   ("max_length", po::value<unsigned>()->default_value(100), "Maximum length of output sentences")
   ("length_bonus", po::value<float>()->default_value(0.0f), "Length bonus per word")
+  ("length_norm", po::value<float>()->default_value(0.0f), "GNMT-style length normalization strength (alpha). 0 disables it")
+  ("coverage_penalty", po::value<float>()->default_value(0.0f), "GNMT-style coverage penalty strength (beta). 0 disables it")
+  ("early_stopping", po::value<EarlyStopping>()->default_value(kSafeBound, "bound"), "When to stop searching. \"bound\" stops once no live hypothesis can beat the k-best complete ones. \"best\" stops as soon as the k-best complete hypotheses beat every live one, which is faster but inexact")
+  ("recombine", po::value<Recombination>()->default_value(kNoRecombination, "none"), "Merge live hypotheses whose output model states and last few words agree. \"max\" keeps the best one's score, \"sum\" gives it their total probability. Not supported with --batched")
+  ("recombination_history", po::value<unsigned>()->default_value(2), "Number of trailing words that must agree for hypotheses to be recombined")
+  ("shortlist", po::value<string>(), "Lexical table (\"source target probability\" per line) used to restrict the output vocabulary of each sentence to the likely translations of its words plus the most frequent words. Standard softmax models only")
+  ("shortlist_translations", po::value<unsigned>()->default_value(10), "Number of translations per source word to put on the shortlist")
+  ("shortlist_frequent", po::value<unsigned>()->default_value(1000), "Number of frequent target words to put on the shortlist")
+  ("shortlist_frequent_words", po::value<string>(), "Target words from most to least frequent, one per line. By default the words with the lowest ids are taken to be the most frequent")
+  ("shortlist_exact", "Give shortlisted words their exact log probabilities under the full vocabulary instead of renormalizing over the shortlist. Slower")
+  ("stream", "While decoding, print each sentence's words as soon as every hypothesis in the beam agrees on them, as \"n ||| STREAM ||| words\" lines. Each such line only has the newly committed words. The k-best list is still printed at the end")
+  ("batched", "Expand all the hypotheses in the beam with one batched computation per time step")
+  ("server", "Keep the model loaded and translate source sentences read from stdin, one per line, instead of input_source")
+  ("threads,j", po::value<unsigned>()->default_value(1), "Number of sentences to decode in parallel. Each runs in its own forked process")
   ("help", "Display this help message");
 
   po::positional_options_description positional_options;
@@ -41,12 +110,27 @@ int main(int argc, char** argv) {
 
   po::notify(vm);
 
+  if (!vm.count("server") && !vm.count("input_source")) {
+    cerr << "Either input_source or --server must be specified" << endl;
+    return 1;
+  }
+
   const string model_filename = vm["model"].as<string>();
-  const string input_source = vm["input_source"].as<string>();
   const unsigned beam_size = vm["beam_size"].as<unsigned>();
   const unsigned max_length = vm["max_length"].as<unsigned>();
   const unsigned kbest_size = vm["kbest_size"].as<unsigned>();
   const float length_bonus = vm["length_bonus"].as<float>();
+  const float length_norm = vm["length_norm"].as<float>();
+  const float coverage_penalty = vm["coverage_penalty"].as<float>();
+  const EarlyStopping early_stopping = vm["early_stopping"].as<EarlyStopping>();
+  const Recombination recombination = vm["recombine"].as<Recombination>();
+  const unsigned recombination_history = vm["recombination_history"].as<unsigned>();
+  const bool batched = vm.count("batched") > 0;
+  if (batched && recombination != kNoRecombination) {
+    cerr << "--recombine can't be combined with --batched" << endl;
+    return 1;
+  }
+  const unsigned threads = vm["threads"].as<unsigned>();
 
   InputReader* input_reader = nullptr;
   OutputReader* output_reader = nullptr;
@@ -56,15 +140,111 @@ int main(int argc, char** argv) {
   Deserialize(model_filename, input_reader, output_reader, translator, dynet_model, trainer);
   translator.SetDropout(0.0f);
 
-  vector<InputSentence*> source_sentences = input_reader->Read(input_source);
-  for (unsigned sentence_number = 0; sentence_number < source_sentences.size(); ++sentence_number) {
-    InputSentence* source = source_sentences[sentence_number];
+  // Morphologically analyzed sentences span several lines, so they can't be
+  // read one request line at a time
+  if (vm.count("server") && dynamic_cast<MorphologyInputReader*>(input_reader) != nullptr) {
+    cerr << "--server requires an input format with one sentence per line, which morphologically analyzed input isn't" << endl;
+    return 1;
+  }
 
-    KBestList<shared_ptr<OutputSentence>> kbest = translator.Translate(source, kbest_size, beam_size, max_length, length_bonus);
-    OutputKBestList(sentence_number, kbest, output_reader);
+  HypothesisScorer* scorer = nullptr;
+  if (length_norm > 0.0f || coverage_penalty > 0.0f) {
+    if (length_bonus != 0.0f) {
+      cerr << "--length_bonus can't be combined with --length_norm or --coverage_penalty" << endl;
+      return 1;
+    }
+    scorer = new GnmtScorer(length_norm, coverage_penalty);
+  }
+  else {
+    scorer = new WordBonusScorer(length_bonus);
+  }
+  if (scorer->NeedsCoverage() && !translator.attention_model->ProducesAlignments()) {
+    cerr << "--coverage_penalty requires an attention model that produces alignments" << endl;
+    return 1;
+  }
 
-    cout.flush();
+  Shortlist* shortlist = nullptr;
+  SoftmaxOutputModel* softmax_model = dynamic_cast<SoftmaxOutputModel*>(translator.output_model);
+  const bool shortlist_exact = vm.count("shortlist_exact") > 0;
+  if (vm.count("shortlist")) {
+    StandardInputReader* standard_input_reader = dynamic_cast<StandardInputReader*>(input_reader);
+    StandardOutputReader* standard_output_reader = dynamic_cast<StandardOutputReader*>(output_reader);
+    if (standard_input_reader == nullptr || standard_output_reader == nullptr || softmax_model == nullptr || !softmax_model->SupportsShortlist()) {
+      cerr << "--shortlist requires standard input, standard output, and a standard softmax (in a model saved since shortlists were added)" << endl;
+      return 1;
+    }
+    shortlist = new Shortlist(standard_input_reader->vocab, standard_output_reader->vocab, vm["shortlist_frequent"].as<unsigned>());
+    shortlist->LoadLexicalTable(vm["shortlist"].as<string>(), vm["shortlist_translations"].as<unsigned>());
+    if (vm.count("shortlist_frequent_words")) {
+      shortlist->LoadFrequentWords(vm["shortlist_frequent_words"].as<string>());
+    }
+  }
+
+  const bool stream = vm.count("stream") > 0;
+  auto translate = [&](unsigned sentence_number, InputSentence* source) {
+    if (shortlist != nullptr) {
+      softmax_model->SetShortlist(shortlist->Candidates(source), shortlist_exact);
+    }
+
+    PartialTranslationCallback callback = nullptr;
+    unsigned words_streamed = 0;
+    if (stream) {
+      callback = [&](const OutputSentence& committed, const OutputSentence& best) {
+        if (committed.size() <= words_streamed) {
+          return;
+        }
+        vector<string> words;
+        for (unsigned i = words_streamed; i < committed.size(); ++i) {
+          words.push_back(output_reader->ToString(committed[i]));
+        }
+        words_streamed = committed.size();
+        ostringstream line;
+        line << sentence_number << " ||| STREAM ||| " << boost::algorithm::join(words, " ") << endl;
+        if (!SendPartialResponse(line.str())) {
+          cout << line.str();
+          cout.flush();
+        }
+      };
+    }
+
+    return batched ?
+        translator.TranslateBatched(source, kbest_size, beam_size, max_length, *scorer, early_stopping, callback) :
+        translator.Translate(source, kbest_size, beam_size, max_length, *scorer, early_stopping, recombination, recombination_history, callback);
+  };
+
+  if (vm.count("server")) {
+    auto handle_request = [&](unsigned sentence_number, const string& line) {
+      InputSentence* source = input_reader->ReadSentence(line);
+      KBestList<shared_ptr<OutputSentence>> kbest = translate(sentence_number, source);
+      delete source;
+      ostringstream response;
+      OutputKBestList(sentence_number, kbest, output_reader, response);
+      return response.str();
+    };
+    WorkerPool pool(threads, handle_request);
+    cerr << "Ready with " << pool.size() << " worker(s)" << endl;
+    Serve(pool);
+    return 0;
   }
 
+  const string input_source = vm["input_source"].as<string>();
+  vector<InputSentence*> source_sentences = input_reader->Read(input_source);
+  auto decode = [&](unsigned sentence_number, const string&) {
+    InputSentence* source = source_sentences[sentence_number];
+    KBestList<shared_ptr<OutputSentence>> kbest = translate(sentence_number, source);
+    ostringstream out;
+    OutputKBestList(sentence_number, kbest, output_reader, out);
+    return out.str();
+  };
+  auto emit = [](unsigned sentence_number, const string& kbest) {
+    cout << kbest;
+    cout.flush();
+  };
+  auto emit_partial = [](unsigned sentence_number, const string& line) {
+    cout << line;
+    cout.flush();
+  };
+  RunOrdered(source_sentences.size(), threads, decode, emit, emit_partial);
+
   return 0;
 }
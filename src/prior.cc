@@ -3,6 +3,7 @@
 #include <boost/archive/binary_iarchive.hpp>
 #include <boost/archive/binary_oarchive.hpp>
 #include "prior.h"
+#include "custom_ops.h"
 BOOST_CLASS_EXPORT_IMPLEMENT(CoveragePrior)
 BOOST_CLASS_EXPORT_IMPLEMENT(DiagonalPrior)
 BOOST_CLASS_EXPORT_IMPLEMENT(MarkovPrior)
@@ -24,16 +25,32 @@ void AttentionPrior::NewGraph(ComputationGraph& cg) {
 void AttentionPrior::SetDropout(float rate) {}
 void AttentionPrior::NewSentence(const InputSentence* input) {}
 
-Expression AttentionPrior::Compute(const vector<Expression>& inputs, unsigned target_index) {
-  assert (false && "Invalid call to Compute() on a prior that does not accept string inputs");
+Expression AttentionPrior::LogPotential(const vector<Expression>& inputs, unsigned target_index) {
+  assert (false && "Invalid call to LogPotential() on a prior that does not accept string inputs");
 }
 
-Expression AttentionPrior::Compute(const vector<Expression>& inputs, const SyntaxTree* tree, unsigned target_index) {
-  assert (false && "Invalid call to Compute() on a prior that does not accept tree inputs");
+Expression AttentionPrior::LogPotential(const vector<Expression>& inputs, const SyntaxTree* tree, unsigned target_index) {
+  assert (false && "Invalid call to LogPotential() on a prior that does not accept tree inputs");
+}
+
+Expression AttentionPrior::Weight() const {
+  return weight;
 }
 
 void AttentionPrior::Notify(Expression attention_vector) {}
 
+bool AttentionPrior::SupportsBatchedDecoding() const {
+  return false;
+}
+
+void AttentionPrior::SelectHypotheses(const vector<unsigned>& parents) {}
+
+Expression AttentionPrior::GetState() const {
+  return Expression();
+}
+
+void AttentionPrior::SetState(const Expression& state) {}
+
 CoveragePrior::CoveragePrior() : AttentionPrior() {}
 
 CoveragePrior::CoveragePrior(Model& model) : AttentionPrior(model) {}
@@ -46,19 +63,35 @@ void CoveragePrior::NewSentence(const InputSentence* input) {
   coverage = zeroes(*pcg, {(unsigned)input->NumNodes()});
 }
 
-Expression CoveragePrior::Compute(const vector<Expression>& inputs, unsigned target_index) {
-  Expression prior = softmax(1 - coverage);
-  return pow(prior, weight);
+Expression CoveragePrior::LogPotential(const vector<Expression>& inputs, unsigned target_index) {
+  // softmax(1 - coverage), and the constant doesn't change the softmax
+  return -coverage;
 }
 
-Expression CoveragePrior::Compute(const vector<Expression>& inputs, const SyntaxTree* tree, unsigned target_index) {
-  return Compute(inputs, target_index);
+Expression CoveragePrior::LogPotential(const vector<Expression>& inputs, const SyntaxTree* tree, unsigned target_index) {
+  return LogPotential(inputs, target_index);
 }
 
 void CoveragePrior::Notify(Expression attention_vector) {
   coverage = coverage + attention_vector;
 }
 
+bool CoveragePrior::SupportsBatchedDecoding() const {
+  return true;
+}
+
+void CoveragePrior::SelectHypotheses(const vector<unsigned>& parents) {
+  coverage = SelectBatchElements(coverage, parents);
+}
+
+Expression CoveragePrior::GetState() const {
+  return coverage;
+}
+
+void CoveragePrior::SetState(const Expression& state) {
+  coverage = state;
+}
+
 DiagonalPrior::DiagonalPrior() : AttentionPrior() {}
 
 DiagonalPrior::DiagonalPrior(Model& model) : AttentionPrior(model) {
@@ -85,21 +118,26 @@ void DiagonalPrior::NewSentence(const InputSentence* sent) {
     }
   }
   source_percentages = input(*pcg, {source_length}, &source_percentages_v);
+  source_ones_v.assign(source_length, 1.0f);
+  source_ones = input(*pcg, {source_length}, &source_ones_v);
 }
 
-Expression DiagonalPrior::Compute(const vector<Expression>& inputs, unsigned target_index) {
+Expression DiagonalPrior::LogPotential(const vector<Expression>& inputs, unsigned target_index) {
   Expression target_expected_length = inputs.size() * length_ratio;
   Expression target_percentage = cdiv(input(*pcg, target_index), target_expected_length);
-  vector<Expression> target_percentage_n(inputs.size(), target_percentage);
-  Expression tp = concatenate(target_percentage_n);
-  Expression diff = source_percentages - tp;
+  // An N x 1 by 1 x 1 product copies the target percentage down the source
+  Expression diff = source_percentages - source_ones * target_percentage;
   // max (x, -x) = abs
-  Expression prior = softmax(-max(-diff, diff));
-  return pow(prior, weight);
+  return -max(-diff, diff);
 }
 
-Expression DiagonalPrior::Compute(const vector<Expression>& inputs, const SyntaxTree* tree, unsigned target_index) {
-  return Compute(inputs, target_index);
+Expression DiagonalPrior::LogPotential(const vector<Expression>& inputs, const SyntaxTree* tree, unsigned target_index) {
+  return LogPotential(inputs, target_index);
+}
+
+bool DiagonalPrior::SupportsBatchedDecoding() const {
+  // Every hypothesis is at the same target position
+  return true;
 }
 
 MarkovPrior::MarkovPrior() : AttentionPrior() {}
@@ -117,20 +155,32 @@ void MarkovPrior::NewSentence(const InputSentence* sent) {
   prev_attention_vector = zeroes(*pcg, {(unsigned)sent->NumNodes()});
 }
 
-Expression MarkovPrior::Compute(const vector<Expression>& inputs, unsigned target_index) {
-  assert (false);
-  // TODO: Who removed conv1d_wide from dynet and why??
-  /*Expression prior = conv1d_wide(transpose(prev_attention_vector), filter);
-  prior = transpose(prior);
-  prior = pickrange(prior, 0, inputs.size());
-  prior = softmax(prior);
-  return pow(prior, weight);*/
+Expression MarkovPrior::LogPotential(const vector<Expression>& inputs, unsigned target_index) {
+  // Scores each position by how far it is from where the previous step
+  // attended, with one filter tap per jump size (see jump_convolution)
+  return jump_convolution(prev_attention_vector, filter);
 }
 
 void MarkovPrior::Notify(Expression attention_vector) {
   prev_attention_vector = attention_vector;
 }
 
+bool MarkovPrior::SupportsBatchedDecoding() const {
+  return true;
+}
+
+void MarkovPrior::SelectHypotheses(const vector<unsigned>& parents) {
+  prev_attention_vector = SelectBatchElements(prev_attention_vector, parents);
+}
+
+Expression MarkovPrior::GetState() const {
+  return prev_attention_vector;
+}
+
+void MarkovPrior::SetState(const Expression& state) {
+  prev_attention_vector = state;
+}
+
 SyntaxPrior::SyntaxPrior() : AttentionPrior() {}
 
 SyntaxPrior::SyntaxPrior(Model& model) : AttentionPrior(model) {
@@ -171,7 +221,7 @@ void SyntaxPrior::NewSentence(const InputSentence* input) {
   }*/
 }
 
-Expression SyntaxPrior::Compute(const vector<Expression>& inputs, const SyntaxTree* tree, unsigned target_index) {
+Expression SyntaxPrior::LogPotential(const vector<Expression>& inputs, const SyntaxTree* tree, unsigned target_index) {
 vector<const SyntaxTree*> node_stack;
   vector<unsigned> index_stack;
   unsigned terminal_index = 0;
@@ -235,8 +285,7 @@ vector<const SyntaxTree*> node_stack;
     terminal_priors[i] = sum(node_log_probs[terminal->id()]);
   }
 
-  Expression syntax_prior = softmax(concatenate(terminal_priors));
-  return pow(syntax_prior, weight);
+  return concatenate(terminal_priors);
 }
 
 void SyntaxPrior::Notify(Expression attention_vector) {
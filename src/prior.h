@@ -23,9 +23,25 @@ public:
   virtual void SetDropout(float rate);
   virtual void NewSentence(const InputSentence* input);
 
-  virtual Expression Compute(const vector<Expression>& inputs, unsigned target_index);
-  virtual Expression Compute(const vector<Expression>& inputs, const SyntaxTree* const tree, unsigned target_index);
+  // The prior's log potential z over the source positions (N x 1), up to an
+  // additive constant. The prior itself is softmax(z) ^ Weight(), and the
+  // attention model combines it with its scores using prior_combine.
+  virtual Expression LogPotential(const vector<Expression>& inputs, unsigned target_index);
+  virtual Expression LogPotential(const vector<Expression>& inputs, const SyntaxTree* const tree, unsigned target_index);
+  Expression Weight() const;
   virtual void Notify(Expression attention_vector);
+
+  // Whether the prior can keep a separate state for each of several
+  // hypotheses, as batch elements, when the attention is over a batch of them
+  virtual bool SupportsBatchedDecoding() const;
+  // Called after a beam search step: hypothesis i now extends old hypothesis
+  // parents[i], so it takes over that hypothesis's state
+  virtual void SelectHypotheses(const vector<unsigned>& parents);
+  // The running state left by the last Notify (e.g. the coverage), so that a
+  // decoder that attends from one hypothesis at a time can keep one per
+  // hypothesis and put it back with SetState. Empty for stateless priors.
+  virtual Expression GetState() const;
+  virtual void SetState(const Expression& state);
 protected:
   Parameter p_weight;
   Expression weight;
@@ -44,9 +60,13 @@ public:
   explicit CoveragePrior(Model& model);
   void NewGraph(ComputationGraph& cg);
   void NewSentence(const InputSentence* input) override;
-  Expression Compute(const vector<Expression>& inputs, unsigned target_index) override;
-  Expression Compute(const vector<Expression>& inputs, const SyntaxTree* const tree, unsigned target_index) override;
+  Expression LogPotential(const vector<Expression>& inputs, unsigned target_index) override;
+  Expression LogPotential(const vector<Expression>& inputs, const SyntaxTree* const tree, unsigned target_index) override;
   void Notify(Expression attention_vector) override;
+  bool SupportsBatchedDecoding() const override;
+  void SelectHypotheses(const vector<unsigned>& parents) override;
+  Expression GetState() const override;
+  void SetState(const Expression& state) override;
 private:
   // TODO: Fertilities
   Expression coverage;
@@ -66,11 +86,15 @@ public:
   explicit DiagonalPrior(Model& model);
   void NewGraph(ComputationGraph& cg) override;
   void NewSentence(const InputSentence* input) override;
-  Expression Compute(const vector<Expression>& inputs, unsigned target_index) override;
-  Expression Compute(const vector<Expression>& inputs, const SyntaxTree* const tree, unsigned target_index) override;
+  Expression LogPotential(const vector<Expression>& inputs, unsigned target_index) override;
+  Expression LogPotential(const vector<Expression>& inputs, const SyntaxTree* const tree, unsigned target_index) override;
+  bool SupportsBatchedDecoding() const override;
 private:
   vector<float> source_percentages_v;
   Expression source_percentages;
+  // N x 1 ones, to broadcast the target position over the source
+  vector<float> source_ones_v;
+  Expression source_ones;
   Parameter p_length_ratio;
   Expression length_ratio;
 
@@ -89,9 +113,13 @@ public:
   explicit MarkovPrior(Model& model, unsigned window_size);
   void NewGraph(ComputationGraph& cg) override;
   void NewSentence(const InputSentence* input) override;
-  Expression Compute(const vector<Expression>& inputs, unsigned target_index) override;
+  Expression LogPotential(const vector<Expression>& inputs, unsigned target_index) override;
   // TODO: Implement for trees
   void Notify(Expression attention_vector) override;
+  bool SupportsBatchedDecoding() const override;
+  void SelectHypotheses(const vector<unsigned>& parents) override;
+  Expression GetState() const override;
+  void SetState(const Expression& state) override;
 
 private:
   Parameter p_filter;
@@ -115,7 +143,7 @@ public:
   explicit SyntaxPrior(Model& model);
   void NewGraph(ComputationGraph& cg) override;
   void NewSentence(const InputSentence* input) override;
-  Expression Compute(const vector<Expression>& inputs, const SyntaxTree* const tree, unsigned target_index) override;
+  Expression LogPotential(const vector<Expression>& inputs, const SyntaxTree* const tree, unsigned target_index) override;
   void Notify(Expression attention_vector) override;
   void Visit(const SyntaxTree* parent, vector<vector<Expression>>& node_log_probs);
 private:
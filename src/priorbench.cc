@@ -0,0 +1,114 @@
+#include "dynet/dynet.h"
+#include "dynet/expr.h"
+#include <boost/program_options.hpp>
+
+#include <chrono>
+#include <iostream>
+#include <random>
+
+#include "attention.h"
+#include "prior.h"
+#include "utils.h"
+
+using namespace dynet;
+using namespace dynet::expr;
+using namespace std;
+namespace po = boost::program_options;
+
+// Times the forward and backward passes of attention over a random source
+// sentence, with and without a Markov prior, and reports the cost per
+// target word of each.
+
+vector<vector<float>> RandomVectors(unsigned count, unsigned dim, mt19937& rng) {
+  normal_distribution<float> normal(0.0f, 1.0f);
+  vector<vector<float>> r(count, vector<float>(dim));
+  for (vector<float>& v : r) {
+    for (float& x : v) {
+      x = normal(rng);
+    }
+  }
+  return r;
+}
+
+// Returns the average time per target word in milliseconds
+double Benchmark(StandardAttentionModel& attention_model, const vector<vector<float>>& encodings, const vector<vector<float>>& states, unsigned trials) {
+  LinearSentence source;
+  source.resize(encodings.size());
+
+  double total_ms = 0.0;
+  for (unsigned trial = 0; trial < trials; ++trial) {
+    ComputationGraph cg;
+    attention_model.NewGraph(cg);
+    attention_model.NewSentence(&source);
+
+    vector<Expression> inputs(encodings.size());
+    for (unsigned i = 0; i < encodings.size(); ++i) {
+      inputs[i] = input(cg, {(unsigned)encodings[i].size()}, encodings[i]);
+    }
+
+    auto start = chrono::steady_clock::now();
+    vector<Expression> losses;
+    for (const vector<float>& s : states) {
+      Expression state = input(cg, {(unsigned)s.size()}, s);
+      Expression context = attention_model.GetContext(inputs, state);
+      losses.push_back(dot_product(context, context));
+    }
+    Expression loss = sum(losses);
+    cg.forward(loss);
+    cg.backward(loss);
+    auto end = chrono::steady_clock::now();
+    total_ms += chrono::duration<double, milli>(end - start).count();
+  }
+  return total_ms / (trials * states.size());
+}
+
+int main(int argc, char** argv) {
+  dynet::initialize(argc, argv);
+
+  po::options_description desc("description");
+  desc.add_options()
+  ("source_length,n", po::value<unsigned>()->default_value(50), "Number of source words")
+  ("target_length,t", po::value<unsigned>()->default_value(50), "Number of target words to attend for")
+  ("hidden_size,h", po::value<unsigned>()->default_value(64), "Size of hidden layers. The source encodings are twice this size, as with a bidirectional encoder")
+  ("markov_prior_window_size", po::value<unsigned>()->default_value(5), "Window size of the Markov prior")
+  ("trials", po::value<unsigned>()->default_value(20), "Number of times to time each configuration")
+  ("help", "Display this help message");
+
+  po::variables_map vm;
+  po::store(po::command_line_parser(argc, argv).options(desc).run(), vm);
+
+  if (vm.count("help")) {
+    cerr << desc;
+    return 1;
+  }
+
+  po::notify(vm);
+
+  const unsigned source_length = vm["source_length"].as<unsigned>();
+  const unsigned target_length = vm["target_length"].as<unsigned>();
+  const unsigned hidden_size = vm["hidden_size"].as<unsigned>();
+  const unsigned window_size = vm["markov_prior_window_size"].as<unsigned>();
+  const unsigned trials = vm["trials"].as<unsigned>();
+  const unsigned annotation_dim = 2 * hidden_size;
+
+  mt19937 rng(1);
+  vector<vector<float>> encodings = RandomVectors(source_length, annotation_dim, rng);
+  vector<vector<float>> states = RandomVectors(target_length, hidden_size, rng);
+
+  Model plain_model;
+  StandardAttentionModel plain(plain_model, annotation_dim, hidden_size, hidden_size, annotation_dim);
+  Model markov_model;
+  StandardAttentionModel markov(markov_model, annotation_dim, hidden_size, hidden_size, annotation_dim);
+  markov.AddPrior(new MarkovPrior(markov_model, window_size));
+
+  // Once each to warm up
+  Benchmark(plain, encodings, states, 1);
+  Benchmark(markov, encodings, states, 1);
+
+  const double plain_ms = Benchmark(plain, encodings, states, trials);
+  const double markov_ms = Benchmark(markov, encodings, states, trials);
+  cout << "Source length " << source_length << ", hidden size " << hidden_size << ", window size " << window_size << endl;
+  cout << "Plain attention: " << plain_ms << " ms per target word" << endl;
+  cout << "With Markov prior: " << markov_ms << " ms per target word (+" << 100.0 * (markov_ms - plain_ms) / plain_ms << "%)" << endl;
+  return 0;
+}
@@ -49,7 +49,7 @@ Expression ResidualModel::BuildGraph(const InputSentence* const source, const Ou
   Expression state = output_model->GetState();
   vector<Expression> losses(N);
   for (unsigned i = 0; i < N; ++i) {
-    const shared_ptr<Word> word = target->at(i);
+    const Word word = target->at(i);
     state = output_model->AddInput(word, source_embedding);
     Expression pred = mlp->Feed(concatenate({source_embedding, state}));
     Expression loss = square(pred - residuals[i]);
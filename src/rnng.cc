@@ -1,3 +1,4 @@
+#include <boost/functional/hash.hpp>
 #include "dynet/expr.h"
 #include "rnng.h"
 #include "utils.h"
@@ -93,6 +94,10 @@ void ParserBuilder::PerformShift(WordId wordid) {
   curr_state->terms.push_back(word);
   curr_state->stack.push_back(word);
   curr_state->is_open_paren.push_back(-1);
+
+  size_t signature = Action::kShift;
+  boost::hash_combine(signature, wordid);
+  curr_state->stack_signatures.push_back(signature);
 }
 
 void ParserBuilder::PerformNT(WordId ntid) {
@@ -103,6 +108,10 @@ void ParserBuilder::PerformNT(WordId ntid) {
   curr_state->stack_lstm_pointer = stack_lstm.state();
   curr_state->stack.push_back(nt_embedding);
   curr_state->is_open_paren.push_back(ntid);
+
+  size_t signature = Action::kNT;
+  boost::hash_combine(signature, ntid);
+  curr_state->stack_signatures.push_back(signature);
 }
 
 void ParserBuilder::PerformReduce() {
@@ -120,6 +129,13 @@ void ParserBuilder::PerformReduce() {
   unsigned nchildren = curr_state->is_open_paren.size() - last_nt_index - 1;
 
   vector<Expression> children(nchildren);
+  // The composed subtree's signature covers its nonterminal and its children, in order
+  size_t signature = curr_state->stack_signatures[last_nt_index];
+  for (unsigned i = last_nt_index + 1; i < curr_state->stack_signatures.size(); ++i) {
+    boost::hash_combine(signature, curr_state->stack_signatures[i]);
+  }
+  curr_state->stack_signatures.resize(last_nt_index);
+
   curr_state->is_open_paren.pop_back(); // nt symbol
   curr_state->stack.pop_back(); // nonterminal dummy
   curr_state->stack_lstm_pointer = stack_lstm.get_head(curr_state->stack_lstm_pointer);
@@ -136,6 +152,7 @@ void ParserBuilder::PerformReduce() {
   curr_state->stack_lstm_pointer = stack_lstm.state();
   curr_state->stack.push_back(composed);
   curr_state->is_open_paren.push_back(-1); // we just closed a paren at this position
+  curr_state->stack_signatures.push_back(signature);
 }
 
 ParserBuilder::ParserBuilder() : curr_state(nullptr) {}
@@ -219,12 +236,14 @@ void ParserBuilder::NewSentence() {
   curr_state->stack.clear();
   curr_state->terms.clear();
   curr_state->is_open_paren.clear();
+  curr_state->stack_signatures.clear();
   curr_state->nopen_parens = 0;
   curr_state->prev_action = {Action::kNone, 0};
 
   curr_state->terms.push_back(SOS_embedding);
   curr_state->stack.push_back(stack_guard);
   curr_state->is_open_paren.push_back(-1);
+  curr_state->stack_signatures.push_back(0);
 
   stack_lstm.start_new_sequence();
   assert (stack_lstm.state() == -1);
@@ -266,6 +285,15 @@ Expression ParserBuilder::GetActionDistribution(RNNPointer p, Expression state_v
   return adist;
 }
 
+size_t ParserBuilder::StateSignature(RNNPointer p) const {
+  assert (p >= 0 && (unsigned)p < prev_states.size());
+  const ParserState& state = prev_states[p];
+  size_t signature = boost::hash_range(state.stack_signatures.begin(), state.stack_signatures.end());
+  boost::hash_combine(signature, state.nopen_parens);
+  boost::hash_combine(signature, (unsigned)state.prev_action.type);
+  return signature;
+}
+
 RNNPointer ParserBuilder::state() const {
   return (RNNPointer)((int)prev_states.size() - 1);
 }
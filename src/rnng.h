@@ -41,6 +41,7 @@ struct ParserState {
   vector<Expression> stack; // variables representing subtree embeddings
   vector<Expression> terms; // generated terminals
   vector<int> is_open_paren; // -1 if no nonterminal has a parenthesis open, otherwise index of NT
+  vector<size_t> stack_signatures; // a hash of the structure of the subtree at each stack position
   unsigned nopen_parens;
   Action prev_action;
 
@@ -92,6 +93,9 @@ public:
   bool IsDone() const;
   bool IsDone(RNNPointer p) const;
 
+  // A hash of the structure of the stack, the number of open nonterminals and the previous action type
+  size_t StateSignature(RNNPointer p) const;
+
 protected:
   ComputationGraph* pcg;
   ParserState* curr_state;
@@ -5,9 +5,11 @@
 
 #include <iostream>
 #include <fstream>
+#include <sstream>
 
 #include "io.h"
 #include "utils.h"
+#include "worker_pool.h"
 
 using namespace dynet;
 using namespace std;
@@ -22,6 +24,7 @@ int main(int argc, char** argv) {
   ("input_source", po::value<string>()->required(), "input file source")
   ("samples,n", po::value<unsigned>()->default_value(1), "Number of samples per sentence")
   ("max_length", po::value<unsigned>()->default_value(100), "Maximum length of output sentences")
+  ("threads,j", po::value<unsigned>()->default_value(1), "Number of sentences to sample from in parallel. Each runs in its own forked process")
   ("help", "Display this help message");
 
   po::positional_options_description positional_options;
@@ -41,6 +44,7 @@ int main(int argc, char** argv) {
   string model_filename = vm["model"].as<string>();
   unsigned num_samples = vm["samples"].as<unsigned>();
   unsigned max_length = vm["max_length"].as<unsigned>();
+  unsigned threads = vm["threads"].as<unsigned>();
 
   InputReader* input_reader = nullptr;
   OutputReader* output_reader = nullptr;
@@ -51,21 +55,34 @@ int main(int argc, char** argv) {
   translator.SetDropout(0.0f);
 
   vector<InputSentence*> source_sentences = input_reader->Read(vm["input_source"].as<string>());
-  for (unsigned sentence_number = 0; sentence_number < source_sentences.size(); ++sentence_number) {
-    InputSentence* source = source_sentences[sentence_number];
+  // Forked workers would all start out with the same random state, so give
+  // each sentence its own seed instead. A single process doesn't draw the
+  // seed, so that its samples match a run without threads.
+  const unsigned seed_base = (threads > 1) ? (*rndeng)() : 0;
 
+  auto sample = [&](unsigned sentence_number, const string&) {
+    InputSentence* source = source_sentences[sentence_number];
+    if (threads > 1) {
+      rndeng->seed(seed_base + sentence_number);
+    }
     vector<pair<shared_ptr<OutputSentence>, float>> samples = translator.Sample(source, num_samples, max_length);
+    ostringstream out;
     for (auto scored_sample : samples) {
       auto& sample = get<0>(scored_sample);
       float score = get<1>(scored_sample);
       vector<string> words;
-      for (shared_ptr<Word> w : *sample) {
+      for (Word w : *sample) {
         words.push_back(output_reader->ToString(w));
       }
-      cout << sentence_number << " ||| " << boost::algorithm::join(words, " ") << " ||| " << score << endl;
+      out << sentence_number << " ||| " << boost::algorithm::join(words, " ") << " ||| " << score << endl;
     }
+    return out.str();
+  };
+  auto emit = [](unsigned sentence_number, const string& samples) {
+    cout << samples;
     cout.flush();
-  }
+  };
+  RunOrdered(source_sentences.size(), threads, sample, emit);
 
   return 0;
 }
@@ -0,0 +1,80 @@
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <string>
+#include "scorer.h"
+
+// Coverage is floored at this before taking its log, so that a source word
+// with no attention at all gets a large but finite penalty
+const float kMinCoverage = 1.0e-6f;
+
+HypothesisScorer::~HypothesisScorer() {}
+
+bool HypothesisScorer::NeedsCoverage() const {
+  return false;
+}
+
+WordBonusScorer::WordBonusScorer(float bonus) : bonus(bonus) {}
+
+double WordBonusScorer::Score(double log_prob, unsigned length, const vector<float>& coverage) const {
+  return log_prob + bonus * length;
+}
+
+double WordBonusScorer::UpperBound(double log_prob, unsigned length, const vector<float>& coverage, unsigned max_length) const {
+  // Each further word costs at most nothing, but earns the bonus,
+  // so a positive bonus is best case collected all the way to max_length.
+  const unsigned remaining = (max_length > length) ? max_length - length : 0;
+  return Score(log_prob, length, coverage) + max(0.0f, bonus) * remaining;
+}
+
+GnmtScorer::GnmtScorer(float alpha, float beta) : alpha(alpha), beta(beta) {
+  assert (alpha >= 0.0f);
+  assert (beta >= 0.0f);
+}
+
+bool GnmtScorer::NeedsCoverage() const {
+  return beta > 0.0f;
+}
+
+double GnmtScorer::LengthPenalty(unsigned length) const {
+  return pow((5.0 + length) / 6.0, alpha);
+}
+
+double GnmtScorer::CoveragePenalty(const vector<float>& coverage) const {
+  if (beta == 0.0f) {
+    return 0.0;
+  }
+
+  double penalty = 0.0;
+  for (float c : coverage) {
+    penalty += log(min(max(c, kMinCoverage), 1.0f));
+  }
+  return beta * penalty;
+}
+
+double GnmtScorer::Score(double log_prob, unsigned length, const vector<float>& coverage) const {
+  return log_prob / LengthPenalty(length) + CoveragePenalty(coverage);
+}
+
+double GnmtScorer::UpperBound(double log_prob, unsigned length, const vector<float>& coverage, unsigned max_length) const {
+  // The log prob can only go down as words are added, and since it's negative
+  // dividing it by the largest possible length penalty gives the best case.
+  // The coverage penalty is never positive.
+  return min(log_prob, 0.0) / LengthPenalty(max(length, max_length));
+}
+
+istream& operator>>(istream& in, EarlyStopping& early_stopping) {
+  string token;
+  in >> token;
+
+  if (token == "bound") {
+    early_stopping = kSafeBound;
+  }
+  else if (token == "best") {
+    early_stopping = kBestFinished;
+  }
+  else {
+    assert (false);
+  }
+  return in;
+}
@@ -0,0 +1,60 @@
+#pragma once
+#include <vector>
+#include <iostream>
+
+using namespace std;
+
+// Decides how beam search ranks hypotheses.
+// Hypotheses are described by their total log probability, their length
+// (not counting the final </s> of complete hypotheses), and, for scorers that
+// ask for it, their coverage: the total attention each source word has
+// received so far, summed over all target positions.
+class HypothesisScorer {
+public:
+  virtual ~HypothesisScorer();
+  virtual bool NeedsCoverage() const;
+
+  virtual double Score(double log_prob, unsigned length, const vector<float>& coverage) const = 0;
+
+  // An upper bound on the Score of any extension of the given hypothesis that
+  // is no more than max_length words long, whether it's complete or not.
+  // Beam search relies on this to prune safely, so it must never be too low.
+  // Implementations may assume that log probabilities are <= 0.
+  virtual double UpperBound(double log_prob, unsigned length, const vector<float>& coverage, unsigned max_length) const = 0;
+};
+
+// The log probability plus a fixed bonus per word
+class WordBonusScorer : public HypothesisScorer {
+public:
+  explicit WordBonusScorer(float bonus);
+  double Score(double log_prob, unsigned length, const vector<float>& coverage) const override;
+  double UpperBound(double log_prob, unsigned length, const vector<float>& coverage, unsigned max_length) const override;
+private:
+  float bonus;
+};
+
+// GNMT-style scoring (Wu et al., 2016): log_prob / lp(length) + cp(coverage), with
+// lp(length) = ((5 + length) / 6)^alpha
+// cp(coverage) = beta * sum_i log(min(coverage_i, 1))
+class GnmtScorer : public HypothesisScorer {
+public:
+  GnmtScorer(float alpha, float beta);
+  bool NeedsCoverage() const override;
+  double Score(double log_prob, unsigned length, const vector<float>& coverage) const override;
+  double UpperBound(double log_prob, unsigned length, const vector<float>& coverage, unsigned max_length) const override;
+
+  double LengthPenalty(unsigned length) const;
+  double CoveragePenalty(const vector<float>& coverage) const;
+private:
+  float alpha;
+  float beta;
+};
+
+// When to stop growing the beam before max_length.
+// kSafeBound stops once no live hypothesis can possibly outscore the K-best
+// complete ones, according to the scorer's UpperBound. kBestFinished stops as
+// soon as there are K complete hypotheses that score better than every live
+// one does right now. That's faster, but can miss hypotheses that would have
+// overtaken them later, e.g. with length normalization.
+enum EarlyStopping {kSafeBound, kBestFinished};
+istream& operator>>(istream& in, EarlyStopping& early_stopping);
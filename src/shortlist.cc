@@ -0,0 +1,81 @@
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <cassert>
+#include "shortlist.h"
+
+Shortlist::Shortlist(Dict& source_vocab, Dict& target_vocab, unsigned top_n) : source_vocab(source_vocab), target_vocab(target_vocab), top_n(top_n) {
+  for (unsigned i = 0; i < top_n && i < target_vocab.size(); ++i) {
+    frequent_words.push_back(i);
+  }
+}
+
+void Shortlist::LoadLexicalTable(const string& filename, unsigned translations_per_word) {
+  ifstream f(filename);
+  if (!f.is_open()) {
+    cerr << "Unable to open " << filename << " for reading." << endl;
+    assert (f.is_open());
+  }
+
+  unordered_map<WordId, vector<pair<float, WordId>>> scored;
+  unsigned line_number = 0;
+  for (string line; getline(f, line);) {
+    ++line_number;
+    vector<string> parts = strip(tokenize(strip(line), " "), true);
+    if (parts.size() == 0) {
+      continue;
+    }
+    if (parts.size() != 3) {
+      cerr << "Bad lexical table entry on line " << line_number << " of " << filename << ": " << line << endl;
+      assert (parts.size() == 3);
+    }
+    if (!source_vocab.contains(parts[0]) || !target_vocab.contains(parts[1])) {
+      continue;
+    }
+    scored[source_vocab.convert(parts[0])].push_back(make_pair(stof(parts[2]), target_vocab.convert(parts[1])));
+  }
+
+  translations.clear();
+  for (auto& entry : scored) {
+    vector<pair<float, WordId>>& candidates = entry.second;
+    unsigned n = min((unsigned)candidates.size(), translations_per_word);
+    partial_sort(candidates.begin(), candidates.begin() + n, candidates.end(), [](const pair<float, WordId>& a, const pair<float, WordId>& b) {
+      return a.first > b.first || (a.first == b.first && a.second < b.second);
+    });
+    vector<WordId>& best = translations[entry.first];
+    for (unsigned i = 0; i < n; ++i) {
+      best.push_back(candidates[i].second);
+    }
+  }
+}
+
+void Shortlist::LoadFrequentWords(const string& filename) {
+  ifstream f(filename);
+  if (!f.is_open()) {
+    cerr << "Unable to open " << filename << " for reading." << endl;
+    assert (f.is_open());
+  }
+
+  frequent_words.clear();
+  for (string line; getline(f, line) && frequent_words.size() < top_n;) {
+    const string word = strip(line);
+    if (word.length() > 0 && target_vocab.contains(word)) {
+      frequent_words.push_back(target_vocab.convert(word));
+    }
+  }
+}
+
+vector<unsigned> Shortlist::Candidates(const InputSentence* const source) const {
+  vector<unsigned> candidates(frequent_words.begin(), frequent_words.end());
+  const LinearSentence* sentence = dynamic_cast<const LinearSentence*>(source);
+  assert (sentence != nullptr);
+  for (const Word& word : *sentence) {
+    auto it = translations.find(word.id);
+    if (it != translations.end()) {
+      candidates.insert(candidates.end(), it->second.begin(), it->second.end());
+    }
+  }
+  sort(candidates.begin(), candidates.end());
+  candidates.erase(unique(candidates.begin(), candidates.end()), candidates.end());
+  return candidates;
+}
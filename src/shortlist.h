@@ -0,0 +1,39 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include "dynet/dict.h"
+#include "utils.h"
+
+using namespace std;
+using namespace dynet;
+
+// A vocabulary shortlist: the target words worth considering when translating
+// a given source sentence. This is the top_n most frequent target words plus,
+// for each word in the source, its most likely translations according to a
+// lexical translation table.
+class Shortlist {
+public:
+  Shortlist(Dict& source_vocab, Dict& target_vocab, unsigned top_n);
+
+  // Reads a lexical table with one "source target probability" entry per line
+  // (e.g. as written by utils/extract_lex_table.py) and keeps the best
+  // translations_per_word targets of each source word. Entries with words
+  // outside the model's vocabularies are ignored.
+  void LoadLexicalTable(const string& filename, unsigned translations_per_word);
+
+  // Reads the target vocabulary from most to least frequent, one word per line.
+  // Without this, the top_n words are taken to be those with the lowest ids,
+  // which holds when the model's vocabulary was read from a frequency sorted file.
+  void LoadFrequentWords(const string& filename);
+
+  // Returns the sorted, deduplicated candidate target word ids for source
+  vector<unsigned> Candidates(const InputSentence* const source) const;
+
+private:
+  Dict& source_vocab;
+  Dict& target_vocab;
+  unsigned top_n;
+  vector<WordId> frequent_words;
+  unordered_map<WordId, vector<WordId>> translations;
+};
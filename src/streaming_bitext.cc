@@ -0,0 +1,170 @@
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <algorithm>
+#include <numeric>
+#include <cassert>
+#include "streaming_bitext.h"
+
+namespace {
+// How many sentence pairs the background thread may read ahead of training
+const unsigned kQueueCapacity = 4096;
+
+void OpenShard(const string& filename, ifstream& f) {
+  f.open(filename);
+  if (!f.is_open()) {
+    cerr << "Unable to open " << filename << " for reading." << endl;
+    assert (f.is_open());
+  }
+}
+}
+
+StreamingBitext::StreamingBitext(const vector<string>& source_shards, const vector<string>& target_shards, InputReader* input_reader, OutputReader* output_reader, unsigned buffer_size, unsigned seed) :
+    source_shards(source_shards), target_shards(target_shards), input_reader(input_reader), output_reader(output_reader),
+    buffer_size(max(buffer_size, 1U)), seed(seed), sentence_count(0), finished(true), cancelled(false) {
+  if (source_shards.size() != target_shards.size()) {
+    cerr << "Got " << source_shards.size() << " source shards but " << target_shards.size() << " target shards" << endl;
+    assert (source_shards.size() == target_shards.size());
+  }
+  assert (source_shards.size() > 0);
+}
+
+StreamingBitext::~StreamingBitext() {
+  StopProducer();
+}
+
+void StreamingBitext::Scan() {
+  sentence_count = 0;
+  for (unsigned i = 0; i < source_shards.size(); ++i) {
+    ifstream source_file, target_file;
+    OpenShard(source_shards[i], source_file);
+    OpenShard(target_shards[i], target_file);
+    string source_line, target_line;
+    while (true) {
+      const bool have_source = (bool)getline(source_file, source_line);
+      const bool have_target = (bool)getline(target_file, target_line);
+      if (have_source != have_target) {
+        cerr << source_shards[i] << " and " << target_shards[i] << " have different numbers of lines" << endl;
+        assert (have_source == have_target);
+      }
+      if (!have_source) {
+        break;
+      }
+      delete input_reader->ReadSentence(source_line);
+      delete output_reader->ReadSentence(target_line);
+      sentence_count++;
+    }
+  }
+}
+
+unsigned StreamingBitext::size() const {
+  return sentence_count;
+}
+
+void StreamingBitext::StartEpoch(unsigned epoch) {
+  StopProducer();
+  finished = false;
+  cancelled = false;
+  producer = thread(&StreamingBitext::Produce, this, epoch);
+}
+
+vector<SentencePair> StreamingBitext::Next(unsigned n) {
+  vector<SentencePair> pairs;
+  unique_lock<mutex> lock(queue_mutex);
+  while (pairs.size() < n) {
+    queue_changed.wait(lock, [this] { return !queue.empty() || finished; });
+    if (queue.empty()) {
+      break;
+    }
+    while (!queue.empty() && pairs.size() < n) {
+      pairs.push_back(queue.front());
+      queue.pop_front();
+    }
+    queue_changed.notify_all();
+  }
+  return pairs;
+}
+
+void StreamingBitext::Free(vector<SentencePair>& pairs) {
+  for (SentencePair& pair : pairs) {
+    delete get<0>(pair);
+    delete get<1>(pair);
+  }
+  pairs.clear();
+}
+
+bool StreamingBitext::Push(const SentencePair& pair) {
+  unique_lock<mutex> lock(queue_mutex);
+  queue_changed.wait(lock, [this] { return queue.size() < kQueueCapacity || cancelled; });
+  if (cancelled) {
+    return false;
+  }
+  queue.push_back(pair);
+  queue_changed.notify_all();
+  return true;
+}
+
+void StreamingBitext::Produce(unsigned epoch) {
+  mt19937 rng(seed + epoch);
+  vector<unsigned> shard_order(source_shards.size());
+  iota(shard_order.begin(), shard_order.end(), 0);
+  shuffle(shard_order.begin(), shard_order.end(), rng);
+
+  // Once the buffer is full, each new pair takes the place of a random one,
+  // which goes out to training
+  vector<SentencePair> buffer;
+  buffer.reserve(buffer_size);
+  bool ok = true;
+  for (unsigned i = 0; i < shard_order.size() && ok; ++i) {
+    ifstream source_file, target_file;
+    OpenShard(source_shards[shard_order[i]], source_file);
+    OpenShard(target_shards[shard_order[i]], target_file);
+    string source_line, target_line;
+    while (ok && getline(source_file, source_line) && getline(target_file, target_line)) {
+      SentencePair pair = make_pair(input_reader->ReadSentence(source_line), output_reader->ReadSentence(target_line));
+      if (buffer.size() < buffer_size) {
+        buffer.push_back(pair);
+        continue;
+      }
+      unsigned j = uniform_int_distribution<unsigned>(0, buffer.size() - 1)(rng);
+      ok = Push(buffer[j]);
+      if (ok) {
+        buffer[j] = pair;
+      }
+      else {
+        buffer.push_back(pair);
+      }
+    }
+  }
+
+  unsigned pushed = 0;
+  if (ok) {
+    shuffle(buffer.begin(), buffer.end(), rng);
+    while (pushed < buffer.size() && Push(buffer[pushed])) {
+      pushed++;
+    }
+  }
+  // Whatever didn't make it into the queue is still ours
+  vector<SentencePair> leftover(buffer.begin() + pushed, buffer.end());
+  Free(leftover);
+
+  lock_guard<mutex> lock(queue_mutex);
+  finished = true;
+  queue_changed.notify_all();
+}
+
+void StreamingBitext::StopProducer() {
+  if (!producer.joinable()) {
+    return;
+  }
+  {
+    lock_guard<mutex> lock(queue_mutex);
+    cancelled = true;
+  }
+  queue_changed.notify_all();
+  producer.join();
+
+  vector<SentencePair> leftover(queue.begin(), queue.end());
+  queue.clear();
+  Free(leftover);
+}
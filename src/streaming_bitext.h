@@ -0,0 +1,56 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "io.h"
+
+using namespace std;
+
+// Training data that is read from disk as it's needed instead of being held
+// in memory. The corpus is given as one or more pairs of shard files, which
+// are read one line at a time by a background thread. Each epoch visits the
+// shards in a random order and shuffles sentence pairs within a buffer of
+// buffer_size, so memory use doesn't depend on the size of the corpus.
+class StreamingBitext {
+public:
+  StreamingBitext(const vector<string>& source_shards, const vector<string>& target_shards, InputReader* input_reader, OutputReader* output_reader, unsigned buffer_size, unsigned seed);
+  ~StreamingBitext();
+
+  // Reads every shard once, adding their words to the readers' vocabularies
+  // and counting the sentence pairs. Call this, then freeze the readers,
+  // before the first epoch.
+  void Scan();
+  unsigned size() const;
+
+  // Starts reading the given epoch in the background
+  void StartEpoch(unsigned epoch);
+  // Returns up to n of the current epoch's sentence pairs, blocking until
+  // they're ready. Returns an empty vector once the epoch is over.
+  // The caller owns the returned sentences, and should Free them.
+  vector<SentencePair> Next(unsigned n);
+  static void Free(vector<SentencePair>& pairs);
+
+private:
+  void Produce(unsigned epoch);
+  // Returns false if the producer should stop
+  bool Push(const SentencePair& pair);
+  void StopProducer();
+
+  vector<string> source_shards;
+  vector<string> target_shards;
+  InputReader* input_reader;
+  OutputReader* output_reader;
+  unsigned buffer_size;
+  unsigned seed;
+  unsigned sentence_count;
+
+  thread producer;
+  mutex queue_mutex;
+  condition_variable queue_changed;
+  deque<SentencePair> queue;
+  bool finished;
+  bool cancelled;
+};
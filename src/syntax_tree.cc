@@ -5,7 +5,7 @@
 
 SyntaxTree::SyntaxTree() : word_dict(nullptr), label_dict(nullptr), label_(-1), id_(-1) {}
 
-SyntaxTree::SyntaxTree(string tree, Dict* word_dict, Dict* label_dict) : word_dict(word_dict), label_dict(label_dict), id_(-1) {
+SyntaxTree::SyntaxTree(boost::string_ref tree, Dict* word_dict, Dict* label_dict) : word_dict(word_dict), label_dict(label_dict), label_(-1), id_(-1) {
   // Sometimes Berkeley parser fails to parse a sentence and just outputs ()
   if (tree == "()") {
     return;
@@ -15,19 +15,20 @@ SyntaxTree::SyntaxTree(string tree, Dict* word_dict, Dict* label_dict) : word_di
 
   // If we have a terminal
   if (tree.length() == 0 || tree[0] != '(') {
-    assert (tree.find("(") == string::npos);
-    assert (tree.find(")") == string::npos);
-    assert (tree.find(" ") == string::npos);
-    label_ = word_dict->convert(tree);
+    assert (tree.find('(') == boost::string_ref::npos);
+    assert (tree.find(')') == boost::string_ref::npos);
+    assert (tree.find(' ') == boost::string_ref::npos);
+    label_ = ConvertWord(*word_dict, tree);
   }
   else {
     assert (tree[tree.length() - 1] == ')');
-    unsigned first_space = tree.find(" ");
-    assert (first_space != string::npos);
+    size_t first_space = tree.find(' ');
+    assert (first_space != boost::string_ref::npos);
     assert (first_space != 1);
-    label_ = label_dict->convert(tree.substr(1, first_space - 1));
+    label_ = ConvertWord(*label_dict, tree.substr(1, first_space - 1));
 
-    vector<string> child_strings;
+    // Children are views into tree, so nothing is copied until the leaves are looked up
+    vector<boost::string_ref> child_strings;
     unsigned start = first_space + 1;
     unsigned i = start;
     unsigned open_parens = 0;
@@ -56,8 +57,9 @@ SyntaxTree::SyntaxTree(string tree, Dict* word_dict, Dict* label_dict) : word_di
       child_strings.push_back(tree.substr(start, end - start + 1));
     }
 
-    for (string child_string : child_strings) {
-      children.push_back(SyntaxTree(child_string, word_dict, label_dict));
+    children.reserve(child_strings.size());
+    for (boost::string_ref child_string : child_strings) {
+      children.emplace_back(child_string, word_dict, label_dict);
     }
     assert (children.size() > 0);
   }
@@ -143,7 +145,7 @@ unsigned SyntaxTree::id() const {
 LinearSentence SyntaxTree::GetTerminals() const {
   LinearSentence terminals;
   if (IsTerminal()) {
-    terminals.push_back(make_shared<StandardWord>(label_));
+    terminals.push_back(Word(label_));
     return terminals;
   }
   else {
@@ -177,6 +179,18 @@ unsigned SyntaxTree::AssignNodeIds(unsigned start) {
   return start + 1;
 }
 
+void SyntaxTree::Remap(const vector<WordId>& word_ids, const vector<WordId>& label_ids, Dict* new_word_dict, Dict* new_label_dict) {
+  word_dict = new_word_dict;
+  label_dict = new_label_dict;
+  // Trees that failed to parse have no label
+  if (label_ != -1) {
+    label_ = IsTerminal() ? word_ids[label_] : label_ids[label_];
+  }
+  for (SyntaxTree& child : children) {
+    child.Remap(word_ids, label_ids, new_word_dict, new_label_dict);
+  }
+}
+
 SyntaxTreeIterator SyntaxTree::begin(TreeIterationOrder order) const {
   SyntaxTree* nonconst_this = const_cast<SyntaxTree*>(this);
   assert (nonconst_this != nullptr);
@@ -30,7 +30,7 @@ private:
 class SyntaxTree : public InputSentence {
 public:
   SyntaxTree();
-  SyntaxTree(string tree, Dict* word_dict, Dict* label_dict);
+  SyntaxTree(boost::string_ref tree, Dict* word_dict, Dict* label_dict);
 
   bool IsTerminal() const;
   unsigned NumChildren() const;
@@ -47,6 +47,9 @@ public:
 
   string ToString() const;
   unsigned AssignNodeIds(unsigned start = 0);
+  // Replaces each terminal's id i with word_ids[i] and each nonterminal's
+  // with label_ids[i], and makes the tree refer to the new dicts
+  void Remap(const vector<WordId>& word_ids, const vector<WordId>& label_ids, Dict* word_dict, Dict* label_dict);
 
   SyntaxTreeIterator begin(TreeIterationOrder order) const;
   SyntaxTreeIterator end() const;
@@ -0,0 +1,49 @@
+#include <algorithm>
+#include <limits>
+#include "topk.h"
+
+namespace {
+// Orders (score, index) pairs best first: higher score, then lower index.
+// Used as the heap comparator this keeps the worst survivor at the front.
+inline bool Better(const pair<float, unsigned>& a, const pair<float, unsigned>& b) {
+  return a.first > b.first || (a.first == b.first && a.second < b.second);
+}
+}
+
+vector<pair<float, unsigned>> TopK(const float* scores, unsigned n, unsigned k) {
+  vector<pair<float, unsigned>> heap;
+  if (k == 0) {
+    return heap;
+  }
+  heap.reserve(k);
+
+  const float masked = kMaskedScore / 2;
+  unsigned i = 0;
+  for (; i < n && heap.size() < k; ++i) {
+    if (scores[i] > masked) {
+      heap.push_back(make_pair(scores[i], i));
+      push_heap(heap.begin(), heap.end(), Better);
+    }
+  }
+
+  // Once the heap is full almost every candidate is rejected by this single
+  // comparison against the current threshold, so the loop stays branch-cheap.
+  // Later indices lose ties, so only strictly better scores get in.
+  float threshold = heap.size() > 0 ? heap.front().first : masked;
+  for (; i < n; ++i) {
+    if (scores[i] <= threshold) {
+      continue;
+    }
+    pop_heap(heap.begin(), heap.end(), Better);
+    heap.back() = make_pair(scores[i], i);
+    push_heap(heap.begin(), heap.end(), Better);
+    threshold = heap.front().first;
+  }
+
+  sort_heap(heap.begin(), heap.end(), Better);
+  return heap;
+}
+
+vector<pair<float, unsigned>> TopK(const vector<float>& scores, unsigned k) {
+  return TopK(scores.data(), scores.size(), k);
+}
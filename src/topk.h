@@ -0,0 +1,18 @@
+#pragma once
+#include <vector>
+#include <limits>
+#include <utility>
+
+using namespace std;
+
+// Returns the (at most) k highest scoring entries of scores[0..n) as
+// (score, index) pairs, best first. Ties go to the lower index.
+// Entries scored kMaskedScore (or anything at or below half of it, which
+// includes -inf) are never returned, so callers can use that to mask out
+// candidates. Nothing is allocated beyond the k-element result.
+// A finite sentinel, since -Ofast lets the compiler assume there are no
+// infinities and fold away comparisons against them
+const float kMaskedScore = -numeric_limits<float>::max();
+
+vector<pair<float, unsigned>> TopK(const float* scores, unsigned n, unsigned k);
+vector<pair<float, unsigned>> TopK(const vector<float>& scores, unsigned k);
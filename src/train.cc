@@ -221,8 +221,15 @@ AttentionModel* CreateAttentionModel(const po::variables_map& vm, Model& dynet_m
   const unsigned alignment_hidden_dim = hidden_size;
   const unsigned output_state_dim = hidden_size;
 
-  if (!vm.count("sparsemax")) {
-    attention_model = new StandardAttentionModel(dynet_model, annotation_dim, output_state_dim, alignment_hidden_dim, key_size);
+  if (vm.count("local_attention")) {
+    const unsigned window = vm["local_attention"].as<unsigned>();
+    attention_model = new LocalAttentionModel(dynet_model, annotation_dim, output_state_dim, alignment_hidden_dim, key_size, window, vm.count("predict_center") > 0, vm.count("fused_attention") > 0);
+  }
+  else if (vm.count("bilinear_attention")) {
+    attention_model = new BilinearAttentionModel(dynet_model, annotation_dim, output_state_dim, key_size);
+  }
+  else if (!vm.count("sparsemax")) {
+    attention_model = new StandardAttentionModel(dynet_model, annotation_dim, output_state_dim, alignment_hidden_dim, key_size, vm.count("fused_attention") > 0);
   }
   else {
     attention_model = new SparsemaxAttentionModel(dynet_model, annotation_dim, output_state_dim, alignment_hidden_dim, key_size);
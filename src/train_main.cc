@@ -1,6 +1,8 @@
 #include <chrono>
 #include "train.h"
 #include "train_wrapper.h"
+#include "parallel_reader.h"
+#include "mapped_model.h"
 
 using namespace dynet;
 using namespace dynet::expr;
@@ -34,12 +36,21 @@ int main(int argc, char** argv) {
   ("root_vocab", po::value<string>()->default_value(""), "Target root vocabulary file. Only used with the morphological output type")
   ("clusters,c", po::value<string>()->default_value(""), "Target vocabulary clusters file")
   ("root_clusters", po::value<string>()->default_value(""), "Target root vocabulary clusters file")
-  ("cores,j", po::value<unsigned>()->default_value(1), "Number of CPU cores to use for training")
+  ("cores,j", po::value<unsigned>()->default_value(1), "Number of CPU cores to use for training. Each core runs a worker process that trains on its own sentences and updates the shared model without locking")
+  ("fork_per_slice", "With > 1 core, use DyNet's multiprocessing trainer, which forks new workers for every r examples, instead of keeping the same workers around. Mostly useful for comparing their speed")
+  ("read_threads", po::value<unsigned>()->default_value(0), "Number of threads to use when loading the training and dev sets. 0 means one per core. The vocabularies come out the same no matter how many are used")
+  ("stream", "Read the training data from disk as it's needed instead of loading it all into memory. train_source and train_target may then be comma-separated lists of shard files. Only standard source and target types are supported, on one core")
+  ("shuffle_buffer", po::value<unsigned>()->default_value(100000), "With --stream, the number of sentence pairs that training data is shuffled within")
+  ("stream_window", po::value<unsigned>()->default_value(10000), "With --stream and minibatches, the number of sentence pairs that are sorted by length and split into minibatches together")
 
   ("peepconcat", "Concatenate the raw word vectors to the output of the encoder")
   ("peepadd", "Add the raw word vectors to the output of the encoder")
   ("key_size", po::value<unsigned>(), "Number of annotation dimensions to use to compute attention. Default is to use the whole annotation vector.")
   ("sparsemax", "Use Sparsemax (rather than Softmax) for computing attention")
+  ("bilinear_attention", "Use multiplicative attention, scoring each source word x against the state s as s^T W x, instead of an MLP. Cheaper at each step, but usually a little less accurate")
+  ("local_attention", po::value<unsigned>(), "Use local attention, only scoring the source words within this many positions of a center that moves along the source. Makes each step's cost independent of the source length")
+  ("predict_center", "With --local_attention, predict each step's center from the decoder state, instead of moving it monotonically at a learned rate")
+  ("fused_attention", "Compute the attention scores and their softmax in one vectorized node, using an approximate tanh. Faster on long sentences. Has no effect with --sparsemax")
   ("no_encoder_rnn", "Use raw word vectors instead of bidirectional RNN to encode")
   ("no_final_mlp", "Do not use an MLP between the attentional context vector and final softmax")
   ("diagonal_prior", "Use diagonal prior on attention")
@@ -53,9 +64,13 @@ int main(int argc, char** argv) {
   ("dropout_rate", po::value<float>()->default_value(0.0f), "Dropout rate (should be >= 0.0 and < 1)")
   ("num_iterations,i", po::value<unsigned>()->default_value(UINT_MAX), "Number of epochs to train for")
   ("quiet,q", "Don't output model at all (useful during debugging)")
-  ("batch_size,b", po::value<unsigned>()->default_value(1), "Batch size (has no effect when using > 1 core)")
+  ("batch_size,b", po::value<unsigned>()->default_value(1), "Maximum number of sentence pairs per minibatch. Each minibatch is built as a single batched graph and gets one update. Sentences are grouped by length. Has no effect when using > 1 core")
+  ("max_tokens", po::value<unsigned>()->default_value(0), "Maximum number of source plus target tokens per minibatch, counting padding. 0 means no limit. Has no effect when using > 1 core")
+  ("shuffle_seed", po::value<unsigned>(), "Seed for the order of minibatches. By default it's drawn from DyNet's random number generator")
   ("report_frequency,r", po::value<unsigned>()->default_value(100), "Show the training loss of every r examples")
   ("dev_frequency,d", po::value<unsigned>()->default_value(10000), "Run the dev set every d examples. Save the model if the score is a new best")
+  ("checkpoint_prefix", po::value<string>(), "Save a checkpoint to prefix.1, prefix.2, ... after every dev run, and the best so far to prefix.best, in the background instead of writing the best model to stdout")
+  ("keep_checkpoints", po::value<unsigned>()->default_value(3), "Number of recent checkpoints to keep when using --checkpoint_prefix, not counting the best one")
   ("model", po::value<string>(), "Reload this model and continue learning");
 
   AddTrainerOptions(desc);
@@ -74,6 +89,8 @@ int main(int argc, char** argv) {
     return 1;
   }
 
+  SetReadThreads(vm["read_threads"].as<unsigned>());
+
   Model dynet_model;
   InputReader* input_reader = nullptr;
   OutputReader* output_reader = nullptr;
@@ -82,9 +99,16 @@ int main(int argc, char** argv) {
 
   if (vm.count("model")) {
     string model_filename = vm["model"].as<string>();
+    // A mapped model's parameters and gradients are private copy-on-write
+    // mappings, so updates made by forked workers would never be shared
+    if (IsMappedModel(model_filename)) {
+      cerr << model_filename << " is a mapped model, which can't be trained. Convert it with convert_model --archive --keep_trainer first." << endl;
+      return 1;
+    }
     translator = new Translator();
     Deserialize(model_filename, input_reader, output_reader, *translator, dynet_model, trainer);
-    if (vm.count("sgd") || vm.count("adagrad") || vm.count("adam") || vm.count("rmsprop") || vm.count("momentum")) {
+    // Models converted without --keep_trainer have no trainer
+    if (trainer == nullptr || vm.count("sgd") || vm.count("adagrad") || vm.count("adam") || vm.count("rmsprop") || vm.count("momentum")) {
       trainer = CreateTrainer(dynet_model, vm);
     }
   }
@@ -95,7 +119,26 @@ int main(int argc, char** argv) {
 
   const string train_source_filename = vm["train_source"].as<string>();
   const string train_target_filename = vm["train_target"].as<string>();
-  Bitext train_bitext = ReadBitext(train_source_filename, train_target_filename, input_reader, output_reader);
+  Bitext train_bitext;
+  StreamingBitext* train_stream = nullptr;
+  if (vm.count("stream")) {
+    if (vm["cores"].as<unsigned>() > 1) {
+      cerr << "--stream only supports training on one core" << endl;
+      return 1;
+    }
+    // The stream is read a line at a time, which only the standard readers can do
+    if (dynamic_cast<StandardInputReader*>(input_reader) == nullptr || dynamic_cast<StandardOutputReader*>(output_reader) == nullptr) {
+      cerr << "--stream requires standard input and standard output" << endl;
+      return 1;
+    }
+    const unsigned seed = vm.count("shuffle_seed") ? vm["shuffle_seed"].as<unsigned>() : (*rndeng)();
+    train_stream = new StreamingBitext(tokenize(train_source_filename, ","), tokenize(train_target_filename, ","), input_reader, output_reader, vm["shuffle_buffer"].as<unsigned>(), seed);
+    train_stream->Scan();
+    cerr << "Streaming " << train_stream->size() << " training sentence pairs" << endl;
+  }
+  else {
+    train_bitext = ReadBitext(train_source_filename, train_target_filename, input_reader, output_reader);
+  }
   input_reader->Freeze();
   output_reader->Freeze();
 
@@ -116,11 +159,23 @@ int main(int argc, char** argv) {
 
   const float dropout_rate = vm["dropout_rate"].as<float>();
   const bool quiet = vm.count("quiet");
-  Learner learner(input_reader, output_reader, *translator, dynet_model, trainer, dropout_rate, quiet);
+  Checkpointer* checkpointer = nullptr;
+  if (vm.count("checkpoint_prefix")) {
+    const unsigned keep_checkpoints = vm["keep_checkpoints"].as<unsigned>();
+    if (keep_checkpoints == 0) {
+      cerr << "--keep_checkpoints must be at least 1" << endl;
+      return 1;
+    }
+    checkpointer = new Checkpointer(vm["checkpoint_prefix"].as<string>(), keep_checkpoints);
+  }
+  Learner learner(input_reader, output_reader, *translator, dynet_model, trainer, dropout_rate, quiet, checkpointer);
 
-  wrapper = new TrainingWrapper(train_bitext, dev_bitext, trainer, &learner);
+  wrapper = new TrainingWrapper(train_bitext, dev_bitext, trainer, &learner, train_stream);
   signal (SIGINT, [](int) { cerr << "ctrl-c pressed. Stopping..." << endl; wrapper->Stop(); } );
   wrapper->Train(vm);
 
+  // Wait for any checkpoints still being written
+  delete checkpointer;
+  delete train_stream;
   return 0;
 }
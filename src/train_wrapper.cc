@@ -1,6 +1,7 @@
 #include <iostream>
 #include <chrono>
 #include "train_wrapper.h"
+#include "hogwild.h"
 
 using namespace std;
 
@@ -29,8 +30,8 @@ std::ostream& operator<< (std::ostream& stream, const SufficientStats& stats) {
   return stream << exp(stats.loss / stats.word_count) << " (" << stats.loss << " over " << stats.word_count << " words)";
 }
 
-Learner::Learner(const InputReader* const input_reader, const OutputReader* const output_reader, Translator& translator, Model& dynet_model, const Trainer* const trainer, float dropout_rate, bool quiet) :
-  input_reader(input_reader), output_reader(output_reader), translator(translator), dynet_model(dynet_model), trainer(trainer), dropout_rate(dropout_rate), quiet(quiet) {}
+Learner::Learner(const InputReader* const input_reader, const OutputReader* const output_reader, Translator& translator, Model& dynet_model, const Trainer* const trainer, float dropout_rate, bool quiet, Checkpointer* checkpointer) :
+  input_reader(input_reader), output_reader(output_reader), translator(translator), dynet_model(dynet_model), trainer(trainer), dropout_rate(dropout_rate), quiet(quiet), checkpointer(checkpointer) {}
 
 Learner::~Learner() {}
 
@@ -50,52 +51,236 @@ SufficientStats Learner::LearnFromDatum(const SentencePair& datum, bool learn) {
   return SufficientStats(loss, output->size(), 1);
 }
 
+SufficientStats Learner::LearnFromBatch(const vector<SentencePair>& batch, bool learn) {
+  if (!translator.SupportsBatchedTraining()) {
+    SufficientStats stats;
+    for (const SentencePair& datum : batch) {
+      stats += LearnFromDatum(datum, learn);
+    }
+    return stats;
+  }
+
+  ComputationGraph cg;
+  vector<const InputSentence*> inputs(batch.size());
+  vector<const OutputSentence*> outputs(batch.size());
+  unsigned word_count = 0;
+  for (unsigned i = 0; i < batch.size(); ++i) {
+    inputs[i] = get<0>(batch[i]);
+    outputs[i] = get<1>(batch[i]);
+    word_count += outputs[i]->size();
+  }
+
+  translator.SetDropout(learn ? dropout_rate : 0.0f);
+  Expression loss_expr = translator.BuildBatchGraph(inputs, outputs, cg);
+  dynet::real loss = as_scalar(loss_expr.value());
+
+  if (learn) {
+    cg.backward(loss_expr);
+  }
+
+  return SufficientStats(loss, word_count, batch.size());
+}
+
 void Learner::SaveModel() {
-  if (!quiet) {
+  SaveCheckpoint(true);
+}
+
+void Learner::SaveCheckpoint(bool best) {
+  if (quiet) {
+    return;
+  }
+  if (checkpointer != nullptr) {
+    checkpointer->Save(input_reader, output_reader, translator, dynet_model, trainer, best);
+  }
+  else if (best) {
     Serialize(input_reader, output_reader, translator, dynet_model, trainer);
   }
 }
 
 
-TrainingWrapper::TrainingWrapper(const Bitext& train_bitext, const Bitext& dev_bitext, Trainer* trainer, Learner* learner) :
+TrainingWrapper::TrainingWrapper(const Bitext& train_bitext, const Bitext& dev_bitext, Trainer* trainer, Learner* learner, StreamingBitext* train_stream) :
     train_bitext(train_bitext), dev_bitext(dev_bitext), trainer(trainer), learner(learner),
-    epoch(0), data_processed(0), sents_since_dev(0), first_dev_run(true), stop(false) {}
+    train_scheduler(nullptr), dev_scheduler(nullptr), hogwild(nullptr), train_stream(train_stream), epoch(0), data_processed(0), sents_since_dev(0), first_dev_run(true), stop(false) {}
 
 void TrainingWrapper::Train(const po::variables_map& vm) {
   const unsigned num_cores = vm["cores"].as<unsigned>();
   const unsigned num_epochs = vm["num_iterations"].as<unsigned>();
-  //const unsigned batch_size = vm["batch_size"].as<unsigned>(); // TODO: Currently unused
+  const unsigned batch_size = vm["batch_size"].as<unsigned>();
+  const unsigned max_tokens = vm["max_tokens"].as<unsigned>();
   const unsigned dev_frequency = vm["dev_frequency"].as<unsigned>();
   const unsigned report_frequency = vm["report_frequency"].as<unsigned>();
 
+  bool batched = (batch_size > 1 || max_tokens > 0);
+  if (batched && num_cores > 1) {
+    cerr << "Warning: --batch_size and --max_tokens have no effect when using > 1 core" << endl;
+    batched = false;
+  }
+  const unsigned seed = vm.count("shuffle_seed") ? vm["shuffle_seed"].as<unsigned>() : (*rndeng)();
+  const unsigned max_sentences = (batch_size > 1) ? batch_size : UINT_MAX;
+  if (batched) {
+    if (train_stream == nullptr) {
+      train_scheduler = new BatchScheduler(train_bitext, max_sentences, max_tokens, seed);
+    }
+    dev_scheduler = new BatchScheduler(dev_bitext, max_sentences, max_tokens, seed);
+    cerr << "Dev set: " << dev_scheduler->ComputePaddingStats(dev_scheduler->Batches(0)) << endl;
+  }
+  else if (num_cores > 1 && !vm.count("fork_per_slice")) {
+    hogwild = new HogwildTrainer(num_cores, learner, trainer, train_bitext, dev_bitext);
+  }
+
   for (epoch = 0; epoch < num_epochs && !stop; ++epoch) {
-    vector<unsigned> train_order = GenerateOrder(train_bitext.size());
     InitializeEpoch();
-    for (unsigned start = 0; start < train_bitext.size() && !stop; start += report_frequency) {
-      unsigned end = std::min((unsigned)train_bitext.size(), start + report_frequency);
-      vector<SentencePair> train_slice(train_bitext.begin() + start, train_bitext.begin() + end);
+    if (train_stream != nullptr) {
+      TrainStreamingEpoch(batched, max_sentences, max_tokens, seed, vm["stream_window"].as<unsigned>(), report_frequency, dev_frequency);
+    }
+    else if (batched) {
+      TrainBatchedEpoch(report_frequency, dev_frequency);
+    }
+    else {
+      TrainEpoch(num_cores, report_frequency, dev_frequency);
+    }
+    if (!stop) {
+      FinalizeEpoch();
+    }
+  }
+
+  delete hogwild;
+  hogwild = nullptr;
+}
+
+// Without batching, the gradients of each report_frequency sentences are
+// accumulated and applied at once, unless the Hogwild workers are in use
+void TrainingWrapper::TrainEpoch(unsigned num_cores, unsigned report_frequency, unsigned dev_frequency) {
+  vector<unsigned> train_order = GenerateOrder(train_bitext.size());
+  for (unsigned start = 0; start < train_bitext.size() && !stop; start += report_frequency) {
+    unsigned end = std::min((unsigned)train_bitext.size(), start + report_frequency);
+    vector<unsigned> slice_indices(train_order.begin() + start, train_order.begin() + end);
+
+    time_point start_time = GetTime();
+    SufficientStats stats;
+    if (hogwild != nullptr) {
+      // The workers do their own updates
+      stats = hogwild->Run(slice_indices, false, true, epoch);
+    }
+    else {
+      vector<SentencePair> train_slice(slice_indices.size());
+      for (unsigned i = 0; i < slice_indices.size(); ++i) {
+        train_slice[i] = train_bitext[slice_indices[i]];
+      }
+      stats = RunSlice(train_slice, num_cores, true);
+      trainer->update(1.0);
+    }
+    time_point end_time = GetTime();
+    double seconds_elapsed = GetSeconds(start_time, end_time);
 
-      time_point start_time = GetTime();
-      SufficientStats stats = RunSlice(train_slice, num_cores, true);
-      time_point end_time = GetTime();
-      double seconds_elapsed = GetSeconds(start_time, end_time);
+    data_processed = end;
+    Report(epoch, end, stats, seconds_elapsed);
+    if (hogwild != nullptr) {
+      hogwild->ReportThroughput(cerr);
+    }
 
-      data_processed = end;
-      Report(epoch, end, stats, seconds_elapsed);
+    epoch_stats += stats;
 
-      epoch_stats += stats;
+    sents_since_dev += slice_indices.size();
+    if (sents_since_dev > dev_frequency) {
+      RunDevSet(num_cores);
+      sents_since_dev = 0;
+    }
+  }
+}
+
+// With batching, every batch gets its own update, and the loss is reported
+// after each batch that brings the total past report_frequency sentences
+void TrainingWrapper::TrainBatchedEpoch(unsigned report_frequency, unsigned dev_frequency) {
+  vector<vector<unsigned>> batches = train_scheduler->Batches(epoch);
+  cerr << "Epoch " << epoch + 1 << ": " << train_scheduler->ComputePaddingStats(batches) << endl;
+
+  for (unsigned next = 0; next < batches.size() && !stop;) {
+    SufficientStats stats;
+    time_point start_time = GetTime();
+    while (next < batches.size() && stats.sentence_count < report_frequency && !stop) {
+      stats += learner->LearnFromBatch(train_scheduler->Gather(batches[next++]), true);
       trainer->update(1.0);
+    }
+    time_point end_time = GetTime();
+    double seconds_elapsed = GetSeconds(start_time, end_time);
+
+    data_processed += stats.sentence_count;
+    Report(epoch, data_processed, stats, seconds_elapsed);
+    epoch_stats += stats;
 
-      sents_since_dev += train_slice.size();
-      if (sents_since_dev > dev_frequency) {
-        RunDevSet(num_cores);
-        sents_since_dev = 0;
+    sents_since_dev += stats.sentence_count;
+    if (sents_since_dev > dev_frequency) {
+      RunDevSet(1);
+      sents_since_dev = 0;
+    }
+  }
+}
+
+// When streaming, training data arrives in windows of window_size sentence
+// pairs. With batching, each window is split into length-sorted batches, each
+// with its own update. Otherwise each window is one report_frequency slice,
+// just like TrainEpoch.
+void TrainingWrapper::TrainStreamingEpoch(bool batched, unsigned max_sentences, unsigned max_tokens, unsigned seed, unsigned window_size, unsigned report_frequency, unsigned dev_frequency) {
+  train_stream->StartEpoch(epoch);
+  if (!batched) {
+    window_size = report_frequency;
+  }
+
+  SufficientStats stats;
+  time_point start_time = GetTime();
+  while (!stop) {
+    vector<SentencePair> window = train_stream->Next(window_size);
+    if (window.empty()) {
+      break;
+    }
+
+    if (batched) {
+      BatchScheduler scheduler(window, max_sentences, max_tokens, seed + data_processed);
+      for (const vector<unsigned>& batch : scheduler.Batches(epoch)) {
+        if (stop) {
+          break;
+        }
+        stats += learner->LearnFromBatch(scheduler.Gather(batch), true);
+        trainer->update(1.0);
+        if (stats.sentence_count >= report_frequency) {
+          FinishReportPeriod(stats, start_time, dev_frequency);
+        }
       }
     }
-    if (!stop) {
-      FinalizeEpoch();
+    else {
+      stats = RunSlice(window, 1, true);
+      trainer->update(1.0);
+      FinishReportPeriod(stats, start_time, dev_frequency);
     }
+    StreamingBitext::Free(window);
+  }
+
+  if (stats.sentence_count > 0) {
+    FinishReportPeriod(stats, start_time, dev_frequency);
+  }
+}
+
+void TrainingWrapper::FinishReportPeriod(SufficientStats& stats, time_point& start_time, unsigned dev_frequency) {
+  time_point end_time = GetTime();
+  double seconds_elapsed = GetSeconds(start_time, end_time);
+
+  data_processed += stats.sentence_count;
+  Report(epoch, data_processed, stats, seconds_elapsed);
+  epoch_stats += stats;
+
+  sents_since_dev += stats.sentence_count;
+  if (sents_since_dev > dev_frequency) {
+    RunDevSet(1);
+    sents_since_dev = 0;
   }
+
+  stats = SufficientStats();
+  start_time = GetTime();
+}
+
+unsigned TrainingWrapper::TrainSize() const {
+  return (train_stream != nullptr) ? train_stream->size() : train_bitext.size();
 }
 
 void TrainingWrapper::Stop() {
@@ -119,7 +304,7 @@ vector<unsigned> TrainingWrapper::GenerateOrder(unsigned size) {
 }
 
 double TrainingWrapper::ComputeFractionalEpoch() const {
-  double fractional_epoch = epoch + 1.0 * data_processed / train_bitext.size();
+  double fractional_epoch = epoch + 1.0 * data_processed / TrainSize();
   return fractional_epoch;
 }
 
@@ -128,12 +313,25 @@ void TrainingWrapper::Report(unsigned epoch, unsigned progress, SufficientStats&
 }
 
 bool TrainingWrapper::RunDevSet(unsigned num_cores) {
-  SufficientStats dev_stats = RunSlice(dev_bitext, num_cores, false);
+  SufficientStats dev_stats;
+  if (dev_scheduler != nullptr) {
+    for (const vector<unsigned>& batch : dev_scheduler->Batches(0)) {
+      dev_stats += learner->LearnFromBatch(dev_scheduler->Gather(batch), false);
+    }
+  }
+  else if (hogwild != nullptr) {
+    vector<unsigned> dev_indices(dev_bitext.size());
+    iota(dev_indices.begin(), dev_indices.end(), 0);
+    dev_stats = hogwild->Run(dev_indices, true, false, epoch);
+  }
+  else {
+    dev_stats = RunSlice(dev_bitext, num_cores, false);
+  }
   bool new_best = (first_dev_run || dev_stats < best_dev_stats);
   cerr << ComputeFractionalEpoch() << "\t" << "dev loss = " << dev_stats;
   cerr << (new_best ? " (New best!)" : "") << endl;
+  learner->SaveCheckpoint(new_best);
   if (new_best) {
-    learner->SaveModel();
     best_dev_stats = dev_stats;
     first_dev_run = false;
   }
@@ -142,6 +340,7 @@ bool TrainingWrapper::RunDevSet(unsigned num_cores) {
 
 void TrainingWrapper::InitializeEpoch() {
   epoch_stats = SufficientStats();
+  data_processed = 0;
 }
 
 void TrainingWrapper::FinalizeEpoch() {
@@ -158,3 +357,4 @@ SufficientStats TrainingWrapper::RunSlice(const vector<SentencePair>& slice, uns
   }
 }
 
+
@@ -4,6 +4,9 @@
 #include "dynet/dynet.h"
 #include "dynet/training.h"
 #include "train.h"
+#include "batch_scheduler.h"
+#include "checkpointer.h"
+#include "streaming_bitext.h"
 using namespace dynet;
 namespace po = boost::program_options;
 
@@ -23,10 +26,16 @@ std::ostream& operator<< (std::ostream& stream, const SufficientStats& stats);
 
 class Learner : public ILearner<SentencePair, SufficientStats> {
 public:
-  Learner(const InputReader* const input_reader, const OutputReader* const output_reader, Translator& translator, Model& dynet_model, const Trainer* const trainer, float dropout_rate, bool quiet);
+  Learner(const InputReader* const input_reader, const OutputReader* const output_reader, Translator& translator, Model& dynet_model, const Trainer* const trainer, float dropout_rate, bool quiet, Checkpointer* checkpointer = nullptr);
   ~Learner();
   SufficientStats LearnFromDatum(const SentencePair& datum, bool learn);
+  // Builds a single graph for the whole batch, if the model supports it,
+  // with one backward pass. The caller does the update.
+  SufficientStats LearnFromBatch(const vector<SentencePair>& batch, bool learn);
   void SaveModel();
+  // With a checkpointer, every call saves a checkpoint in the background.
+  // Without one, only new bests are saved, synchronously to stdout.
+  void SaveCheckpoint(bool best);
 private:
   const InputReader* const input_reader;
   const OutputReader* const output_reader;
@@ -35,13 +44,17 @@ private:
   const Trainer* const trainer;
   float dropout_rate;
   bool quiet;
+  Checkpointer* checkpointer;
 };
 
+class HogwildTrainer;
+
 class TrainingWrapper {
 public:
   typedef std::chrono::steady_clock::time_point time_point;
 
-  TrainingWrapper(const Bitext& train_bitext, const Bitext& dev_bitext, Trainer* trainer, Learner* learner);
+  // If train_stream is given, the training data is read from it and train_bitext is ignored
+  TrainingWrapper(const Bitext& train_bitext, const Bitext& dev_bitext, Trainer* trainer, Learner* learner, StreamingBitext* train_stream = nullptr);
   void Train(const po::variables_map& vm);
   void Stop();
 
@@ -55,6 +68,12 @@ private:
   bool RunDevSet(unsigned num_cores);
   void InitializeEpoch();
   void FinalizeEpoch();
+  void TrainEpoch(unsigned num_cores, unsigned report_frequency, unsigned dev_frequency);
+  void TrainBatchedEpoch(unsigned report_frequency, unsigned dev_frequency);
+  void TrainStreamingEpoch(bool batched, unsigned max_sentences, unsigned max_tokens, unsigned seed, unsigned window_size, unsigned report_frequency, unsigned dev_frequency);
+  // Reports stats, runs the dev set if it's due, and starts a new reporting period
+  void FinishReportPeriod(SufficientStats& stats, time_point& start_time, unsigned dev_frequency);
+  unsigned TrainSize() const;
   SufficientStats RunSlice(const vector<SentencePair>& slice, unsigned num_cores, bool learn);
 
   const Bitext& train_bitext;
@@ -62,6 +81,14 @@ private:
   Trainer* trainer;
   Learner* learner;
 
+  // Only used when training with minibatches
+  BatchScheduler* train_scheduler;
+  BatchScheduler* dev_scheduler;
+  // Only used when training with more than one core
+  HogwildTrainer* hogwild;
+  // Only used when streaming the training data
+  StreamingBitext* train_stream;
+
   unsigned epoch;
   unsigned data_processed;
   unsigned sents_since_dev;
@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <boost/functional/hash.hpp>
 #include "translator.h"
 
 Translator::Translator() {}
@@ -31,7 +33,7 @@ vector<Expression> Translator::PerWordLosses(const InputSentence* const source,
   Expression state = output_model->GetState();
   attention_model->NewSentence(source);
   for (unsigned i = 0; i < target->size(); ++i) {
-    const shared_ptr<Word> word = target->at(i);
+    const Word word = target->at(i);
     assert (same_value(state, output_model->GetState()));
 
     Expression context = attention_model->GetContext(encodings, state);
@@ -49,6 +51,59 @@ Expression Translator::BuildGraph(const InputSentence* const source, const Outpu
   return sum(word_losses);
 }
 
+bool Translator::SupportsBatchedTraining() const {
+  SoftmaxOutputModel* softmax_model = dynamic_cast<SoftmaxOutputModel*>(output_model);
+  return encoder_model->SupportsBatchedEncoding() && attention_model->SupportsBatchedSources() && softmax_model != nullptr && softmax_model->SupportsBatchedDecoding();
+}
+
+Expression Translator::BuildBatchGraph(const vector<const InputSentence*>& sources, const vector<const OutputSentence*>& targets, ComputationGraph& cg) {
+  assert (SupportsBatchedTraining());
+  assert (sources.size() == targets.size() && sources.size() > 0);
+  SoftmaxOutputModel* softmax_model = dynamic_cast<SoftmaxOutputModel*>(output_model);
+  const unsigned batch_size = sources.size();
+  NewGraph(cg);
+
+  vector<Expression> encodings = encoder_model->EncodeBatch(sources);
+  vector<unsigned> source_lengths(batch_size);
+  vector<unsigned> target_lengths(batch_size);
+  for (unsigned j = 0; j < batch_size; ++j) {
+    source_lengths[j] = sources[j]->NumNodes();
+    target_lengths[j] = targets[j]->size();
+  }
+  attention_model->NewBatch(source_lengths);
+  const unsigned max_length = *max_element(target_lengths.begin(), target_lengths.end());
+  const unsigned min_length = *min_element(target_lengths.begin(), target_lengths.end());
+
+  vector<Expression> state = softmax_model->GetInitialBatchState();
+  for (unsigned k = 0; k < state.size(); ++k) {
+    state[k] = BroadcastToBatch(state[k], batch_size);
+  }
+
+  vector<Expression> losses(max_length);
+  for (unsigned i = 0; i < max_length; ++i) {
+    // Sentences that have already ended just keep predicting </s>, unscored
+    vector<WordId> words(batch_size, softmax_model->kEOS);
+    for (unsigned j = 0; j < batch_size; ++j) {
+      if (i < target_lengths[j]) {
+        words[j] = targets[j]->at(i).id;
+      }
+    }
+
+    Expression output_state = softmax_model->GetBatchState(state);
+    Expression context = attention_model->GetContext(encodings, output_state);
+    Expression loss = softmax_model->LossBatch(output_state, context, words);
+    if (i >= min_length) {
+      loss = cmult(loss, LengthMask(cg, target_lengths, i));
+    }
+    losses[i] = sum_batches(loss);
+
+    if (i + 1 < max_length) {
+      state = softmax_model->AddInputBatch(state, words, context);
+    }
+  }
+  return sum(losses);
+}
+
 void Translator::Sample(const vector<Expression>& encodings, shared_ptr<OutputSentence> prefix, float prefix_score, RNNPointer state_pointer, unsigned sample_count, unsigned max_length, ComputationGraph& cg, vector<pair<shared_ptr<OutputSentence>, float>>& samples) {
   if (max_length == 0) {
     shared_ptr<OutputSentence> sample = make_shared<OutputSentence>(*prefix);
@@ -57,13 +112,16 @@ void Translator::Sample(const vector<Expression>& encodings, shared_ptr<OutputSe
   }
 
   Expression output_state = output_model->GetState(state_pointer);
+  attention_model->SetTargetIndex(prefix->size());
   Expression context = attention_model->GetContext(encodings, output_state);
+  // Each continuation starts from the prior state this prefix left behind
+  const vector<Expression> prior_state = attention_model->GetPriorState();
 
-  unordered_map<shared_ptr<Word>, unsigned> continuations;
-  unordered_map<shared_ptr<Word>, float> scores;
+  unordered_map<Word, unsigned> continuations;
+  unordered_map<Word, float> scores;
   for (unsigned i = 0; i < sample_count; ++i) {
-    pair<shared_ptr<Word>, float> sample = output_model->Sample(state_pointer, context);
-    shared_ptr<Word> w = get<0>(sample);
+    pair<Word, float> sample = output_model->Sample(state_pointer, context);
+    Word w = get<0>(sample);
     float score = get<1>(sample);
     if (continuations.find(w) != continuations.end()) {
       continuations[w]++;
@@ -75,7 +133,7 @@ void Translator::Sample(const vector<Expression>& encodings, shared_ptr<OutputSe
   }
 
   for (auto it = continuations.begin(); it != continuations.end(); ++it) {
-    shared_ptr<Word> w = it->first;
+    Word w = it->first;
     float score = prefix_score + scores[w];
     prefix->push_back(w);
     output_model->AddInput(w, context, state_pointer);
@@ -88,6 +146,7 @@ void Translator::Sample(const vector<Expression>& encodings, shared_ptr<OutputSe
       }
     }
     else {
+      attention_model->SetPriorState(prior_state);
       Sample(encodings, prefix, score, new_pointer, it->second, max_length - 1, cg, samples);
     }
     prefix->pop_back();
@@ -112,7 +171,7 @@ vector<Expression> Translator::Align(const InputSentence* const source, const Ou
   vector<Expression> alignments;
   Expression input_matrix = concatenate_cols(encodings);
   for (unsigned i = 1; i < target->size(); ++i) {
-    const shared_ptr<Word> prev_word = (*target)[i - 1];
+    const Word prev_word = (*target)[i - 1];
     Expression state = output_model->GetState();
     Expression word_alignment = attention_model->GetAlignmentVector(encodings, state);
     Expression context = input_matrix * word_alignment;
@@ -122,70 +181,344 @@ vector<Expression> Translator::Align(const InputSentence* const source, const Ou
   return alignments;
 }
 
+namespace {
+typedef HypothesisArena::Handle Handle;
+
+// Returns false if no extension of a live hypothesis can make it into either
+// the complete hypotheses or the next beam, in which case it need not be expanded.
+template<class T>
+bool WorthExpanding(const HypothesisScorer& scorer, const HypothesisArena& arena, Handle hyp, unsigned max_length, const KBestList<Handle>& complete_hyps, unsigned K, const KBestList<T>& new_hyps, unsigned beam_size) {
+  const double log_prob = arena.log_prob(hyp);
+  const unsigned length = arena.length(hyp);
+  const vector<float>& coverage = arena.coverage(hyp);
+
+  const bool complete_full = complete_hyps.size() >= K;
+  if (complete_full && scorer.UpperBound(log_prob, length, coverage, max_length) < complete_hyps.worst_score()) {
+    return false;
+  }
+
+  const double next_bound = scorer.UpperBound(log_prob, length, coverage, length + 1);
+  if (new_hyps.size() >= beam_size && next_bound < new_hyps.worst_score() && complete_full && next_bound < complete_hyps.worst_score()) {
+    return false;
+  }
+  return true;
+}
+
+// True if we have K complete hypotheses that all score better than the best live one does now
+template<class T>
+bool BestHaveFinished(const KBestList<Handle>& complete_hyps, unsigned K, const KBestList<T>& live_hyps) {
+  if (complete_hyps.size() < K) {
+    return false;
+  }
+  return live_hyps.size() == 0 || get<0>(live_hyps.hypothesis_list().front()) < complete_hyps.worst_score();
+}
+
+// Returns the id of the hypothesis' coverage after attending with the given
+// alignment. The empty hypothesis starts out with no coverage vector at all.
+unsigned UpdateCoverage(HypothesisArena& arena, Handle hyp, const float* alignment, unsigned source_length) {
+  vector<float> coverage = arena.coverage(hyp);
+  coverage.resize(source_length, 0.0f);
+  for (unsigned i = 0; i < coverage.size(); ++i) {
+    coverage[i] += alignment[i];
+  }
+  return arena.AddCoverage(coverage);
+}
+
+double LogAdd(double a, double b) {
+  const double m = max(a, b);
+  return m + log(exp(a - m) + exp(b - m));
+}
+
+// Hypotheses with equal keys get recombined
+size_t RecombinationKey(const HypothesisArena& arena, Handle hyp, size_t state_signature, unsigned history_length) {
+  size_t key = state_signature;
+  for (unsigned i = 0; i < history_length && hyp != arena.root(); ++i, hyp = arena.parent(hyp)) {
+    boost::hash_combine(key, arena.word(hyp).id);
+  }
+  return key;
+}
+
+Handle CommonAncestor(const HypothesisArena& arena, Handle a, Handle b) {
+  while (arena.length(a) > arena.length(b)) {
+    a = arena.parent(a);
+  }
+  while (arena.length(b) > arena.length(a)) {
+    b = arena.parent(b);
+  }
+  while (a != b) {
+    a = arena.parent(a);
+    b = arena.parent(b);
+  }
+  return a;
+}
+
+// Whatever translations search ends up with descend from either the complete
+// hypotheses or the live ones, so their common ancestor can be committed.
+template<class T>
+void ReportPartialTranslation(const HypothesisArena& arena, const KBestList<Handle>& complete_hyps, const KBestList<T>& live_hyps, const PartialTranslationCallback& callback) {
+  if (!callback || (complete_hyps.size() == 0 && live_hyps.size() == 0)) {
+    return;
+  }
+
+  vector<pair<double, Handle>> remaining;
+  for (auto& hyp : complete_hyps.hypothesis_list()) {
+    remaining.push_back(make_pair(get<0>(hyp), get<1>(hyp)));
+  }
+  for (auto& hyp : live_hyps.hypothesis_list()) {
+    remaining.push_back(make_pair(get<0>(hyp), get<0>(get<1>(hyp))));
+  }
+
+  Handle committed = get<1>(remaining[0]);
+  pair<double, Handle> best = remaining[0];
+  for (auto& hyp : remaining) {
+    committed = CommonAncestor(arena, committed, get<1>(hyp));
+    if (get<0>(hyp) > get<0>(best)) {
+      best = hyp;
+    }
+  }
+  callback(*arena.Sentence(committed), *arena.Sentence(get<1>(best)));
+}
+
+KBestList<shared_ptr<OutputSentence>> MaterializeKBest(const HypothesisArena& arena, const KBestList<Handle>& hyps) {
+  KBestList<shared_ptr<OutputSentence>> kbest(hyps.max_size);
+  for (auto& hyp : hyps.hypothesis_list()) {
+    kbest.append(get<0>(hyp), arena.Sentence(get<1>(hyp)));
+  }
+  return kbest;
+}
+}
+
 KBestList<shared_ptr<OutputSentence>> Translator::Translate(const InputSentence* const source, unsigned K, unsigned beam_size, unsigned max_length, float length_bonus) {
+  WordBonusScorer scorer(length_bonus);
+  return Translate(source, K, beam_size, max_length, scorer, kSafeBound);
+}
+
+istream& operator>>(istream& in, Recombination& recombination) {
+  string token;
+  in >> token;
+
+  if (token == "none") {
+    recombination = kNoRecombination;
+  }
+  else if (token == "max") {
+    recombination = kRecombineMax;
+  }
+  else if (token == "sum") {
+    recombination = kRecombineSum;
+  }
+  else {
+    assert (false);
+  }
+  return in;
+}
+
+KBestList<shared_ptr<OutputSentence>> Translator::Translate(const InputSentence* const source, unsigned K, unsigned beam_size, unsigned max_length, const HypothesisScorer& scorer, EarlyStopping early_stopping, Recombination recombination, unsigned recombination_history, const PartialTranslationCallback& callback) {
   assert (beam_size >= K);
   ComputationGraph cg;
   NewGraph(cg);
 
-  KBestList<shared_ptr<OutputSentence>> complete_hyps(K);
-  KBestList<pair<shared_ptr<OutputSentence>, RNNPointer>> top_hyps(beam_size);
-  top_hyps.add(0.0, make_pair(make_shared<OutputSentence>(), output_model->GetStatePointer()));
-
   vector<Expression> encodings = encoder_model->Encode(source);
   attention_model->NewSentence(source);
-
-  for (unsigned length = 0; length < max_length; ++length) {
-    KBestList<pair<shared_ptr<OutputSentence>, RNNPointer>> new_hyps(beam_size);
-
-    for (auto& hyp : top_hyps.hypothesis_list()) {
-      double hyp_score = get<0>(hyp);
-
-      // Early termination: if we have K completed hypotheses, and the current prefix's
-      // score is worse than the worst of the complete hyps, then it's impossible to
-      // later get a better hypothesis later.
-      // Assumption: the log prob of every word will be <= buffer.
-      // This is true for 0.0 by default, but length priors and such may invalidate this assumption.
-      const float buffer = length_bonus;
-      if (complete_hyps.size() >= K && hyp_score < complete_hyps.worst_score() - buffer) {
-        break;
-      }
-
-      if (new_hyps.size() >= K && hyp_score < new_hyps.worst_score() - buffer) {
-        break;
+  const bool track_coverage = scorer.NeedsCoverage();
+
+  // Hypotheses live in the arena, and are ranked by their scorer score.
+  // The beam additionally keeps track of each hypothesis' decoder state.
+  HypothesisArena arena;
+  KBestList<Handle> complete_hyps(K);
+  KBestList<pair<Handle, RNNPointer>> top_hyps(beam_size);
+  top_hyps.add(0.0, make_pair(arena.root(), output_model->GetStatePointer()));
+
+  // Priors with a running state (e.g. coverage) keep one per hypothesis:
+  // prior_states[h] is the state left by attending from h, which h's
+  // children start from
+  const vector<Expression> initial_prior_state = attention_model->GetPriorState();
+  unordered_map<Handle, vector<Expression>> prior_states;
+
+  for (unsigned length = 0; length < max_length && top_hyps.size() > 0; ++length) {
+    KBestList<pair<Handle, RNNPointer>> new_hyps(beam_size);
+
+    // With recombination on, this step's live candidates are collected here
+    // first, so that equivalent ones can be merged before they compete for the beam.
+    vector<tuple<double, Handle, RNNPointer>> candidates;
+    unordered_map<size_t, unsigned> candidate_index;
+
+    for (auto& scored_hyp : top_hyps.hypothesis_list()) {
+      const Handle hyp = get<0>(get<1>(scored_hyp));
+      const RNNPointer state_pointer = get<1>(get<1>(scored_hyp));
+      assert (arena.length(hyp) == length);
+      if (!WorthExpanding(scorer, arena, hyp, max_length, complete_hyps, K, new_hyps, beam_size)) {
+        continue;
       }
 
-      shared_ptr<OutputSentence> hyp_sentence = get<0>(get<1>(hyp));
-      RNNPointer state_pointer = get<1>(get<1>(hyp));
-      assert (hyp_sentence->size() == length);
+      // Every hypothesis in the beam is at target position length
       Expression output_state = output_model->GetState(state_pointer);
+      attention_model->SetTargetIndex(length);
+      attention_model->SetPriorState(hyp == arena.root() ? initial_prior_state : prior_states[arena.parent(hyp)]);
       Expression context = attention_model->GetContext(encodings, output_state);
-      KBestList<shared_ptr<Word>> best_words = output_model->PredictKBest(state_pointer, context, beam_size);
+      prior_states[hyp] = attention_model->GetPriorState();
+      unsigned coverage_id = arena.coverage_id(hyp);
+      if (track_coverage) {
+        vector<float> alignment = as_vector(attention_model->GetLastAlignment().value());
+        assert (alignment.size() == encodings.size());
+        coverage_id = UpdateCoverage(arena, hyp, &alignment[0], encodings.size());
+      }
+      KBestList<Word> best_words = output_model->PredictKBest(state_pointer, context, beam_size);
 
       for (auto& w : best_words.hypothesis_list()) {
-        double word_score = get<0>(w);
-        shared_ptr<Word> word = get<1>(w);
-        double new_score = hyp_score + word_score;
-        shared_ptr<OutputSentence> new_sentence(new OutputSentence(*hyp_sentence));
-        new_sentence->push_back(word);
+        Word word = get<1>(w);
+        Handle new_hyp = arena.Extend(hyp, word, arena.log_prob(hyp) + get<0>(w), coverage_id);
         output_model->AddInput(word, context, state_pointer);
-        if (!output_model->IsDone()) {
-          new_score += length_bonus;
-          new_hyps.add(new_score, make_pair(new_sentence, output_model->GetStatePointer()));
+        if (output_model->IsDone()) {
+          double score = scorer.Score(arena.log_prob(new_hyp), length, arena.coverage(new_hyp));
+          complete_hyps.add(score, new_hyp);
+          continue;
         }
-        else {
-          complete_hyps.add(new_score, new_sentence);
+
+        const RNNPointer new_pointer = output_model->GetStatePointer();
+        double score = scorer.Score(arena.log_prob(new_hyp), length + 1, arena.coverage(new_hyp));
+        if (recombination == kNoRecombination) {
+          new_hyps.add(score, make_pair(new_hyp, new_pointer));
+          continue;
+        }
+
+        const size_t key = RecombinationKey(arena, new_hyp, output_model->StateSignature(new_pointer), recombination_history);
+        auto it = candidate_index.find(key);
+        if (it == candidate_index.end()) {
+          candidate_index[key] = candidates.size();
+          candidates.push_back(make_tuple(score, new_hyp, new_pointer));
+          continue;
+        }
+
+        tuple<double, Handle, RNNPointer>& existing = candidates[it->second];
+        const Handle other_hyp = get<1>(existing);
+        const double other_log_prob = arena.log_prob(other_hyp);
+        if (score > get<0>(existing)) {
+          existing = make_tuple(score, new_hyp, new_pointer);
+        }
+        if (recombination == kRecombineSum) {
+          const Handle survivor = get<1>(existing);
+          arena.set_log_prob(survivor, LogAdd(arena.log_prob(new_hyp), other_log_prob));
+          get<0>(existing) = scorer.Score(arena.log_prob(survivor), length + 1, arena.coverage(survivor));
         }
       }
     }
+
+    for (auto& candidate : candidates) {
+      new_hyps.add(get<0>(candidate), make_pair(get<1>(candidate), get<2>(candidate)));
+    }
     top_hyps = new_hyps;
+    ReportPartialTranslation(arena, complete_hyps, top_hyps, callback);
+
+    if (early_stopping == kBestFinished && BestHaveFinished(complete_hyps, K, top_hyps)) {
+      break;
+    }
   }
 
   for (auto& hyp : top_hyps.hypothesis_list()) {
-    double score = get<0>(hyp);
-    shared_ptr<OutputSentence> sentence = get<0>(get<1>(hyp));
-    complete_hyps.add(score, sentence);
+    complete_hyps.add(get<0>(hyp), get<0>(get<1>(hyp)));
+  }
+  return MaterializeKBest(arena, complete_hyps);
+}
+
+KBestList<shared_ptr<OutputSentence>> Translator::TranslateBatched(const InputSentence* const source, unsigned K, unsigned beam_size, unsigned max_length, float length_bonus) {
+  WordBonusScorer scorer(length_bonus);
+  return TranslateBatched(source, K, beam_size, max_length, scorer, kSafeBound);
+}
+
+KBestList<shared_ptr<OutputSentence>> Translator::TranslateBatched(const InputSentence* const source, unsigned K, unsigned beam_size, unsigned max_length, const HypothesisScorer& scorer, EarlyStopping early_stopping, const PartialTranslationCallback& callback) {
+  SoftmaxOutputModel* softmax_model = dynamic_cast<SoftmaxOutputModel*>(output_model);
+  if (softmax_model == nullptr || !softmax_model->SupportsBatchedDecoding() || !attention_model->SupportsBatchedDecoding()) {
+    return Translate(source, K, beam_size, max_length, scorer, early_stopping, kNoRecombination, 2, callback);
+  }
+
+  assert (beam_size >= K);
+  ComputationGraph cg;
+  NewGraph(cg);
+
+  vector<Expression> encodings = encoder_model->Encode(source);
+  attention_model->NewSentence(source);
+  const bool track_coverage = scorer.NeedsCoverage();
+
+  // The i-th live hypothesis is the i-th batch element of batch_state.
+  // After each step, parents[i] says which old batch element the i-th new
+  // hypothesis extends. Its last word is the input for the next step.
+  HypothesisArena arena;
+  KBestList<Handle> complete_hyps(K);
+  KBestList<pair<Handle, unsigned>> live_hyps(beam_size);
+  live_hyps.add(0.0, make_pair(arena.root(), 0));
+  vector<Expression> batch_state = softmax_model->GetInitialBatchState();
+  Expression batch_context;
+
+  for (unsigned length = 0; length < max_length && live_hyps.size() > 0; ++length) {
+    if (length > 0) {
+      vector<unsigned> parents;
+      vector<WordId> prev_words;
+      for (auto& hyp : live_hyps.hypothesis_list()) {
+        const Handle h = get<0>(get<1>(hyp));
+        parents.push_back(get<1>(get<1>(hyp)));
+        prev_words.push_back(arena.word(h).id);
+      }
+
+      vector<Expression> parent_state(batch_state.size());
+      for (unsigned i = 0; i < batch_state.size(); ++i) {
+        parent_state[i] = SelectBatchElements(batch_state[i], parents);
+      }
+      Expression parent_context = SelectBatchElements(batch_context, parents);
+      batch_state = softmax_model->AddInputBatch(parent_state, prev_words, parent_context);
+      attention_model->SelectHypotheses(parents);
+    }
+
+    Expression output_state = softmax_model->GetBatchState(batch_state);
+    batch_context = attention_model->GetContext(encodings, output_state);
+    Expression log_probs = softmax_model->PredictLogDistributionBatch(output_state, batch_context);
+    vector<float> dist = as_vector(log_probs.value());
+    assert (dist.size() % live_hyps.size() == 0);
+    const unsigned vocab_size = dist.size() / live_hyps.size();
+    vector<float> alignments;
+    if (track_coverage) {
+      alignments = as_vector(attention_model->GetLastAlignment().value());
+      assert (alignments.size() == live_hyps.size() * encodings.size());
+    }
+
+    KBestList<pair<Handle, unsigned>> new_hyps(beam_size);
+    for (unsigned i = 0; i < live_hyps.size(); ++i) {
+      const Handle hyp = get<0>(get<1>(live_hyps.hypothesis_list()[i]));
+      assert (arena.length(hyp) == length);
+      if (!WorthExpanding(scorer, arena, hyp, max_length, complete_hyps, K, new_hyps, beam_size)) {
+        continue;
+      }
+
+      unsigned coverage_id = arena.coverage_id(hyp);
+      if (track_coverage) {
+        coverage_id = UpdateCoverage(arena, hyp, &alignments[i * encodings.size()], encodings.size());
+      }
+
+      vector<pair<float, unsigned>> best_words = TopK(&dist[i * vocab_size], vocab_size, beam_size);
+      for (auto& w : best_words) {
+        WordId word = softmax_model->CandidateWord(get<1>(w));
+        Handle new_hyp = arena.Extend(hyp, Word(word), arena.log_prob(hyp) + get<0>(w), coverage_id);
+        if (word != softmax_model->kEOS) {
+          double score = scorer.Score(arena.log_prob(new_hyp), length + 1, arena.coverage(new_hyp));
+          new_hyps.add(score, make_pair(new_hyp, i));
+        }
+        else {
+          double score = scorer.Score(arena.log_prob(new_hyp), length, arena.coverage(new_hyp));
+          complete_hyps.add(score, new_hyp);
+        }
+      }
+    }
+    live_hyps = new_hyps;
+    ReportPartialTranslation(arena, complete_hyps, live_hyps, callback);
+
+    if (early_stopping == kBestFinished && BestHaveFinished(complete_hyps, K, live_hyps)) {
+      break;
+    }
+  }
+
+  for (auto& hyp : live_hyps.hypothesis_list()) {
+    complete_hyps.add(get<0>(hyp), get<0>(get<1>(hyp)));
   }
-  return complete_hyps;
+  return MaterializeKBest(arena, complete_hyps);
 }
 
 Expression Translator::GetContexts(const InputSentence* const source, const vector<Expression>& new_embs) {
@@ -261,7 +594,7 @@ vector<vector<float>> Translator::GetAttentionGradients(const InputSentence* con
   attention_model->NewSentence(source);
   vector<vector<float>> grads;
   for (unsigned i = 0; i < target->size() - 1; ++i) {
-    const shared_ptr<Word> word = target->at(i);
+    const Word word = target->at(i);
     assert (same_value(state, output_model->GetState()));
 
     Expression scores = attention_model->GetScoreVector(encodings, nobackprop(state));
@@ -1,11 +1,27 @@
 #pragma once
+#include <functional>
 #include <boost/serialization/access.hpp>
 #include "encoder.h"
 #include "attention.h"
 #include "output.h"
 #include "kbestlist.h"
+#include "scorer.h"
+#include "hypothesis_arena.h"
 #include "syntax_tree.h"
 
+// Hypothesis recombination. Live hypotheses that have the same output model
+// StateSignature and the same last few words are treated as equivalent, and
+// only the best of them is kept. kRecombineMax keeps its score as is, while
+// kRecombineSum gives it the total probability of all the merged hypotheses.
+enum Recombination {kNoRecombination, kRecombineMax, kRecombineSum};
+istream& operator>>(istream& in, Recombination& recombination);
+
+// Called by beam search after every time step with the words that all the
+// hypotheses still in the running begin with, which are therefore certain to
+// begin every translation in the final k-best list, and the current best
+// hypothesis. The committed words only ever grow from one call to the next.
+typedef function<void(const OutputSentence& committed, const OutputSentence& best)> PartialTranslationCallback;
+
 class Translator {
 public:
   Translator();
@@ -15,9 +31,23 @@ public:
   void SetDropout(float rate);
   vector<Expression> PerWordLosses(const InputSentence* const source, const OutputSentence* const target, ComputationGraph& cg);
   Expression BuildGraph(const InputSentence* const source, const OutputSentence* const target, ComputationGraph& cg);
+  // Builds the total loss of a batch of sentence pairs as one batched graph.
+  // Sentences are padded to the length of the longest one in the batch, and
+  // the padding is masked out, so the loss is the same as the sum of
+  // BuildGraph's, but the encoder, attention and output models run one batched
+  // step per position instead of one step per sentence and position.
+  // Only for models where SupportsBatchedTraining() is true.
+  bool SupportsBatchedTraining() const;
+  Expression BuildBatchGraph(const vector<const InputSentence*>& sources, const vector<const OutputSentence*>& targets, ComputationGraph& cg);
   vector<pair<shared_ptr<OutputSentence>, float>> Sample(const InputSentence* const source, unsigned samples, unsigned max_length);
   vector<Expression> Align(const InputSentence* const source, const OutputSentence* const target, ComputationGraph& cg);
   KBestList<shared_ptr<OutputSentence>> Translate(const InputSentence* const source, unsigned K, unsigned beam_size, unsigned max_length, float length_bonus=0.0f);
+  KBestList<shared_ptr<OutputSentence>> Translate(const InputSentence* const source, unsigned K, unsigned beam_size, unsigned max_length, const HypothesisScorer& scorer, EarlyStopping early_stopping, Recombination recombination = kNoRecombination, unsigned recombination_history = 2, const PartialTranslationCallback& callback = nullptr);
+  // Same search as Translate, but all the live hypotheses are advanced together
+  // as a single batch. Falls back to Translate if the models can't be batched.
+  // Recombination is only done by Translate, so TranslateBatched doesn't take it.
+  KBestList<shared_ptr<OutputSentence>> TranslateBatched(const InputSentence* const source, unsigned K, unsigned beam_size, unsigned max_length, float length_bonus=0.0f);
+  KBestList<shared_ptr<OutputSentence>> TranslateBatched(const InputSentence* const source, unsigned K, unsigned beam_size, unsigned max_length, const HypothesisScorer& scorer, EarlyStopping early_stopping, const PartialTranslationCallback& callback = nullptr);
 
   // XXX: This should be temporary and is just for some qualitative digging stuff I'm doing
   Expression GetContexts(const InputSentence* const source, const vector<Expression>& new_embs);
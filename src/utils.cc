@@ -2,8 +2,10 @@
 #include <sstream>
 #include <vector>
 #include <map>
+#include <deque>
 #include <cassert>
 #include <cctype>
+#include <algorithm>
 #include <boost/algorithm/string/join.hpp>
 #include <boost/algorithm/string.hpp>
 #include <boost/algorithm/string/regex.hpp>
@@ -17,8 +19,44 @@ unsigned LinearSentence::NumNodes() const {
   return this->size();
 }
 
-Word::~Word() {}
-StandardWord::StandardWord(WordId id) : id(id) {}
+namespace {
+// A deque never moves its elements, so references into it stay valid
+deque<MorphoWord>& MorphoWordArena() {
+  static deque<MorphoWord> arena;
+  return arena;
+}
+}
+
+Word::Word() : id(0) {}
+Word::Word(WordId id) : id(id) {}
+
+Word Word::FromMorphoWord(MorphoWord&& word) {
+  deque<MorphoWord>& arena = MorphoWordArena();
+  arena.push_back(move(word));
+  return Word(-(WordId)arena.size());
+}
+
+bool Word::IsMorphoWord() const {
+  return id < 0;
+}
+
+const MorphoWord& Word::morpho() const {
+  assert (IsMorphoWord());
+  return MorphoWordArena()[-id - 1];
+}
+
+WordId Word::standard_id() const {
+  assert (!IsMorphoWord());
+  return id;
+}
+
+bool Word::operator==(const Word& other) const {
+  return id == other.id;
+}
+
+bool Word::operator!=(const Word& other) const {
+  return id != other.id;
+}
 
 // Samples an item from a multinomial distribution
 // The values in dist should sum to one.
@@ -100,6 +138,54 @@ vector<string> strip(const vector<string>& input, bool removeEmpty) {
   return output;
 }
 
+boost::string_ref strip_ref(boost::string_ref input) {
+  while (!input.empty() && isspace((unsigned char)input.front())) {
+    input.remove_prefix(1);
+  }
+  while (!input.empty() && isspace((unsigned char)input.back())) {
+    input.remove_suffix(1);
+  }
+  return input;
+}
+
+void tokenize_ref(boost::string_ref input, char delimiter, vector<boost::string_ref>& tokens) {
+  tokens.clear();
+  size_t next = 0;
+  while ((next = input.find(delimiter)) != boost::string_ref::npos) {
+    tokens.push_back(input.substr(0, next));
+    input.remove_prefix(next + 1);
+  }
+  if (!input.empty()) {
+    tokens.push_back(input);
+  }
+}
+
+void utf8_chars_ref(boost::string_ref word, vector<boost::string_ref>& chars) {
+  chars.clear();
+  for (size_t i = 0; i < word.length(); ) {
+    size_t len = max(UTF8Len(word[i]), 1U);
+    len = min(len, word.length() - i);
+    chars.push_back(word.substr(i, len));
+    i += len;
+  }
+}
+
+unsigned ParseUnsigned(boost::string_ref input) {
+  input = strip_ref(input);
+  assert (!input.empty() && isdigit((unsigned char)input.front()));
+  unsigned r = 0;
+  for (unsigned i = 0; i < input.length() && isdigit((unsigned char)input[i]); ++i) {
+    r = r * 10 + (input[i] - '0');
+  }
+  return r;
+}
+
+WordId ConvertWord(Dict& dict, boost::string_ref word) {
+  static thread_local string buffer;
+  buffer.assign(word.data(), word.length());
+  return dict.convert(buffer);
+}
+
 map<string, double> parse_feature_string(string input) {
   map<string, double> output;
   for (string piece : tokenize(input, " ")) {
@@ -141,6 +227,30 @@ vector<Expression> MakeLSTMInitialState(Expression c, unsigned lstm_dim, unsigne
   return hinit;
 }
 
+// Builds a batched expression whose i-th batch element is element indices[i] of x
+Expression SelectBatchElements(const Expression& x, const vector<unsigned>& indices) {
+  vector<Expression> elements(indices.size());
+  for (unsigned i = 0; i < indices.size(); ++i) {
+    elements[i] = pick_batch_elem(x, indices[i]);
+  }
+  return concatenate_to_batch(elements);
+}
+
+// Copies an expression with a single batch element into batch_size of them
+Expression BroadcastToBatch(const Expression& x, unsigned batch_size) {
+  return concatenate_to_batch(vector<Expression>(batch_size, x));
+}
+
+// Builds a {1} expression with one batch element per sentence, which is 1
+// if the sentence is longer than position and 0 if position is padding
+Expression LengthMask(ComputationGraph& cg, const vector<unsigned>& lengths, unsigned position) {
+  vector<float> mask(lengths.size());
+  for (unsigned i = 0; i < lengths.size(); ++i) {
+    mask[i] = (position < lengths[i]) ? 1.0f : 0.0f;
+  }
+  return input(cg, Dim({1}, lengths.size()), mask);
+}
+
 string vec2str(Expression expr) {
   ostringstream oss;
   bool first = true;
@@ -4,6 +4,7 @@
 #include <string>
 #include <tuple>
 #include <memory>
+#include <boost/utility/string_ref.hpp>
 /*#include <boost/archive/text_iarchive.hpp>
 #include <boost/archive/text_oarchive.hpp>
 #include <boost/archive/binary_iarchive.hpp>
@@ -17,27 +18,47 @@ using namespace dynet::expr;
 
 typedef int WordId;
 
-struct Word {
-  virtual ~Word();
-};
-
-struct StandardWord : public Word {
-  explicit StandardWord(WordId id);
-  WordId id;
-};
-
 class Analysis {
 public:
   WordId root;
   vector<WordId> affixes;
 };
 
-struct MorphoWord : public Word {
+struct MorphoWord {
   WordId word;
   vector<Analysis> analyses;
   vector<WordId> chars;
 };
 
+// A single token, stored by value. A word from a vocabulary is just its id.
+// Words that need more than that (currently only MorphoWords) are kept in a
+// process-wide arena and referred to with negative ids.
+struct Word {
+  Word();
+  explicit Word(WordId id);
+  // Moves word into the arena and returns a Word that refers to it
+  static Word FromMorphoWord(MorphoWord&& word);
+
+  bool IsMorphoWord() const;
+  const MorphoWord& morpho() const;
+  // The id of a plain word, for lookups and softmaxes. Asserts that it isn't a morpho word.
+  WordId standard_id() const;
+
+  bool operator==(const Word& other) const;
+  bool operator!=(const Word& other) const;
+
+  WordId id;
+};
+static_assert(sizeof(Word) == sizeof(WordId), "Words should be stored as bare ids");
+
+namespace std {
+template<> struct hash<Word> {
+  size_t operator()(const Word& word) const {
+    return hash<WordId>()(word.id);
+  }
+};
+}
+
 class InputSentence {
 public:
   virtual ~InputSentence();
@@ -45,7 +66,7 @@ public:
   virtual unsigned NumNodes() const = 0;
 };
 
-typedef vector<shared_ptr<Word>> OutputSentence;
+typedef vector<Word> OutputSentence;
 
 class LinearSentence : public InputSentence, public OutputSentence {
 public:
@@ -67,9 +88,27 @@ vector<string> tokenize(string input, char delimiter);
 string strip(const string& input);
 vector<string> strip(const vector<string>& input, bool removeEmpty = false);
 
+// Non-copying versions of the above for the corpus readers. The results point
+// into input, so they're only valid for as long as it is.
+// Same as strip, but returns a view of input
+boost::string_ref strip_ref(boost::string_ref input);
+// Splits input on delimiter into tokens, which is cleared first so that its
+// storage can be reused. Gives the same tokens as tokenize(input, delimiter).
+void tokenize_ref(boost::string_ref input, char delimiter, vector<boost::string_ref>& tokens);
+// Splits a word into its UTF-8 characters, treating invalid bytes as one character each
+void utf8_chars_ref(boost::string_ref word, vector<boost::string_ref>& chars);
+// Parses a non-negative decimal integer, like stoi but without making a string
+unsigned ParseUnsigned(boost::string_ref input);
+// Looks word up in dict, copying it into a reused per-thread buffer instead
+// of a new string, since Dict is keyed by std::string
+WordId ConvertWord(Dict& dict, boost::string_ref word);
+
 map<string, double> parse_feature_string(string input);
 
 float logsumexp(const vector<float>& v);
 vector<Expression> MakeLSTMInitialState(Expression c, unsigned lstm_dim, unsigned lstm_layer_count);
+Expression SelectBatchElements(const Expression& x, const vector<unsigned>& indices);
+Expression BroadcastToBatch(const Expression& x, unsigned batch_size);
+Expression LengthMask(ComputationGraph& cg, const vector<unsigned>& lengths, unsigned position);
 string vec2str(Expression expr);
 bool same_value(Expression e1, Expression e2);
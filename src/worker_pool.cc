@@ -0,0 +1,255 @@
+#include <iostream>
+#include <cassert>
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <map>
+#include <unistd.h>
+#include <sys/select.h>
+#include <sys/wait.h>
+#include "worker_pool.h"
+
+namespace {
+// Where SendPartialResponse writes to, in worker processes
+int partial_response_fd = -1;
+unsigned current_request_id = 0;
+
+bool WriteAll(int fd, const char* data, size_t length) {
+  while (length > 0) {
+    ssize_t written = write(fd, data, length);
+    if (written < 0 && errno == EINTR) {
+      continue;
+    }
+    if (written <= 0) {
+      return false;
+    }
+    data += written;
+    length -= written;
+  }
+  return true;
+}
+
+bool ReadAll(int fd, char* data, size_t length) {
+  while (length > 0) {
+    ssize_t bytes_read = read(fd, data, length);
+    if (bytes_read < 0 && errno == EINTR) {
+      continue;
+    }
+    if (bytes_read <= 0) {
+      return false;
+    }
+    data += bytes_read;
+    length -= bytes_read;
+  }
+  return true;
+}
+}
+
+bool WriteFrame(int fd, unsigned id, const string& payload, bool partial) {
+  uint32_t header[3] = {(uint32_t)id, (uint32_t)payload.size(), partial ? 1u : 0u};
+  return WriteAll(fd, (const char*)header, sizeof(header)) && WriteAll(fd, payload.data(), payload.size());
+}
+
+bool ReadFrame(int fd, unsigned& id, string& payload, bool* partial) {
+  uint32_t header[3];
+  if (!ReadAll(fd, (char*)header, sizeof(header))) {
+    return false;
+  }
+  id = header[0];
+  if (partial != nullptr) {
+    *partial = header[2] != 0;
+  }
+  payload.resize(header[1]);
+  return header[1] == 0 || ReadAll(fd, &payload[0], header[1]);
+}
+
+bool SendPartialResponse(const string& payload) {
+  if (partial_response_fd == -1) {
+    return false;
+  }
+  return WriteFrame(partial_response_fd, current_request_id, payload, true);
+}
+
+WorkerPool::WorkerPool(unsigned worker_count, const Handler& handler) : pending_count(0) {
+  assert (worker_count > 0);
+  // A dead worker should show up as a failed write, not kill the parent
+  signal(SIGPIPE, SIG_IGN);
+  cout.flush();
+  cerr.flush();
+
+  for (unsigned i = 0; i < worker_count; ++i) {
+    int request_pipe[2];
+    int response_pipe[2];
+    if (pipe(request_pipe) != 0 || pipe(response_pipe) != 0) {
+      cerr << "Unable to create pipes for worker " << i << endl;
+      abort();
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+      cerr << "Unable to fork worker " << i << endl;
+      abort();
+    }
+    else if (pid == 0) {
+      // Don't hold on to the other workers' pipes, or they'd never see EOF
+      for (Worker& w : workers) {
+        close(w.request_fd);
+        close(w.response_fd);
+      }
+      close(request_pipe[1]);
+      close(response_pipe[0]);
+
+      unsigned id;
+      string request;
+      partial_response_fd = response_pipe[1];
+      while (ReadFrame(request_pipe[0], id, request)) {
+        current_request_id = id;
+        string response = handler(id, request);
+        if (!WriteFrame(response_pipe[1], id, response)) {
+          break;
+        }
+      }
+      // Skip the parent's destructors and atexit handlers
+      _exit(0);
+    }
+
+    close(request_pipe[0]);
+    close(response_pipe[1]);
+    workers.push_back({pid, request_pipe[1], response_pipe[0], false});
+  }
+}
+
+WorkerPool::~WorkerPool() {
+  for (Worker& w : workers) {
+    close(w.request_fd);
+  }
+  for (Worker& w : workers) {
+    waitpid(w.pid, nullptr, 0);
+    close(w.response_fd);
+  }
+}
+
+void WorkerPool::Submit(unsigned id, const string& request) {
+  queue.push_back(make_pair(id, request));
+  ++pending_count;
+  Dispatch();
+}
+
+void WorkerPool::Dispatch() {
+  for (Worker& w : workers) {
+    if (queue.size() == 0) {
+      break;
+    }
+    if (w.busy) {
+      continue;
+    }
+    if (!WriteFrame(w.request_fd, queue.front().first, queue.front().second)) {
+      cerr << "Worker " << w.pid << " died" << endl;
+      abort();
+    }
+    w.busy = true;
+    queue.pop_front();
+  }
+}
+
+bool WorkerPool::Receive(unsigned& id, string& response, int extra_fd, bool* partial) {
+  assert (pending_count > 0 || extra_fd != -1);
+  while (true) {
+    fd_set fds;
+    FD_ZERO(&fds);
+    int max_fd = extra_fd;
+    if (extra_fd != -1) {
+      FD_SET(extra_fd, &fds);
+    }
+    for (Worker& w : workers) {
+      if (w.busy) {
+        FD_SET(w.response_fd, &fds);
+        max_fd = max(max_fd, w.response_fd);
+      }
+    }
+
+    if (select(max_fd + 1, &fds, nullptr, nullptr, nullptr) < 0) {
+      if (errno == EINTR) {
+        continue;
+      }
+      cerr << "select() failed while waiting for workers" << endl;
+      abort();
+    }
+
+    for (Worker& w : workers) {
+      if (w.busy && FD_ISSET(w.response_fd, &fds)) {
+        bool is_partial;
+        if (!ReadFrame(w.response_fd, id, response, &is_partial)) {
+          cerr << "Worker " << w.pid << " died" << endl;
+          abort();
+        }
+        if (is_partial) {
+          if (partial != nullptr) {
+            *partial = true;
+            return true;
+          }
+          continue;
+        }
+        if (partial != nullptr) {
+          *partial = false;
+        }
+        w.busy = false;
+        --pending_count;
+        Dispatch();
+        return true;
+      }
+    }
+
+    if (extra_fd != -1 && FD_ISSET(extra_fd, &fds)) {
+      return false;
+    }
+  }
+}
+
+unsigned WorkerPool::pending() const {
+  return pending_count;
+}
+
+unsigned WorkerPool::size() const {
+  return workers.size();
+}
+
+void RunOrdered(unsigned count, unsigned worker_count, const WorkerPool::Handler& handler, const function<void(unsigned, const string&)>& emit, const function<void(unsigned, const string&)>& emit_partial) {
+  if (worker_count <= 1) {
+    for (unsigned i = 0; i < count; ++i) {
+      emit(i, handler(i, ""));
+    }
+    return;
+  }
+
+  WorkerPool pool(worker_count, handler);
+  // Keep a couple of requests queued up per worker, so that nobody goes idle
+  // while we're busy writing output, without submitting the whole corpus up front.
+  // The window also bounds how much finished output can pile up behind one slow request.
+  const unsigned max_in_flight = 2 * worker_count;
+  const unsigned window = 16 * worker_count;
+  map<unsigned, string> reorder_buffer;
+  unsigned next_to_submit = 0;
+  unsigned next_to_emit = 0;
+  while (next_to_emit < count) {
+    while (next_to_submit < count && pool.pending() < max_in_flight && next_to_submit - next_to_emit < window) {
+      pool.Submit(next_to_submit++, "");
+    }
+
+    unsigned id;
+    string response;
+    bool partial;
+    pool.Receive(id, response, -1, &partial);
+    if (partial) {
+      if (emit_partial) {
+        emit_partial(id, response);
+      }
+      continue;
+    }
+    reorder_buffer[id] = response;
+
+    for (auto it = reorder_buffer.begin(); it != reorder_buffer.end() && it->first == next_to_emit; it = reorder_buffer.erase(it)) {
+      emit(next_to_emit++, it->second);
+    }
+  }
+}
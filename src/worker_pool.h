@@ -0,0 +1,69 @@
+#pragma once
+#include <deque>
+#include <functional>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+using namespace std;
+
+// A pool of forked worker processes that each run a request handler.
+// DyNet only allows one ComputationGraph to exist per process, so parallel
+// decoding has to happen in separate processes rather than threads. The
+// workers are forked after the model has been loaded, so they all share the
+// parent's copy of the parameters copy-on-write.
+// Requests and responses are opaque strings, passed over pipes as frames.
+class WorkerPool {
+public:
+  typedef function<string(unsigned, const string&)> Handler;
+
+  WorkerPool(unsigned worker_count, const Handler& handler);
+  ~WorkerPool();
+
+  // Queues up a request. It is handed to the first worker to become idle.
+  void Submit(unsigned id, const string& request);
+
+  // Blocks until a worker finishes a request, or until extra_fd (if not -1)
+  // has input available. In the former case returns true and fills in the
+  // id and response of the finished request, otherwise returns false.
+  // If partial is given, responses sent early with SendPartialResponse are
+  // returned the same way, with *partial set to true. Otherwise they're dropped.
+  bool Receive(unsigned& id, string& response, int extra_fd = -1, bool* partial = nullptr);
+
+  // Number of requests that have been submitted but not yet received
+  unsigned pending() const;
+  unsigned size() const;
+
+private:
+  struct Worker {
+    pid_t pid;
+    int request_fd;
+    int response_fd;
+    bool busy;
+  };
+
+  vector<Worker> workers;
+  deque<pair<unsigned, string>> queue;
+  unsigned pending_count;
+
+  void Dispatch();
+};
+
+// Lets a handler running in a pool worker send part of its response to the
+// parent before it has finished, e.g. the first words of a translation.
+// Returns false if the handler isn't running in a worker, in which case the
+// caller has to deliver the partial response itself.
+bool SendPartialResponse(const string& payload);
+
+// Runs handler(i, "") for every i in [0, count) on worker_count forked workers,
+// and calls emit(i, response) for each of them in order of i, as soon as all
+// the earlier ones have been emitted. Handlers can get at their inputs through
+// memory that was set up before the call, since the workers are forked from it.
+// With a single worker everything runs in this process, without forking.
+// Partial responses are passed to emit_partial as soon as they arrive, if it's given.
+void RunOrdered(unsigned count, unsigned worker_count, const WorkerPool::Handler& handler, const function<void(unsigned, const string&)>& emit, const function<void(unsigned, const string&)>& emit_partial = nullptr);
+
+// Frame format: request id, payload length, partial flag, payload bytes.
+// Both return false if the other end has gone away.
+bool WriteFrame(int fd, unsigned id, const string& payload, bool partial = false);
+bool ReadFrame(int fd, unsigned& id, string& payload, bool* partial = nullptr);
@@ -0,0 +1,52 @@
+# Builds a lexical translation table for "predict --shortlist" from the
+# attention matrices written by "align", by treating each target word's
+# attention as soft alignment counts: p(t | s) = count(s, t) / count(s).
+# Usage: python extract_lex_table.py source.txt target.txt alignments.txt > lex.txt
+# Sentences are wrapped in <s> and </s> the same way viz-align.py does.
+import sys
+import argparse
+from collections import defaultdict
+
+parser = argparse.ArgumentParser()
+parser.add_argument('source')
+parser.add_argument('target')
+parser.add_argument('alignments')
+parser.add_argument('--max_per_word', type=int, default=50, help='Number of translations to keep for each source word')
+parser.add_argument('--threshold', type=float, default=0.01, help='Drop translations less likely than this')
+args = parser.parse_args()
+
+def read_matrices(filename):
+	matrix = []
+	for line in open(filename):
+		line = line.strip()
+		if not line:
+			if matrix:
+				yield matrix
+			matrix = []
+			continue
+		matrix.append([float(x) for x in line.split()])
+	if matrix:
+		yield matrix
+
+counts = defaultdict(lambda: defaultdict(float))
+totals = defaultdict(float)
+source_file = open(args.source)
+target_file = open(args.target)
+for n, matrix in enumerate(read_matrices(args.alignments)):
+	source = ['<s>'] + source_file.readline().split() + ['</s>']
+	target = target_file.readline().split() + ['</s>']
+	if len(matrix) != len(target) or any(len(row) != len(source) for row in matrix):
+		sys.stderr.write('Alignment %d does not match its sentence pair. Skipping it.\n' % n)
+		continue
+	for t, row in zip(target, matrix):
+		for s, a in zip(source, row):
+			counts[s][t] += a
+			totals[s] += a
+
+for s in sorted(counts):
+	translations = sorted(counts[s].items(), key=lambda item: (-item[1], item[0]))
+	for t, count in translations[:args.max_per_word]:
+		p = count / totals[s]
+		if p < args.threshold:
+			break
+		print('%s %s %g' % (s, t, p))
@@ -0,0 +1,77 @@
+# Replays a source file against "predict --server" and reports latencies.
+# Usage: python predict_client.py source.txt -- bin/predict model --server --threads 4 [...]
+# The k-best lists are written to stdout in input order.
+import sys
+import time
+import argparse
+import threading
+import subprocess
+
+parser = argparse.ArgumentParser()
+parser.add_argument('source')
+parser.add_argument('--rate', type=float, default=0.0, help='Requests per second to send. Default is 0.0 = as fast as possible')
+parser.add_argument('command', nargs=argparse.REMAINDER)
+args = parser.parse_args()
+
+command = args.command[1:] if args.command[:1] == ['--'] else args.command
+sentences = [line.rstrip('\n') for line in open(args.source)]
+send_times = {}
+
+server = subprocess.Popen(command, stdin=subprocess.PIPE, stdout=subprocess.PIPE, universal_newlines=True)
+
+def send():
+	for i, sentence in enumerate(sentences):
+		send_times[i] = time.time()
+		server.stdin.write(sentence + '\n')
+		server.stdin.flush()
+		if args.rate > 0.0:
+			time.sleep(1.0 / args.rate)
+	server.stdin.close()
+
+sender = threading.Thread(target=send)
+sender.start()
+
+responses = {}
+latencies = []
+first_word_latencies = []
+streamed = set()
+current = []
+for line in server.stdout:
+	line = line.rstrip('\n')
+	# With --stream, partial translations arrive on lines of their own
+	if ' ||| STREAM ||| ' in line:
+		sent_id = int(line.split('|||')[0])
+		if sent_id not in streamed:
+			streamed.add(sent_id)
+			first_word_latencies.append(time.time() - send_times[sent_id])
+		continue
+	if line:
+		current.append(line)
+		continue
+	# A blank line ends a response. Empty k-best lists can't be attributed to a
+	# request, so only non-empty ones are counted.
+	if current:
+		sent_id = int(current[0].split('|||')[0])
+		responses[sent_id] = current
+		latencies.append(time.time() - send_times[sent_id])
+	current = []
+
+sender.join()
+server.wait()
+
+for i in range(len(sentences)):
+	for line in responses.get(i, []):
+		print(line)
+
+def report(name, latencies):
+	latencies.sort()
+	def percentile(p):
+		return 1000.0 * latencies[min(len(latencies) - 1, int(p * len(latencies)))]
+	sys.stderr.write('%s (ms): mean %.1f, p50 %.1f, p90 %.1f, p99 %.1f, max %.1f\n' % (
+		name, 1000.0 * sum(latencies) / len(latencies), percentile(0.5), percentile(0.9), percentile(0.99), 1000.0 * latencies[-1]))
+
+if latencies:
+	sys.stderr.write('%d requests, %d answered\n' % (len(sentences), len(latencies)))
+	report('latency', latencies)
+if first_word_latencies:
+	report('time to first words', first_word_latencies)